@@ -9,8 +9,23 @@
 #include <teMIDI.h>
 #include <teCommon.h>
 #include <sgtl5000midi.h>
+#include "src/tehubMidi.h"
 #include "src/sgtl5000.h"
-// #include "src/midiHost.h"
+#include "src/usbDrift.h"
+#include "src/serialMidi.h"
+#include "src/serialMux.h"
+#include "src/deferLog.h"
+#include "src/midiHost.h"
+#include "src/midiOut.h"
+#include "src/stereoMixer.h"
+#include "src/memoryProbe.h"
+#include "src/latencyProbe.h"
+#include "src/configStore.h"
+#include "src/usbConnection.h"
+#include "src/usbTrace.h"
+#include "src/usbAudio.h"
+#include "src/controlBench.h"
+#include "src/ccCoalescer.h"
 
 
 #define	dbg_audio	0
@@ -21,6 +36,9 @@
 #define MIDI_SERIAL_PORT		Serial1
 
 void tehub_dumpCCValues(const char *where);
+void restoreConfig();
+void saveConfig();
+void controlBenchTask();
 	// forward
 
 
@@ -54,10 +72,103 @@ void tehub_dumpCCValues(const char *where);
 	//		allowing me to send a defined sine wave pattern to it.
 	// and if WITH_MIXERS it will also be sent to the MIX_AUX channel.
 
+#define WITH_ROUTER	1
+	// if 1, the mixer, the in_mix, and the fixed connections between them
+	// are replaced by one AudioStereoMatrix (src/stereoMixer.h), so any
+	// source (LINE_IN, usb_in, the Looper return, the sine) can go to any
+	// destination (the SGTL5000, usb_out, the Looper send), with each
+	// crosspoint turned on and off at runtime by a TEHUB_CC_ROUTE CC.
+	// The default routes are the same graph as WITH_ROUTER 0, and the
+	// MIX_XXX CCs still set the levels.  A destination with no routes on
+	// costs nothing, and the sine is only computed while one of its routes
+	// is on.  Requires WITH_MIXERS and WITH_SINE, for the MIX CCs and the sine.
+
+
+#define WITH_DRIFT_COMP	1
+	// if defined, adds an AudioUsbDrift object that steers the USB
+	// feedback endpoint from the measured I2S sample rate, to get
+	// rid of the slow usb_in overruns (pops). See src/usbDrift.h
+
+#define LOW_LATENCY		0
+	// Live monitoring profile.  The latency through the hub is mostly
+	// whole audio blocks (i2s_in, usb_out, usb_in, i2s_out each hold
+	// about one), and the USB audio buffering in the core is also sized
+	// in blocks, so smaller blocks shrink all of it at once.
+	// AUDIO_BLOCK_SAMPLES has to be the same in the core and every
+	// library, so it cannot be set here.  It has to go in the build
+	// flags (-DAUDIO_BLOCK_SAMPLES=32 or 64, in platform.local.txt
+	// for the IDE), and this just checks that it was.
+	// With tiny blocks a single USB slip is an audible glitch, so this
+	// requires WITH_DRIFT_COMP, and the fused stereo mixers keep the
+	// per block update() overhead from doubling.
+
+#define MEASURE_LATENCY	0
+	// Latency and jitter benchmark.  If 1, an AudioLatencyProbe replaces
+	// the sine in the in_mix to usb_out, sends a chirp four times a second,
+	// correlates the return, and loop() reports the mean latency, jitter,
+	// min and max every 100 iterations. See src/latencyProbe.h
+	// Requires WITH_SINE (it uses the sine's in_mix channel).
+#define LATENCY_FROM_LOOPER	0
+	// 0 = listen for the return on usb_in (hub -> iPad -> hub)
+	// 1 = on the Looper return, i2s_in channel 2 (hub -> iPad -> hub
+	//     -> Looper -> hub), which requires WITH_MIXERS
+
+#define CONTROL_BENCH	0
+	// Control path benchmark.  If 1, loop() ignores TE3 and instead
+	// replays bench_trace[] (EQ band, PEQ and mix pedal sweeps) through
+	// the same CC handling as handleSerialMidi(), and after each pass
+	// reports the CCs/sec, I2C transactions per CC, and the time taken
+	// by the CC handling, sgtl5000.loop(), and calcBiquad().
+	// See src/controlBench.h
+
+#define AUDIO_MEMORY_BLOCKS		100
+	// passed to AudioMemory().  Run once with AUDIO_MEMORY_CALIBRATE
+	// to find the smallest safe value for the active WITH_ options.
+#define AUDIO_MEMORY_CALIBRATE	0
+	// if 1, AudioMemoryProbes are added between the audio objects,
+	// setup() uses AUDIO_MEMORY_CALIBRATE_BLOCKS, telemetry leaves the
+	// peak alone, and loop() reports the per object usage and the
+	// minimum safe pool size after 10 seconds. See src/memoryProbe.h
+#define AUDIO_MEMORY_CALIBRATE_BLOCKS	200
+
+#define WITH_FAST_SERIAL	0
+	// 0 = MIDI_SERIAL_PORT at 115200 with the debug text sent raw
+	//		between control packets, as TE3 has always expected.
+	// 1 = FAST_SERIAL_BAUD with RTS/CTS flow control, and the debug
+	//		text framed in packets on SERIAL_DEBUG_CABLE (src/serialMux.h).
+	//		TE3 must be built to match. Note that the TLP521 opto coupler
+	//		on the ESP32 TX line (see sgtl5000.cpp enable()) is way too slow
+	//		for this, and needs to be replaced with a fast one (6N137) first.
+	// In both cases control packets go out before any queued debug text.
+
+#define FAST_SERIAL_BAUD		2000000
+#define FAST_SERIAL_RTS_PIN		2
+#define FAST_SERIAL_CTS_PIN		3
+	// RTS can be any pin. CTS must be a pin the core supports
+	// for Serial1 CTS, otherwise setup() will report an error.
 
-#define WITH_MIDI_HOST 	0
 #define SPOOF_FTP		0
 	// vestigial
+
+#define WITH_CONFIG_STORE	1
+	// if 1, the TEHUB_CC_SAVE_CONFIG command saves the SGTL5000 and
+	// mixer settings to EEPROM, and setup() puts them back right after
+	// the defaults, so the hub comes up the way it was without waiting
+	// for TE3.  Only on the command, as writing the flash glitches the
+	// audio. See src/configStore.h
+
+#define USB_AUDIO_LAZY		1
+	// if 1, setup() brings up the codec and the audio graph before USB,
+	// and the connections to usb_in and usb_out are only made once the
+	// host configures us (src/usbConnection.h).  Until then the LINE_IN
+	// monitor (MIX_CHANNEL_IN) is at least STANDALONE_MONITOR_LEVEL,
+	// so the hub passes the guitar through with no host attached.
+	// 0 = the old way, USB first, and a fixed graph.
+#define STANDALONE_MONITOR_LEVEL	100
+
+#define USB_SERIAL_WAIT_MS	2000
+	// if DEBUG_TO_USB_SERIAL, how long setup() waits
+	// for the laptop to open the port
 	
 
 #define DEFAULT_VOLUME_IN		0		// listen to the raw LINE_IN signal
@@ -88,113 +199,312 @@ void tehub_dumpCCValues(const char *where);
 #define MIX_CHANNEL_IN_USB  	4		// amount of i2s_in->usb_out;  channel 0 from perspective of in_mixers
 #define MIX_CHANNEL_IN_SINE		5		// amount of sine->usb_out;    channel 1 from perspective of in_mixers
 
+#if WITH_ROUTER
+	// the ROUTE_SRC_XXX and ROUTE_DST_XXX numbers
+	// are in src/tehubMidi.h, as TE3 has to know them
+
+	#if USB_AUDIO_CHANNELS == 4
+		#define ROUTE_NUM_SRCS	5
+		#define ROUTE_NUM_DSTS	4
+	#else
+		#define ROUTE_NUM_SRCS	4
+		#define ROUTE_NUM_DSTS	3
+	#endif
+#endif
+
+#if LOW_LATENCY
+	#if AUDIO_BLOCK_SAMPLES > 64
+		#error LOW_LATENCY requires building with -DAUDIO_BLOCK_SAMPLES=32 or 64
+	#endif
+	#if !WITH_DRIFT_COMP
+		#error LOW_LATENCY requires WITH_DRIFT_COMP
+	#endif
+#endif
+
+#if MEASURE_LATENCY && !WITH_SINE
+	#error MEASURE_LATENCY requires WITH_SINE
+#endif
+#if MEASURE_LATENCY && LATENCY_FROM_LOOPER && !WITH_MIXERS
+	#error LATENCY_FROM_LOOPER requires WITH_MIXERS
+#endif
+#if WITH_ROUTER && !(WITH_MIXERS && WITH_SINE)
+	#error WITH_ROUTER requires WITH_MIXERS and WITH_SINE
+#endif
+
+
 // audio vars
 
+#if USB_AUDIO_LAZY
+	#define UsbConnection	usbAudioConnection
+#else
+	#define UsbConnection	AudioConnection
+#endif
+	// for every connection to or from usb_in or usb_out
+
+#if USB_AUDIO_CORE
+	#define UsbAudioIn		AudioInputUSB
+	#define UsbAudioOut		AudioOutputUSB
+#else
+	#define UsbAudioIn		AudioInputUSBStream
+	#define UsbAudioOut		AudioOutputUSBStream
+#endif
+	// the USB audio format (rate, bits, channels) is set in src/usbAudio.h.
+	// With USB_AUDIO_CHANNELS 4, channels 0,1 are as always, and 2,3 are
+	// the Looper both ways: the host gets the Looper return (i2s_in 2,3)
+	// as its own pair, and its usb_in 2,3 go to the Looper send (i2s_out 2,3)
+	// instead of usb_in 0,1.
+
 
 uint8_t mix_level[NUM_MIXER_CHANNELS];
 
 SGTL5000 sgtl5000;
 
 AudioInputI2SQuad       i2s_in;
+#if AUDIO_MEMORY_CALIBRATE
+	AudioMemoryProbe	probe_i2s_in("i2s_in");
+#endif
 AudioOutputI2SQuad      i2s_out;
-AudioInputUSB   		usb_in;
-AudioOutputUSB  		usb_out;
-#if WITH_MIXERS
-	AudioMixer4			mixer_L;
-	AudioMixer4			mixer_R;
+#if AUDIO_MEMORY_CALIBRATE
+	AudioMemoryProbe	probe_i2s_out("i2s_out");
 #endif
-#if WITH_SINE
-	AudioMixer4			in_mix_L;
-	AudioMixer4			in_mix_R;
+UsbAudioIn				usb_in;
+#if WITH_DRIFT_COMP
+	AudioUsbDrift		usb_drift;
+		// must be declared after usb_in
+#endif
+#if AUDIO_MEMORY_CALIBRATE
+	AudioMemoryProbe	probe_usb_in("usb_in");
+#endif
+UsbAudioOut				usb_out;
+#if AUDIO_MEMORY_CALIBRATE
+	AudioMemoryProbe	probe_usb_out("usb_out");
+#endif
+#if WITH_ROUTER
 	AudioSynthWaveformSine  sine;
+#else
+	#if WITH_MIXERS
+		AudioStereoMixer4	mixer;
+	#endif
+	#if WITH_SINE
+		AudioStereoMixer<2>	in_mix;
+		AudioSynthWaveformSine  sine;
+	#endif
+#endif
+#if MEASURE_LATENCY
+	AudioLatencyProbe	latency_probe;
+	#if LATENCY_FROM_LOOPER
+		AudioConnection	c_latency(i2s_in, 2, latency_probe, 0);		// Looper --> latency probe
+	#else
+		UsbConnection	c_latency(usb_in, 0, latency_probe, 0);		// USB_in --> latency probe
+	#endif
+#endif
+#if WITH_ROUTER
+	AudioStereoMatrix<ROUTE_NUM_SRCS,ROUTE_NUM_DSTS> router;
+		// after all of its sources in update() order
+#endif
+#if AUDIO_MEMORY_CALIBRATE && (WITH_MIXERS || WITH_SINE)
+	AudioMemoryProbe	probe_mixers("mixers");
 #endif
 
 
-#if WITH_MIXERS
-
-	AudioConnection	c_i1(i2s_in,  0, mixer_L, MIX_CHANNEL_IN);			// SGTL5000 LINE_IN --> out_mixer(0)
-	AudioConnection	c_i2(i2s_in,  1, mixer_R, MIX_CHANNEL_IN);
+#if WITH_ROUTER
 
-	#if !WITH_SINE
-		AudioConnection c_in1(i2s_in, 0, usb_out, 0);					// STGTL5000 LINE_IN --> USB_out
-		AudioConnection c_in2(i2s_in, 1, usb_out, 1);
+	AudioConnection	c_r1(i2s_in,  0, router, STEREO_L(ROUTE_SRC_IN));		// SGTL5000 LINE_IN --> router
+	AudioConnection	c_r2(i2s_in,  1, router, STEREO_R(ROUTE_SRC_IN));
+	UsbConnection	c_r3(usb_in,  0, router, STEREO_L(ROUTE_SRC_USB));		// USB_in --> router
+	UsbConnection	c_r4(usb_in,  1, router, STEREO_R(ROUTE_SRC_USB));
+	AudioConnection	c_r5(i2s_in,  2, router, STEREO_L(ROUTE_SRC_LOOP));		// Looper --> router
+	AudioConnection	c_r6(i2s_in,  3, router, STEREO_R(ROUTE_SRC_LOOP));
+	#if MEASURE_LATENCY
+		AudioConnection c_r7(latency_probe, 0, router, STEREO_L(ROUTE_SRC_SINE));	// click --> router
+		AudioConnection c_r8(latency_probe, 0, router, STEREO_R(ROUTE_SRC_SINE));
 	#else
-		AudioConnection c_in1(i2s_in, 0, in_mix_L, 0);					// STGTL5000 LINE_IN --> in_mixer(0)
-		AudioConnection c_in2(i2s_in, 1, in_mix_R, 0);
+		AudioConnection c_r7(sine, 0, router, STEREO_L(ROUTE_SRC_SINE));		// sine --> router
+		AudioConnection c_r8(sine, 0, router, STEREO_R(ROUTE_SRC_SINE));
+	#endif
+
+	AudioConnection	c_o1(router, STEREO_L(ROUTE_DST_CODEC), i2s_out, 0);	// router --> SGTL5000
+	AudioConnection	c_o2(router, STEREO_R(ROUTE_DST_CODEC), i2s_out, 1);
+	UsbConnection	c_o3(router, STEREO_L(ROUTE_DST_USB),   usb_out, 0);	// router --> USB_out
+	UsbConnection	c_o4(router, STEREO_R(ROUTE_DST_USB),   usb_out, 1);
+	AudioConnection	c_o5(router, STEREO_L(ROUTE_DST_LOOP),  i2s_out, 2);	// router --> Looper
+	AudioConnection	c_o6(router, STEREO_R(ROUTE_DST_LOOP),  i2s_out, 3);
+
+	#if USB_AUDIO_CHANNELS == 4
+		UsbConnection c_q1(usb_in, 2, router, STEREO_L(ROUTE_SRC_USB2));	// USB_in(2,3) --> router
+		UsbConnection c_q2(usb_in, 3, router, STEREO_R(ROUTE_SRC_USB2));
+		UsbConnection c_q3(router, STEREO_L(ROUTE_DST_USB2), usb_out, 2);	// router --> USB_out(2,3)
+		UsbConnection c_q4(router, STEREO_R(ROUTE_DST_USB2), usb_out, 3);
+	#endif
 
-		AudioConnection c_usb1(in_mix_L, 0, usb_out, 0);				// in_mixers --> usb_out
-		AudioConnection c_usb2(in_mix_R, 0, usb_out, 1);
+#elif WITH_MIXERS
 
-		AudioConnection c_sine1(sine, 0, mixer_L, MIX_CHANNEL_AUX);		// sine --> out_mixer(3)
-		AudioConnection c_sine2(sine, 0, mixer_R, MIX_CHANNEL_AUX);
-		AudioConnection c_sine3(sine, 0, in_mix_L, 1);					// sine --> in_mixer(1)
-		AudioConnection c_sine4(sine, 0, in_mix_R, 1);
+	AudioConnection	c_i1(i2s_in,  0, mixer, STEREO_L(MIX_CHANNEL_IN));	// SGTL5000 LINE_IN --> out_mixer(0)
+	AudioConnection	c_i2(i2s_in,  1, mixer, STEREO_R(MIX_CHANNEL_IN));
+
+	#if !WITH_SINE
+		UsbConnection c_in1(i2s_in, 0, usb_out, 0);					// STGTL5000 LINE_IN --> USB_out
+		UsbConnection c_in2(i2s_in, 1, usb_out, 1);
+	#else
+		AudioConnection c_in1(i2s_in, 0, in_mix, STEREO_L(0));			// STGTL5000 LINE_IN --> in_mixer(0)
+		AudioConnection c_in2(i2s_in, 1, in_mix, STEREO_R(0));
+
+		UsbConnection c_usb1(in_mix, 0, usb_out, 0);					// in_mixer --> usb_out
+		UsbConnection c_usb2(in_mix, 1, usb_out, 1);
+
+		AudioConnection c_sine1(sine, 0, mixer, STEREO_L(MIX_CHANNEL_AUX));	// sine --> out_mixer(3)
+		AudioConnection c_sine2(sine, 0, mixer, STEREO_R(MIX_CHANNEL_AUX));
+		#if MEASURE_LATENCY
+			AudioConnection c_sine3(latency_probe, 0, in_mix, STEREO_L(1));	// click --> in_mixer(1)
+			AudioConnection c_sine4(latency_probe, 0, in_mix, STEREO_R(1));
+		#else
+			AudioConnection c_sine3(sine, 0, in_mix, STEREO_L(1));		// sine --> in_mixer(1)
+			AudioConnection c_sine4(sine, 0, in_mix, STEREO_R(1));
+		#endif
 	#endif
 
 
-	AudioConnection	c_ul(usb_in,  0, mixer_L, MIX_CHANNEL_USB);			// USB_in --> out_mixer(1)
-	AudioConnection	c_ur(usb_in,  1, mixer_R, MIX_CHANNEL_USB);
-	AudioConnection c_q1(usb_in,  0, i2s_out, 2);						// USB_in --> Looper
-	AudioConnection c_q2(usb_in,  1, i2s_out, 3);
-	AudioConnection c_q3(i2s_in,  2, mixer_L, MIX_CHANNEL_LOOP);		// Looper --> out_mixer(2)
-	AudioConnection c_q4(i2s_in,  3, mixer_R, MIX_CHANNEL_LOOP);
-	AudioConnection c_o1(mixer_L, 0, i2s_out, 0);						// out_mixers --> SGTL5000
-	AudioConnection c_o2(mixer_R, 0, i2s_out, 1);
+	UsbConnection	c_ul(usb_in,  0, mixer, STEREO_L(MIX_CHANNEL_USB));	// USB_in --> out_mixer(1)
+	UsbConnection	c_ur(usb_in,  1, mixer, STEREO_R(MIX_CHANNEL_USB));
+	#if USB_AUDIO_CHANNELS == 4
+		UsbConnection c_q1(usb_in,  2, i2s_out, 2);					// USB_in(2,3) --> Looper
+		UsbConnection c_q2(usb_in,  3, i2s_out, 3);
+		UsbConnection c_q5(i2s_in,  2, usb_out, 2);					// Looper --> USB_out(2,3)
+		UsbConnection c_q6(i2s_in,  3, usb_out, 3);
+	#else
+		UsbConnection c_q1(usb_in,  0, i2s_out, 2);					// USB_in --> Looper
+		UsbConnection c_q2(usb_in,  1, i2s_out, 3);
+	#endif
+	AudioConnection c_q3(i2s_in,  2, mixer, STEREO_L(MIX_CHANNEL_LOOP));	// Looper --> out_mixer(2)
+	AudioConnection c_q4(i2s_in,  3, mixer, STEREO_R(MIX_CHANNEL_LOOP));
+	AudioConnection c_o1(mixer, 0, i2s_out, 0);							// out_mixer --> SGTL5000
+	AudioConnection c_o2(mixer, 1, i2s_out, 1);
 
 #else	// no mixers; no looper; stripped version
 
 	#if !WITH_SINE
 
-		AudioConnection	c_i1(i2s_in, 0, usb_out, 0);					// SGTL5000 LINE_IN --> usb_out
-		AudioConnection	c_i2(i2s_in, 1, usb_out, 1);
+		UsbConnection	c_i1(i2s_in, 0, usb_out, 0);					// SGTL5000 LINE_IN --> usb_out
+		UsbConnection	c_i2(i2s_in, 1, usb_out, 1);
 
 	#else
 
-		AudioConnection	c_i1(i2s_in, 	0, in_mix_L, 0);				// SGTL5000 LINE_IN --> in_mixer(0)
-		AudioConnection	c_i2(i2s_in, 	1, in_mix_R, 0);
-		AudioConnection c_s1(sine, 	 	0, in_mix_L, 1);				// sine --> in_mixer(1)
-		AudioConnection c_s2(sine, 	 	0, in_mix_R, 1);
-		AudioConnection	c_u1(in_mix_L,	0, usb_out, 0);					// in_mixers --> usb_out
-		AudioConnection	c_u2(in_mix_R,  0, usb_out, 1);
+		AudioConnection	c_i1(i2s_in, 	0, in_mix, STEREO_L(0));		// SGTL5000 LINE_IN --> in_mixer(0)
+		AudioConnection	c_i2(i2s_in, 	1, in_mix, STEREO_R(0));
+		#if MEASURE_LATENCY
+			AudioConnection c_s1(latency_probe, 0, in_mix, STEREO_L(1));	// click --> in_mixer(1)
+			AudioConnection c_s2(latency_probe, 0, in_mix, STEREO_R(1));
+		#else
+			AudioConnection c_s1(sine, 	 	0, in_mix, STEREO_L(1));	// sine --> in_mixer(1)
+			AudioConnection c_s2(sine, 	 	0, in_mix, STEREO_R(1));
+		#endif
+		UsbConnection	c_u1(in_mix,	0, usb_out, 0);					// in_mixer --> usb_out
+		UsbConnection	c_u2(in_mix,	1, usb_out, 1);
 
 	#endif
 
-	AudioConnection c_o1(usb_in, 0, i2s_out, 0);						// usb_in --> SGTL5000
-	AudioConnection c_o2(usb_in, 1, i2s_out, 1);
+	UsbConnection c_o1(usb_in, 0, i2s_out, 0);						// usb_in --> SGTL5000
+	UsbConnection c_o2(usb_in, 1, i2s_out, 1);
+	#if USB_AUDIO_CHANNELS == 4
+		UsbConnection c_o3(usb_in, 2, i2s_out, 2);					// usb_in(2,3) <--> Looper
+		UsbConnection c_o4(usb_in, 3, i2s_out, 3);
+		UsbConnection c_o5(i2s_in, 2, usb_out, 2);
+		UsbConnection c_o6(i2s_in, 3, usb_out, 3);
+	#endif
 
 #endif
 
 
 
+static uint8_t monitorLevel(uint8_t val)
+	// what actually goes to the MIX_CHANNEL_IN gain.
+	// mix_level[] is still what was asked for.
+{
+	#if USB_AUDIO_LAZY
+		if (!usbAudioConnection::connected() &&
+			val < STANDALONE_MONITOR_LEVEL)
+			return STANDALONE_MONITOR_LEVEL;
+	#endif
+	return val;
+}
+
+
+#if WITH_ROUTER
+
+	static const uint8_t mix_route[NUM_MIXER_CHANNELS][2] = {
+		{ ROUTE_SRC_IN,		ROUTE_DST_CODEC },		// MIX_CHANNEL_IN
+		{ ROUTE_SRC_USB,	ROUTE_DST_CODEC },		// MIX_CHANNEL_USB
+		{ ROUTE_SRC_LOOP,	ROUTE_DST_CODEC },		// MIX_CHANNEL_LOOP
+		{ ROUTE_SRC_SINE,	ROUTE_DST_CODEC },		// MIX_CHANNEL_AUX
+		{ ROUTE_SRC_IN,		ROUTE_DST_USB },		// MIX_CHANNEL_IN_USB
+		{ ROUTE_SRC_SINE,	ROUTE_DST_USB }, };		// MIX_CHANNEL_IN_SINE
+		// the router crosspoint each mix channel sets the level of
+
+	static void initRoutes()
+		// the same graph as WITH_ROUTER 0.
+		// Everything else is off, at unity.
+	{
+		router.route(ROUTE_SRC_IN,		ROUTE_DST_CODEC,	true);
+		router.route(ROUTE_SRC_USB,		ROUTE_DST_CODEC,	true);
+		router.route(ROUTE_SRC_LOOP,	ROUTE_DST_CODEC,	true);
+		router.route(ROUTE_SRC_SINE,	ROUTE_DST_CODEC,	true);
+		router.route(ROUTE_SRC_IN,		ROUTE_DST_USB,		true);
+		router.route(ROUTE_SRC_SINE,	ROUTE_DST_USB,		true);
+		#if USB_AUDIO_CHANNELS == 4
+			router.route(ROUTE_SRC_USB2,	ROUTE_DST_LOOP,		true);
+			router.route(ROUTE_SRC_LOOP,	ROUTE_DST_USB2,		true);
+		#else
+			router.route(ROUTE_SRC_USB,		ROUTE_DST_LOOP,		true);
+		#endif
+	}
+
+#endif
+
+
 bool setMixLevel(uint8_t channel, uint8_t val)
 {
-	display(dbg_audio,"setMixLevel(%d,%d)",channel,val);
+	defer_display(dbg_audio,"setMixLevel(%d,%d)",channel,val);
 	if (val > 127) val = 127;
 	float vol = val;
 	vol = vol/100;
 
-	#if WITH_SINE
-		if (channel >= MIX_CHANNEL_IN_USB && channel <= MIX_CHANNEL_IN_SINE)
-		{
-			uint8_t in_channel = channel - MIX_CHANNEL_IN_USB;
-			in_mix_L.gain(in_channel,vol);
-			in_mix_R.gain(in_channel,vol);
-			mix_level[channel] = val;
-			return true;
-		}
-	#endif
+	#if WITH_ROUTER
 
-	#if WITH_MIXERS
-		if (channel >= MIX_CHANNEL_IN && channel <= MIX_CHANNEL_AUX)
+		if (channel < NUM_MIXER_CHANNELS)
 		{
-			mixer_L.gain(channel, vol);
-			mixer_R.gain(channel, vol);
 			mix_level[channel] = val;
+			if (channel == MIX_CHANNEL_IN)
+				vol = monitorLevel(val) / 100.0;
+			router.gain(mix_route[channel][0],mix_route[channel][1],vol);
 			return true;
 		}
+
+	#else
+
+		#if WITH_SINE
+			if (channel >= MIX_CHANNEL_IN_USB && channel <= MIX_CHANNEL_IN_SINE)
+			{
+				uint8_t in_channel = channel - MIX_CHANNEL_IN_USB;
+				in_mix.gain(in_channel,vol);
+				mix_level[channel] = val;
+				return true;
+			}
+		#endif
+
+		#if WITH_MIXERS
+			if (channel >= MIX_CHANNEL_IN && channel <= MIX_CHANNEL_AUX)
+			{
+				mix_level[channel] = val;
+				if (channel == MIX_CHANNEL_IN)
+					vol = monitorLevel(val) / 100.0;
+				mixer.gain(channel, vol);
+				return true;
+			}
+		#endif
+
 	#endif
 
-	my_error("unimplmented mix_channel(%d)",channel);
+	defer_error("unimplmented mix_channel(%d)",channel);
 	return false;
 }
 
@@ -241,6 +551,21 @@ bool setMixLevel(uint8_t channel, uint8_t val)
 	}
 
 
+	static void setSineAmplitude(float level)
+		// AudioSynthWaveformSine skips its update() at amplitude(0),
+		// so with the router it is kept there unless it is routed
+	{
+		#if WITH_ROUTER
+			bool routed = false;
+			for (int dst=0; dst<ROUTE_NUM_DSTS; dst++)
+				routed = routed || router.routed(ROUTE_SRC_SINE,dst);
+			if (!routed)
+				level = 0;
+		#endif
+		sine.amplitude(level);
+	}
+
+
 	float calc_pct(uint32_t now, uint32_t secs)
 	{
 		float num = (now - sine_phase_time);
@@ -260,7 +585,7 @@ bool setMixLevel(uint8_t channel, uint8_t val)
 				{
 					sine_phase = SINE_PHASE_ATTACK;
 					sine_phase_time = now;
-					display(dbg_sine,"sine_attack",0);
+					defer_display(dbg_sine,"sine_attack",0);
 				}
 				break;
 			case SINE_PHASE_ATTACK:
@@ -268,11 +593,11 @@ bool setMixLevel(uint8_t channel, uint8_t val)
 				{
 					sine_phase = SINE_PHASE_DUR;
 					sine_phase_time = now;
-					display(dbg_sine,"sine_dur",0);
+					defer_display(dbg_sine,"sine_dur",0);
 				}
 				else
 				{
-					sine.amplitude(SINE_VOL * calc_pct(now,SINE_ATTACK));
+					setSineAmplitude(SINE_VOL * calc_pct(now,SINE_ATTACK));
 				}
 				break;
 			case SINE_PHASE_DUR:
@@ -280,7 +605,12 @@ bool setMixLevel(uint8_t channel, uint8_t val)
 				{
 					sine_phase = SINE_PHASE_DECAY;
 					sine_phase_time = now;
-					display(dbg_sine,"sine_decay",0);
+					defer_display(dbg_sine,"sine_decay",0);
+				}
+				else
+				{
+					setSineAmplitude(SINE_VOL);
+						// so a route change takes effect here too
 				}
 				break;
 			case SINE_PHASE_DECAY:
@@ -288,12 +618,12 @@ bool setMixLevel(uint8_t channel, uint8_t val)
 				{
 					sine_phase = SINE_PHASE_OFF;
 					sine_phase_time = now;
-					display(dbg_sine,"sine_off",0);
-					sine.amplitude(0.00);
+					defer_display(dbg_sine,"sine_off",0);
+					setSineAmplitude(0.00);
 				}
 				else
 				{
-					sine.amplitude(SINE_VOL * (1.0 - calc_pct(now,SINE_DECAY)));
+					setSineAmplitude(SINE_VOL * (1.0 - calc_pct(now,SINE_DECAY)));
 				}
 				break;
 		}
@@ -303,6 +633,245 @@ bool setMixLevel(uint8_t channel, uint8_t val)
 
 
 
+//----------------------------------------------
+// telemetry
+//-----------------------------------------------
+// A compact binary health record that is pushed to TE3 as a single
+// SysEx message on the TEHUB_CABLE every telemetry_period*100 ms.
+// TE3 can graph it live, and it is useful for finding dropouts without
+// recompiling with the #if 0 block in loop() turned on.
+//
+// TEHUB_CC_TELEMETRY (src/tehubMidi.h) sets the period in 100ms units,
+// 0 = off (default).
+//
+// Collection is just a few counters and compares in loop(), read()
+// and write(). Nothing here calls display(); the record is written
+// directly to the MIDI_SERIAL_PORT from loop() as USB-MIDI style
+// 4 byte SysEx packets, the same framing TE3 sends us.
+//
+//	F0 7D 01 01		non-commercial manufacturer id, record type, version
+//	then 14 bit fields, msb 7 bits first, saturated at 16383:
+//		usb_in underruns since last record
+//		usb_in overruns since last record
+//		AudioProcessorUsageMax() * 100
+//		AudioMemoryUsageMax()
+//		loop() min iteration time in us
+//		loop() max iteration time in us
+//		SGTL5000 I2C transactions since last record
+//		SGTL5000 I2C failures since last record
+//		SGTL5000 longest I2C transaction in us
+//		usb drift in ppm + 8192 (8192 if !WITH_DRIFT_COMP)
+//		serial midi sync bytes + dropped packets since last record (version 2)
+//	F7
+
+#define TELEMETRY_SYSEX_ID		0x7D
+#define TELEMETRY_RECORD		0x01
+#define TELEMETRY_VERSION		0x02
+#define TELEMETRY_NUM_FIELDS	11
+
+#define SCENE_RECORD			0x02
+#define SCENE_VERSION			0x01
+	// incoming scene recall, see handleScene()
+
+extern volatile uint32_t usb_audio_underrun_count;
+extern volatile uint32_t usb_audio_overrun_count;
+
+uint8_t telemetry_period = 0;
+uint32_t telemetry_time = 0;
+uint32_t telemetry_last_underrun = 0;
+uint32_t telemetry_last_overrun = 0;
+uint32_t telemetry_last_serial = 0;
+uint32_t loop_last_us = 0;
+uint32_t loop_min_us = 0xffffffff;
+uint32_t loop_max_us = 0;
+
+
+inline void telemetryLoopTime()
+	// called at the top of every loop()
+{
+	uint32_t now = micros();
+	if (loop_last_us)
+	{
+		uint32_t elapsed = now - loop_last_us;
+		if (elapsed < loop_min_us) loop_min_us = elapsed;
+		if (elapsed > loop_max_us) loop_max_us = elapsed;
+	}
+	loop_last_us = now;
+}
+
+
+void sendSysex(const uint8_t *data, int len)
+	// sends a complete F0..F7 message as 4 byte packets:
+	// CIN 0x4 = start/continue, 0x5/0x6/0x7 = ends with 1/2/3 bytes
+{
+	uint8_t packet[4];
+	while (len > 0)
+	{
+		int n = len > 3 ? 3 : len;
+		uint8_t cin = len > 3 ? 0x4 : 0x4 + n;
+		packet[0] = (TEHUB_CABLE << 4) | cin;
+		packet[1] = data[0];
+		packet[2] = n > 1 ? data[1] : 0;
+		packet[3] = n > 2 ? data[2] : 0;
+		serial_mux.writeControl(packet);
+		data += n;
+		len -= n;
+	}
+}
+
+
+void handleTelemetry()
+{
+	if (!telemetry_period ||
+		millis() - telemetry_time < 100 * (uint32_t) telemetry_period)
+		return;
+	telemetry_time = millis();
+
+	uint32_t fields[TELEMETRY_NUM_FIELDS];
+	uint32_t underruns = usb_audio_underrun_count;
+	uint32_t overruns = usb_audio_overrun_count;
+
+	fields[0] = underruns - telemetry_last_underrun;
+	fields[1] = overruns - telemetry_last_overrun;
+	fields[2] = AudioProcessorUsageMax() * 100;
+	fields[3] = AudioMemoryUsageMax();
+	fields[4] = loop_min_us == 0xffffffff ? 0 : loop_min_us;
+	fields[5] = loop_max_us;
+	sgtl5000.getI2CStats(&fields[6],&fields[7],&fields[8]);
+	#if WITH_DRIFT_COMP
+		int32_t ppm = usb_drift.ratePPM();
+		if (ppm < -8192) ppm = -8192;
+		if (ppm > 8191) ppm = 8191;
+		fields[9] = ppm + 8192;
+	#else
+		fields[9] = 8192;
+	#endif
+	uint32_t serial_errors = serial_midi.syncErrors() + serial_midi.overflows();
+	fields[10] = serial_errors - telemetry_last_serial;
+	telemetry_last_serial = serial_errors;
+
+	telemetry_last_underrun = underruns;
+	telemetry_last_overrun = overruns;
+	AudioProcessorUsageMaxReset();
+	#if !AUDIO_MEMORY_CALIBRATE
+		AudioMemoryUsageMaxReset();
+	#endif
+	loop_min_us = 0xffffffff;
+	loop_max_us = 0;
+
+	uint8_t sysex[5 + TELEMETRY_NUM_FIELDS * 2];
+	uint8_t *p = sysex;
+	*p++ = 0xF0;
+	*p++ = TELEMETRY_SYSEX_ID;
+	*p++ = TELEMETRY_RECORD;
+	*p++ = TELEMETRY_VERSION;
+	for (int i=0; i<TELEMETRY_NUM_FIELDS; i++)
+	{
+		uint32_t val = fields[i] > 16383 ? 16383 : fields[i];
+		*p++ = (val >> 7) & 0x7f;
+		*p++ = val & 0x7f;
+	}
+	*p++ = 0xF7;
+	sendSysex(sysex, p - sysex);
+}
+
+
+
+//-----------------------------------------------
+// USB trace dump
+//-----------------------------------------------
+// With USB_TRACE (src/usbTrace.h), a usb_in underrun or overrun, or
+// the TEHUB_CC_USB_TRACE command (src/tehubMidi.h), triggers the
+// trace, and once it has frozen it goes to TE3, USB_TRACE_PER_SYSEX
+// events per SysEx message, only as fast as the serial_mux has room
+// for them:
+//
+//	F0 7D 03 01		non-commercial manufacturer id, record type, version
+//	first event number, 14 bits, msb 7 bits first
+//	number of events in the trace, 14 bits
+//	then for each event, the cycles and info words (see usbTrace.h)
+//		as five 7 bit bytes each, msb first
+//	F7
+//
+// The cycles are ARM_DWT_CYCCNT, F_CPU_ACTUAL per second.
+
+#define USB_TRACE_RECORD		0x03
+#define USB_TRACE_VERSION		0x01
+#define USB_TRACE_PER_SYSEX		8
+
+#define USB_TRACE_CAUSE_UNDERRUN	1
+#define USB_TRACE_CAUSE_OVERRUN		2
+#define USB_TRACE_CAUSE_COMMAND		3
+	// the arg of the USB_TRACE_TRIGGER event
+
+
+#if USB_TRACE
+
+	static uint8_t *put32(uint8_t *p, uint32_t val)
+	{
+		for (int shift=28; shift>=0; shift-=7)
+			*p++ = (val >> shift) & 0x7f;
+		return p;
+	}
+
+	void handleUsbTrace()
+	{
+		static uint32_t last_underrun = 0;
+		static uint32_t last_overrun = 0;
+		static int sent = 0;
+
+		uint32_t underruns = usb_audio_underrun_count;
+		uint32_t overruns = usb_audio_overrun_count;
+		if (underruns != last_underrun)
+			usb_trace_trigger(USB_TRACE_CAUSE_UNDERRUN);
+		if (overruns != last_overrun)
+			usb_trace_trigger(USB_TRACE_CAUSE_OVERRUN);
+		last_underrun = underruns;
+		last_overrun = overruns;
+
+		if (!usb_trace_frozen())
+			return;
+
+		int count = usb_trace_count();
+		int n = count - sent;
+		if (n > USB_TRACE_PER_SYSEX)
+			n = USB_TRACE_PER_SYSEX;
+		int len = 9 + n * 10;
+		if (serial_mux.controlFree() < (len + 2) / 3)
+			return;
+
+		uint8_t sysex[9 + USB_TRACE_PER_SYSEX * 10];
+		uint8_t *p = sysex;
+		*p++ = 0xF0;
+		*p++ = TELEMETRY_SYSEX_ID;
+		*p++ = USB_TRACE_RECORD;
+		*p++ = USB_TRACE_VERSION;
+		*p++ = (sent >> 7) & 0x7f;
+		*p++ = sent & 0x7f;
+		*p++ = (count >> 7) & 0x7f;
+		*p++ = count & 0x7f;
+		for (int i=0; i<n; i++)
+		{
+			uint32_t cycles, info;
+			usb_trace_get(sent + i, &cycles, &info);
+			p = put32(p,cycles);
+			p = put32(p,info);
+		}
+		*p++ = 0xF7;
+		sendSysex(sysex, p - sysex);
+
+		sent += n;
+		if (sent >= count)
+		{
+			sent = 0;
+			usb_trace_rearm();
+		}
+	}
+
+#endif
+
+
+
 
 
 //=================================================
@@ -320,6 +889,7 @@ extern "C" {
 void reboot_teensy()
 {
 	warning(0,"REBOOTING TE_HUB!",0);
+	serial_mux.flush();
 	delay(300);
 	SCB_AIRCR = 0x05FA0004;
 	SCB_AIRCR = 0x05FA0004;
@@ -328,45 +898,24 @@ void reboot_teensy()
 
 
 
-void setup()
+void initUsb()
+	// USB device, midi host, and the USB debug port.
+	// Called before or after the audio, see USB_AUDIO_LAZY
 {
-	#if FLASH_PIN
-		pinMode(FLASH_PIN,OUTPUT);
-		digitalWrite(FLASH_PIN,1);
-	#endif
-
-	//-----------------------------------------
-	// initialize MIDI_SERIAL_PORT
-	//-----------------------------------------
-
-	setColorString(COLOR_CONST_DEFAULT, "\033[94m");	// bright blue
-        // TE3_hub's normal display color is bright blue
-        // TE3's normal (default) display color is green
-        // Looper's normal display color, is cyan, I think
-
-	MIDI_SERIAL_PORT.begin(115200);		// Serial1
-	#if HOW_DEBUG_OUTPUT == DEBUG_TO_MIDI_SERIAL
-		delay(500);
-		dbgSerial = &MIDI_SERIAL_PORT;
-		display(0,"TE3_hub.ino setup() started on MIDI_SERIAL_PORT",0);
-	#endif
-
-	//-----------------------
-	// initialize usb
-	//-----------------------
-
 	#if SPOOF_FTP	// vestigial
 		setFTPDescriptors();
     #endif
 
-    delay(500);
 	my_usb_init();
+		// does not wait for enumeration, which carries
+		// on by itself in the USB interrupt
+	midi_out.begin();
 
 	#if FLASH_PIN
 		digitalWrite(FLASH_PIN,0);
 	#endif
 
-	#if WITH_MIDI_HOST   // vestigial
+	#if WITH_MIDI_HOST
 		display(0,"initilizing midiHost",0);
 		midi_host.init();
 	#endif
@@ -377,24 +926,75 @@ void setup()
 	//---------------------------------
 
 	#if HOW_DEBUG_OUTPUT == DEBUG_TO_USB_SERIAL
-		delay(500);
 		USB_SERIAL_PORT.begin(115200);		// Serial.begin()
+		uint32_t usb_wait = millis();
+		while (!USB_SERIAL_PORT && millis() - usb_wait < USB_SERIAL_WAIT_MS) ;
+			// true once enumerated and the port is opened
+		display(0,"TE3_hub.ino setup() started on USB_SERIAL_PORT after %d ms",millis() - usb_wait);
+	#endif
+}
+
+
+
+void setup()
+{
+	#if FLASH_PIN
+		pinMode(FLASH_PIN,OUTPUT);
+		digitalWrite(FLASH_PIN,1);
+	#endif
+
+	//-----------------------------------------
+	// initialize MIDI_SERIAL_PORT
+	//-----------------------------------------
+
+	setColorString(COLOR_CONST_DEFAULT, "\033[94m");	// bright blue
+        // TE3_hub's normal display color is bright blue
+        // TE3's normal (default) display color is green
+        // Looper's normal display color, is cyan, I think
+
+	#if WITH_FAST_SERIAL
+		MIDI_SERIAL_PORT.begin(FAST_SERIAL_BAUD);
+		bool rts_ok = MIDI_SERIAL_PORT.attachRts(FAST_SERIAL_RTS_PIN);
+		bool cts_ok = MIDI_SERIAL_PORT.attachCts(FAST_SERIAL_CTS_PIN);
+	#else
+		MIDI_SERIAL_PORT.begin(115200);		// Serial1
+	#endif
+	serial_mux.begin(&MIDI_SERIAL_PORT, WITH_FAST_SERIAL);
+	serial_midi.begin(&MIDI_SERIAL_PORT,
+		(1 << SGTL5000_CABLE) | (1 << TEHUB_CABLE),
+		(1 << MIDI_TYPE_CC) | (0xf << 0x4));
+		// frames packets in the LPUART6 interrupt.  CCs, and
+		// the SysEx CINs 0x4..0x7 for scene recall
+	#if HOW_DEBUG_OUTPUT == DEBUG_TO_MIDI_SERIAL
 		delay(500);
-		display(0,"TE3_hub.ino setup() started on USB_SERIAL_PORT",0);
+		dbgSerial = &serial_mux;
+		display(0,"TE3_hub.ino setup() started on MIDI_SERIAL_PORT",0);
+	#endif
+	#if WITH_FAST_SERIAL
+		if (!rts_ok || !cts_ok)
+			my_error("MIDI_SERIAL_PORT attachRts(%d)=%d attachCts(%d)=%d",
+				FAST_SERIAL_RTS_PIN,rts_ok,
+				FAST_SERIAL_CTS_PIN,cts_ok);
 	#endif
 
+	#if !USB_AUDIO_LAZY
+		initUsb();
+	#endif
 
 	//-----------------------------------
 	// initialize the audio system
 	//-----------------------------------
 
-	delay(500);
-	display(0,"initializing audio system",0);
+	display(0,"initializing audio system at %d ms",millis());
 
-	AudioMemory(100);
-	delay(250);
+	#if AUDIO_MEMORY_CALIBRATE
+		AudioMemory(AUDIO_MEMORY_CALIBRATE_BLOCKS);
+	#else
+		AudioMemory(AUDIO_MEMORY_BLOCKS);
+	#endif
 
 	sgtl5000.enable();
+		// polls for the chip to answer, rather than a fixed delay
 	sgtl5000.setDefaults();
 
 	// setDefaults() is optimized for guitar.
@@ -408,6 +1008,9 @@ void setup()
 	// tehub_dumpCCValues("in TE_hub::setup()");
 		// see heavy duty notes in sgtl5000midi.h
 
+	#if WITH_ROUTER
+		initRoutes();
+	#endif
 	#if WITH_MIXERS
 		setMixLevel(MIX_CHANNEL_IN, 	DEFAULT_VOLUME_IN);
 		setMixLevel(MIX_CHANNEL_USB, 	DEFAULT_VOLUME_USB);
@@ -417,10 +1020,25 @@ void setup()
 	
 	#if WITH_SINE
 		setMixLevel(MIX_CHANNEL_IN_USB, 	DEFAULT_VOLUME_IN_USB);
-		setMixLevel(MIX_CHANNEL_IN_SINE, 	DEFAULT_VOLUME_IN_SINE);
+		#if MEASURE_LATENCY
+			setMixLevel(MIX_CHANNEL_IN_SINE, 	100);
+		#else
+			setMixLevel(MIX_CHANNEL_IN_SINE, 	DEFAULT_VOLUME_IN_SINE);
+		#endif
 		initSine();
 	#endif
 
+	#if WITH_CONFIG_STORE
+		restoreConfig();
+			// one scene, on top of the defaults, so only
+			// the registers that differ get written
+	#endif
+
+	#if USB_AUDIO_LAZY
+		initUsb();
+			// the usbAudioConnections get made
+			// by loop() once the host configures us
+	#endif
 
 	//--------------------------------
 	// setup finished
@@ -430,7 +1048,7 @@ void setup()
 		digitalWrite(FLASH_PIN,1);
 	#endif
 
-	display(0,"TE3_hub.ino setup() finished",0);
+	display(0,"TE3_hub.ino setup() finished at %d ms",millis());
 
 }	// setup()
 
@@ -444,6 +1062,8 @@ void setup()
 
 void loop()
 {
+	telemetryLoopTime();
+
 	// trying to debug USB audio glitches (pops and hiccups).
 	// I don't know if these available global vars are indicators or not.
 	//
@@ -472,9 +1092,17 @@ void loop()
 				last_underrun = usb_audio_underrun_count;
 				last_overrun = usb_audio_overrun_count;
 
-				display(0,"USB Audio over(%d) under(%d)",
-					usb_audio_overrun_count,
-					usb_audio_underrun_count);
+				#if WITH_DRIFT_COMP
+					display(0,"USB Audio over(%d) under(%d) drift(%d ppm) offset(%d)",
+						usb_audio_overrun_count,
+						usb_audio_underrun_count,
+						usb_drift.ratePPM(),
+						usb_drift.offset());
+				#else
+					display(0,"USB Audio over(%d) under(%d)",
+						usb_audio_overrun_count,
+						usb_audio_underrun_count);
+				#endif
 			}
 			show_usb_time = millis();
 		}
@@ -513,11 +1141,19 @@ void loop()
 	//------------------------------------------------------
 	// handleSerialMidi() && SGTL5000 eq automation
 
-	#if 1
+	#if !CONTROL_BENCH
 		handleSerialMidi();
 	#endif
 
-	#if 1
+	#if WITH_MIDI_HOST
+		midi_host.task();
+	#endif
+	midi_out.task();
+
+	#if CONTROL_BENCH
+		controlBenchTask();
+			// calls sgtl5000.loop()
+	#else
 		sgtl5000.loop();
 	#endif
 
@@ -525,6 +1161,29 @@ void loop()
 		handleSine();
 	#endif
 
+	handleTelemetry();
+	#if USB_TRACE
+		handleUsbTrace();
+	#endif
+	#if AUDIO_MEMORY_CALIBRATE
+		AudioMemoryProbe::task();
+	#endif
+	#if MEASURE_LATENCY
+		latency_probe.task();
+	#endif
+	#if USB_AUDIO_LAZY && WITH_MIXERS
+		if (usbAudioConnection::task())
+			setMixLevel(MIX_CHANNEL_IN, mix_level[MIX_CHANNEL_IN]);
+				// the standalone monitor goes back to the
+				// real mix level once USB is connected
+	#elif USB_AUDIO_LAZY
+		usbAudioConnection::task();
+	#endif
+
+	defer_log.task();
+	serial_mux.task();
+		// last, to send whatever this loop() queued
+
 }	// loop()
 
 
@@ -541,152 +1200,590 @@ void loop()
 #define dbg_sm  0
 #define dbg_dispatch	0
 
-int tehub_getCC(uint8_t cc)
+//-----------------------------
+// tehub CC descriptor table
+//-----------------------------
+// Same idea as the one in sgtl5000.cpp (see src/ccTable.h), but with
+// plain functions, which get passed the arg from the table, so that
+// all the mixer channels can share setMixLevel().
+
+typedef struct
 {
-	switch (cc)
+	uint8_t cc;
+	uint8_t max;
+	uint8_t flags;
+	uint8_t automation;
+	const char *name;
+	bool (*set)(uint8_t arg, uint8_t val);
+	int (*get)(uint8_t arg);
+	uint8_t arg;
+} tehubCCDesc_t;
+
+
+static bool tehubDump(uint8_t arg, uint8_t val)
+{
+	tehub_dumpCCValues("from dump_tehub command");
+	return 1;
+}
+
+static bool tehubReboot(uint8_t arg, uint8_t val)
+{
+	reboot_teensy();
+	return 1;
+}
+
+static bool tehubReset(uint8_t arg, uint8_t val)
+{
+	display(0,"TEHUB_RESET not implemented yet",0);
+	return 1;
+}
+
+static bool tehubSetTelemetry(uint8_t arg, uint8_t val)
+{
+	telemetry_period = val;
+	telemetry_time = millis();
+	return 1;
+}
+
+static int tehubGetTelemetry(uint8_t arg)
+{
+	return telemetry_period;
+}
+
+#if USB_TRACE
+	static bool tehubUsbTrace(uint8_t arg, uint8_t val)
 	{
-		case TEHUB_CC_DUMP				: return 255;
-		case TEHUB_CC_REBOOT			: return 255;
-		case TEHUB_CC_RESET				: return 255;
+		usb_trace_trigger(USB_TRACE_CAUSE_COMMAND);
+		return 1;
+	}
+#endif
 
-		#if WITH_MIXERS
-			case TEHUB_CC_MIX_IN		: return mix_level[MIX_CHANNEL_IN];
-			case TEHUB_CC_MIX_USB		: return mix_level[MIX_CHANNEL_USB];
-			case TEHUB_CC_MIX_LOOP		: return mix_level[MIX_CHANNEL_LOOP];
-			case TEHUB_CC_MIX_AUX		: return mix_level[MIX_CHANNEL_AUX];
-		#endif
+static int getMixLevel(uint8_t channel)
+{
+	return mix_level[channel];
+}
 
-		#if WITH_SINE
-			case TEHUB_CC_IN_MIX_USB	: return mix_level[MIX_CHANNEL_IN_USB];
-			case TEHUB_CC_IN_MIX_SINE	: return mix_level[MIX_CHANNEL_IN_SINE];
-		#endif
+
+#if WITH_CONFIG_STORE
+
+	// TEHUB_CC_SAVE_CONFIG is in src/tehubMidi.h
+
+	static bool tehubSaveConfig(uint8_t arg, uint8_t val)
+	{
+		saveConfig();
+		return 1;
 	}
 
-	return -1;		// unimplmented CC
+#endif
+
+
+#if WITH_ROUTER
+
+	// TEHUB_CC_ROUTE(src,dst) in src/tehubMidi.h is one on/off CC
+	// per router crosspoint.  A 2 channel build just does not have
+	// the USB2 ones.
+
+	static_assert(ROUTE_NUM_SRCS <= ROUTE_MAX_SRCS && ROUTE_NUM_DSTS <= ROUTE_MAX_DSTS,
+		"ROUTE_MAX_SRCS and ROUTE_MAX_DSTS are too small");
+
+	static bool tehubSetRoute(uint8_t arg, uint8_t val)
+	{
+		router.route(arg / ROUTE_MAX_DSTS, arg % ROUTE_MAX_DSTS, val);
+		return 1;
+	}
+
+	static int tehubGetRoute(uint8_t arg)
+	{
+		return router.routed(arg / ROUTE_MAX_DSTS, arg % ROUTE_MAX_DSTS);
+	}
+
+	#define TEHUB_ROUTE(src, dst) \
+		{ TEHUB_CC_ROUTE(ROUTE_SRC_##src, ROUTE_DST_##dst), 1, 0, CC_AUTO_NONE, "ROUTE_" #src "_" #dst, \
+		  tehubSetRoute, tehubGetRoute, ROUTE_SRC_##src * ROUTE_MAX_DSTS + ROUTE_DST_##dst }
+
+#endif
+
+
+#define TEHUB_CC(cc, max, flags, aut, set, get, arg) \
+	{ TEHUB_CC_##cc, max, flags, aut, #cc, set, get, arg }
+
+static constexpr tehubCCDesc_t tehub_cc_table[] = {
+	TEHUB_CC(DUMP,			1,   CC_WRITE_ONLY | CC_COMMAND,	CC_AUTO_NONE,	tehubDump,			NULL,				0),
+	TEHUB_CC(REBOOT,		1,   CC_WRITE_ONLY | CC_COMMAND,	CC_AUTO_NONE,	tehubReboot,		NULL,				0),
+	TEHUB_CC(RESET,			1,   CC_WRITE_ONLY | CC_COMMAND,	CC_AUTO_NONE,	tehubReset,			NULL,				0),
+	TEHUB_CC(TELEMETRY,		127, 0,								CC_AUTO_NONE,	tehubSetTelemetry,	tehubGetTelemetry,	0),
+	#if USB_TRACE
+		TEHUB_CC(USB_TRACE,	1,   CC_WRITE_ONLY | CC_COMMAND,	CC_AUTO_NONE,	tehubUsbTrace,		NULL,				0),
+	#endif
+	#if WITH_CONFIG_STORE
+		TEHUB_CC(SAVE_CONFIG,	1, CC_WRITE_ONLY | CC_COMMAND,	CC_AUTO_NONE,	tehubSaveConfig,	NULL,				0),
+	#endif
+
+	#if WITH_MIXERS
+		TEHUB_CC(MIX_IN,	127, 0,		CC_AUTO_MIXER,	setMixLevel,	getMixLevel,	MIX_CHANNEL_IN),
+		TEHUB_CC(MIX_USB,	127, 0,		CC_AUTO_MIXER,	setMixLevel,	getMixLevel,	MIX_CHANNEL_USB),
+		TEHUB_CC(MIX_LOOP,	127, 0,		CC_AUTO_MIXER,	setMixLevel,	getMixLevel,	MIX_CHANNEL_LOOP),
+		TEHUB_CC(MIX_AUX,	127, 0,		CC_AUTO_MIXER,	setMixLevel,	getMixLevel,	MIX_CHANNEL_AUX),
+	#endif
+
+	#if WITH_SINE
+		TEHUB_CC(IN_MIX_USB,	127, 0,	CC_AUTO_MIXER,	setMixLevel,	getMixLevel,	MIX_CHANNEL_IN_USB),
+		TEHUB_CC(IN_MIX_SINE,	127, 0,	CC_AUTO_MIXER,	setMixLevel,	getMixLevel,	MIX_CHANNEL_IN_SINE),
+	#endif
+
+	#if WITH_ROUTER
+		TEHUB_ROUTE(IN,		CODEC),
+		TEHUB_ROUTE(IN,		USB),
+		TEHUB_ROUTE(IN,		LOOP),
+		TEHUB_ROUTE(USB,	CODEC),
+		TEHUB_ROUTE(USB,	USB),
+		TEHUB_ROUTE(USB,	LOOP),
+		TEHUB_ROUTE(LOOP,	CODEC),
+		TEHUB_ROUTE(LOOP,	USB),
+		TEHUB_ROUTE(LOOP,	LOOP),
+		TEHUB_ROUTE(SINE,	CODEC),
+		TEHUB_ROUTE(SINE,	USB),
+		TEHUB_ROUTE(SINE,	LOOP),
+		#if USB_AUDIO_CHANNELS == 4
+			TEHUB_ROUTE(IN,		USB2),
+			TEHUB_ROUTE(USB,	USB2),
+			TEHUB_ROUTE(LOOP,	USB2),
+			TEHUB_ROUTE(SINE,	USB2),
+			TEHUB_ROUTE(USB2,	CODEC),
+			TEHUB_ROUTE(USB2,	USB),
+			TEHUB_ROUTE(USB2,	LOOP),
+			TEHUB_ROUTE(USB2,	USB2),
+		#endif
+	#endif
+};
+
+#define TEHUB_NUM_CCS	((int) (sizeof(tehub_cc_table) / sizeof(tehub_cc_table[0])))
+
+static constexpr ccIndex<TEHUB_NUM_CCS> tehub_cc_index(tehub_cc_table);
+
+static_assert(tehub_cc_index.valid,
+	"a CC is in the tehub CC table twice, or is not 0..127");
+static_assert(TEHUB_CC_LAST <= 127,
+	"the src/tehubMidi.h CCs go past 127");
+
+
+int tehub_getCC(uint8_t cc)
+{
+	uint8_t idx = tehub_cc_index[cc];
+	if (idx == CC_NONE)
+		return -1;		// unimplmented CC
+	const tehubCCDesc_t *desc = &tehub_cc_table[idx];
+	if (desc->flags & CC_WRITE_ONLY)
+		return 255;
+	return desc->get(desc->arg);
+}
+
+
+int tehub_getCCMax(uint8_t cc)
+	// -1 for unimplemented CCs
+{
+	uint8_t idx = tehub_cc_index[cc];
+	return idx == CC_NONE ? -1 : tehub_cc_table[idx].max;
+}
+
+
+bool tehub_isCommandCC(uint8_t cc)
+{
+	uint8_t idx = tehub_cc_index[cc];
+	return idx != CC_NONE && (tehub_cc_table[idx].flags & CC_COMMAND);
+}
+
+
+bool tehub_isContinuousCC(uint8_t cc)
+	// the mixer levels, which are coalesced
+{
+	uint8_t idx = tehub_cc_index[cc];
+	return idx != CC_NONE && tehub_cc_table[idx].automation != CC_AUTO_NONE;
 }
 
 
 void tehub_dumpCCValues(const char *where)
 {
 	display(0,"tehub CC values %s",where);
-	int num_dumped = 0;
 	
 	proc_entry();
-	for (uint8_t cc=TEHUB_CC_BASE; cc<=TEHUB_CC_MAX; cc++)
+	for (int i=0; i<TEHUB_NUM_CCS; i++)
 	{
-		if (!tehub_writeOnlyCC(cc))
-		{
-			int val = tehub_getCC(cc);
-			if (val != -1)
-			{
-				num_dumped++;
-				display(0,"TEHUB_CC(%-2d) = %-4d  %-19s max=%d",cc,val,tehub_getCCName(cc),tehub_getCCMax(cc));
-			}
-		}
+		const tehubCCDesc_t *desc = &tehub_cc_table[i];
+		if (!(desc->flags & CC_WRITE_ONLY))
+			display(0,"TEHUB_CC(%-2d) = %-4d  %-19s max=%d",desc->cc,desc->get(desc->arg),desc->name,desc->max);
 	}
-	if (!num_dumped)
-		my_error("There are no CC's implemented by define in te_hub!",0);
-
 	proc_leave();
 }
 
 
 bool tehub_dispatchCC(uint8_t cc, uint8_t val)
 {
-	display(dbg_dispatch,"tehub CC(%d) %s <= %d",cc,tehub_getCCName(cc),val);
+	uint8_t idx = tehub_cc_index[cc];
+	if (idx == CC_NONE)
+	{
+		defer_error("unknown dispatchCC(%d,%d)",cc,val);
+		return false;
+	}
 
-	switch (cc)
+	const tehubCCDesc_t *desc = &tehub_cc_table[idx];
+	if (val > desc->max)
 	{
-		case TEHUB_CC_DUMP		: tehub_dumpCCValues("from dump_tehub command"); return 1;
-		case TEHUB_CC_REBOOT	: reboot_teensy();
-		case TEHUB_CC_RESET		: display(0,"TEHUB_RESET not implemented yet",0); return 1;
+		defer_warning(0,"tehub CC(%d) %s val(%d) > max(%d)",cc,desc->name,val,desc->max);
+		return false;
+	}
+	defer_display(dbg_dispatch,"tehub CC(%d) %s <= %d",cc,desc->name,val);
+	return desc->set(desc->arg,val);
+}
+
+
+
+#define SERIAL_MIDI_BATCH		SERIAL_MIDI_RING_SIZE
+	// most packets read per loop().  Since the continuous
+	// CCs are coalesced, we might as well take all of them.
+
+// The continuous CCs are coalesced by src/ccCoalescer, which the
+// host bench builds too. It only needs to know the two targets.
+
+static bool sgtl_isContinuousCC(uint8_t cc)	{ return sgtl5000.isContinuousCC(cc); }
+static bool sgtl_dispatchCC(uint8_t cc, uint8_t val)	{ return sgtl5000.dispatchCC(cc,val); }
+
+static const ccTarget_t cc_targets[NUM_CC_TARGETS] =
+{
+	{ sgtl_isContinuousCC,	sgtl_dispatchCC },		// CC_TARGET_SGTL
+	{ tehub_isContinuousCC,	tehub_dispatchCC },		// CC_TARGET_TEHUB
+};
+
+static ccCoalescer cc_coalescer(cc_targets);
+
+
+
+//----------------------------------------------
+// control path benchmark
+//----------------------------------------------
 
+#if CONTROL_BENCH
+
+	#define SGTL_MOVE(ms, cc, from, to, dur)	{ ms, CC_TARGET_SGTL, SGTL_CC_##cc, from, to, dur }
+	#define TEHUB_MOVE(ms, cc, from, to, dur)	{ ms, CC_TARGET_TEHUB, TEHUB_CC_##cc, from, to, dur }
+
+	static const benchMove_t bench_trace[] = {
+
+		// graphic EQ, one band all the way up and down,
+		// then two at once, as with two expression pedals
+
+		SGTL_MOVE(0,	EQ_SELECT,		0,	3,		0),
+		SGTL_MOVE(100,	EQ_BAND2,		47,	95,		1000),
+		SGTL_MOVE(1100,	EQ_BAND2,		95,	0,		2000),
+		SGTL_MOVE(3100,	EQ_BAND2,		0,	47,		1000),
+		SGTL_MOVE(4200,	EQ_BAND0,		47,	95,		1000),
+		SGTL_MOVE(4200,	EQ_BAND4,		47,	0,		1000),
+
+		// parametric EQ, a wah-like filter sweep
+
+		SGTL_MOVE(5300,	EQ_SELECT,		3,	1,		0),
+		SGTL_MOVE(5300,	PEQ_COUNT,		0,	3,		0),
+		SGTL_MOVE(5400,	PEQ_GAIN(1),	64,	112,	500),
+		SGTL_MOVE(5400,	PEQ_Q(1),		6,	40,		500),
+		SGTL_MOVE(6000,	PEQ_FREQ(1),	28,	110,	1500),
+		SGTL_MOVE(7500,	PEQ_FREQ(1),	110, 28,	1500),
+		SGTL_MOVE(9000,	PEQ_GAIN(1),	112, 64,	500),
+
+		// volumes
+
+		SGTL_MOVE(9600,	HP_VOLUME,		100, 40,	1000),
+		SGTL_MOVE(10600, HP_VOLUME,		40,	100,	1000),
 		#if WITH_MIXERS
-			case TEHUB_CC_MIX_IN	: return setMixLevel(MIX_CHANNEL_IN,   val);
-			case TEHUB_CC_MIX_USB	: return setMixLevel(MIX_CHANNEL_USB,  val);
-			case TEHUB_CC_MIX_LOOP	: return setMixLevel(MIX_CHANNEL_LOOP, val);
-			case TEHUB_CC_MIX_AUX	: return setMixLevel(MIX_CHANNEL_AUX,  val);
+			TEHUB_MOVE(9600,	MIX_USB,	100, 0,		1000),
+			TEHUB_MOVE(10600,	MIX_USB,	0,	100,	1000),
 		#endif
 
-		#if WITH_SINE
-			case TEHUB_CC_IN_MIX_USB	: return setMixLevel(MIX_CHANNEL_IN_USB, val);
-			case TEHUB_CC_IN_MIX_SINE	: return setMixLevel(MIX_CHANNEL_IN_SINE, val);
-		#endif
+		SGTL_MOVE(11700, EQ_SELECT,		1,	0,		0),
+	};
+
+	static void benchHandler(const uint8_t *targets, const uint8_t *ccs, const uint8_t *vals, int count)
+		// one pass of handleSerialMidi()
+	{
+		for (int i=0; i<count; i++)
+			cc_coalescer.handleCC(targets[i],ccs[i],vals[i]);
+		cc_coalescer.dispatchPending();
 	}
 
-	my_error("unknown dispatchCC(%d,%d)",cc,val);
-	return false;
-}
+	static controlBench control_bench(
+		bench_trace,
+		sizeof(bench_trace) / sizeof(bench_trace[0]),
+		benchHandler);
 
+	void controlBenchTask()
+	{
+		control_bench.task(&sgtl5000);
+	}
 
+#endif	// CONTROL_BENCH
 
-#define isCC(byte)				(((byte) & 0x0f) == MIDI_TYPE_CC)
-#define knownCable(byte)		(((byte >> 4) == SGTL5000_CABLE) || ((byte >> 4) == TEHUB_CABLE))
-#define knownCableCC(byte)		(isCC(byte) && knownCable(byte))
 
 
-void handleSerialMidi()
+//----------------------------------------------
+// scene recall
+//----------------------------------------------
+// A whole scene arrives as one SysEx message on the TEHUB_CABLE,
+// with the same header as the telemetry record:
+//
+//	F0 7D 02 01		manufacturer id, SCENE_RECORD, SCENE_VERSION
+//	then any number of sections:
+//		target		CC_TARGET_SGTL or CC_TARGET_TEHUB
+//		count		number of pairs that follow
+//		cc val		count times
+//	F7
+//
+// Anything coalesced before the scene is dispatched first.  The SGTL5000
+// part goes to sgtl5000.applyScene(), which only writes what changed,
+// muted, as one burst.  The tehub part is the mixers, which already ramp
+// per sample, so those are just set if they differ.
+//
+// A section with more than 128 pairs, or with a data byte over 0x7f,
+// means the message is garbage, and the rest of it is dropped.  Pairs
+// for unknown CCs, or with values over the CC's max, are just skipped.
+
+#define SCENE_MAX_BYTES		(8 + 2 * (2 + 2 * 128))
+	// every CC of both targets, and then some
+
+static uint8_t scene_buf[SCENE_MAX_BYTES];
+static int scene_len = -1;
+	// -1 = not in a SysEx message
+
+
+static void applySceneSections(const uint8_t *p, const uint8_t *end)
+	// the sections of a scene, for a SysEx or a saved configuration
 {
-	static uint32_t msg32 = 0;
-	static uint8_t *buf = (uint8_t *)&msg32;
-	static uint8_t len = 0;
-
-	// code expects a leading SERIAL_MIDI byte that
-	// has a known cable. The redundant message 'type'
-	// in the leading byte is not checked.
-	//
-	// If an unknown cable is detected, it will report an
-	// error and skip the byte in an attempt to try to
-	// synchronize to the MIDI stream.  Otherwise it buffers
-	// four bytes for handling.
-
-	while (MIDI_SERIAL_PORT.available())
+	while (p + 2 <= end)
 	{
-		uint8_t byte = MIDI_SERIAL_PORT.read();
+		uint8_t target = *p++;
+		int count = *p++;
+		if (count > 128 || p + 2 * count > end)
+		{
+			defer_error("TE3_hub: scene section(%d) count(%d) too long",target,count);
+			return;
+		}
 
-		if (len == 0)
+		uint8_t ccs[128];
+		uint8_t vals[128];
+		int num = 0;
+		for (int i=0; i<count; i++)
 		{
-			if (knownCableCC(byte))
+			uint8_t cc = *p++;
+			uint8_t val = *p++;
+			if ((cc | val) & 0x80)
+			{
+				defer_error("TE3_hub: scene section(%d) bad pair(0x%02x,0x%02x)",target,cc,val);
+				return;
+			}
+
+			int max = target == CC_TARGET_SGTL ? sgtl5000.getCCMax(cc) :
+					  target == CC_TARGET_TEHUB ? tehub_getCCMax(cc) : 127;
+			if (max < 0 || val > max)
 			{
-				buf[len++] = byte;
+				defer_warning(0,"TE3_hub: scene section(%d) skipping CC(%d) val(%d) max(%d)",target,cc,val,max);
+				continue;
 			}
-			else
+			ccs[num] = cc;
+			vals[num++] = val;
+		}
+
+		if (target == CC_TARGET_SGTL)
+		{
+			int changed = sgtl5000.applyScene(ccs,vals,num);
+			defer_display(dbg_sm,"scene sgtl5000 %d/%d changed",changed,num);
+		}
+		else if (target == CC_TARGET_TEHUB)
+		{
+			for (int i=0; i<num; i++)
 			{
-				my_error("TE3_hub: unexpected cable/type in MIDI byte0(0x%02x)",byte);
+				int cur = tehub_getCC(ccs[i]);
+				if (cur >= 0 && cur != 255 && cur != vals[i])
+					tehub_dispatchCC(ccs[i],vals[i]);
 			}
 		}
 		else
 		{
-			buf[len++] = byte;
-			if (len == 4)
-			{
-				display(dbg_sm,"<-- %08x",msg32);
+			defer_error("TE3_hub: unknown scene target(%d)",target);
+			return;
+		}
+	}
+}
 
-				msgUnion msg(msg32);
 
-				if (msg.cable() == SGTL5000_CABLE &&
-					msg.channel() == SGTL5000_CHANNEL &&
-					msg.type() == MIDI_TYPE_CC)
-				{
-					sgtl5000.dispatchCC(msg.param1(),msg.param2());
-				}
-				else if (msg.cable() == TEHUB_CABLE &&
-						 msg.channel() == TEHUB_CHANNEL &&
-						 msg.type() == MIDI_TYPE_CC)
-				{
-					tehub_dispatchCC(msg.param1(),msg.param2());
-				}
+static void handleScene(const uint8_t *buf, int len)
+{
+	if (len < 5 ||
+		buf[1] != TELEMETRY_SYSEX_ID ||
+		buf[2] != SCENE_RECORD ||
+		buf[3] != SCENE_VERSION)
+	{
+		defer_error("TE3_hub: unexpected SysEx(%d bytes) %02x %02x %02x",len,buf[1],buf[2],buf[3]);
+		return;
+	}
 
-				else
-				{
-					my_error("TE3_hub: unexpected serial midi(0x%08x)",msg32);
-				}
+	cc_coalescer.dispatchPending();
+	applySceneSections(&buf[4],&buf[len - 1]);
+		// up to the F7
+}
+
+
+#if WITH_CONFIG_STORE
+
+	static int buildScene(uint8_t *buf, int max_len)
+		// The current state, as scene sections, for the configStore.
+		// Every readable SGTL5000 CC, and the tehub mixer levels and routes.
+	{
+		uint8_t ccs[128];
+		uint8_t vals[128];
+		uint8_t *p = buf;
+		uint8_t *end = buf + max_len;
+
+		int count = sgtl5000.snapshotCCs(ccs,vals,128);
+		if (p + 2 + 2 * count > end)
+			return -1;
+		*p++ = CC_TARGET_SGTL;
+		*p++ = count;
+		for (int i=0; i<count; i++)
+		{
+			*p++ = ccs[i];
+			*p++ = vals[i];
+		}
 
-				len = 0;
+		count = 0;
+		for (int i=0; i<TEHUB_NUM_CCS; i++)
+		{
+			const tehubCCDesc_t *desc = &tehub_cc_table[i];
+			bool keep = desc->automation == CC_AUTO_MIXER;
+			#if WITH_ROUTER
+				keep = keep || desc->set == tehubSetRoute;
+			#endif
+			if (keep)
+			{
+				ccs[count] = desc->cc;
+				vals[count++] = desc->get(desc->arg);
 			}
 		}
+		if (count)
+		{
+			if (p + 2 + 2 * count > end)
+				return -1;
+			*p++ = CC_TARGET_TEHUB;
+			*p++ = count;
+			for (int i=0; i<count; i++)
+			{
+				*p++ = ccs[i];
+				*p++ = vals[i];
+			}
+		}
+		return p - buf;
+	}
+
+
+	void restoreConfig()
+		// from setup(), after the defaults
+	{
+		uint8_t buf[CONFIG_MAX_DATA];
+		int len = config_store.load(buf,CONFIG_MAX_DATA);
+		if (len > 0)
+		{
+			display(0,"restoring saved configuration(%d bytes) seq(%d)",len,config_store.sequence());
+			applySceneSections(buf,buf + len);
+		}
+	}
+
+	void saveConfig()
+		// for the TEHUB_CC_SAVE_CONFIG command, which handleCC()
+		// only dispatches after any coalesced CCs, so they get
+		// saved too
+	{
+		uint8_t buf[CONFIG_MAX_DATA];
+		int len = buildScene(buf,CONFIG_MAX_DATA);
+		if (len < 0)
+		{
+			my_error("TE3_hub: configuration too big to save",0);
+			return;
+		}
+		if (config_store.save(buf,len))
+			display(0,"saved configuration(%d bytes) seq(%d)",len,config_store.sequence());
+	}
+
+#endif
+
+
+static void handleSysexPacket(uint32_t msg32)
+	// CIN 0x4 = start/continue with 3 bytes,
+	// 0x5/0x6/0x7 = ends with 1/2/3 bytes
+{
+	uint8_t cin = msg32 & 0x0f;
+	int n = cin == 0x4 ? 3 : cin - 0x4;
+	for (int i=0; i<n; i++)
+	{
+		uint8_t byte = (msg32 >> (8 * (i + 1))) & 0xff;
+		if (byte == 0xF0)
+			scene_len = 0;
+		if (scene_len < 0)
+			continue;
+		if (scene_len >= SCENE_MAX_BYTES)
+		{
+			defer_error("TE3_hub: SysEx longer than %d bytes",SCENE_MAX_BYTES);
+			scene_len = -1;
+			return;
+		}
+		scene_buf[scene_len++] = byte;
+		if (byte == 0xF7)
+		{
+			handleScene(scene_buf,scene_len);
+			scene_len = -1;
+		}
+	}
+}
+
+
+void handleSerialMidi()
+	// The packets are framed in the serial interrupt (see
+	// src/serialMidi.h), which only accepts a leading byte with
+	// a known cable and the CC or SysEx code index.  Bytes skipped while
+	// looking for one are counted there, and show up in the
+	// telemetry record, instead of a my_error() per byte.
+{
+	uint32_t msg32;
+	int count = 0;
+	while (count++ < SERIAL_MIDI_BATCH &&
+		   serial_midi.read(&msg32))
+	{
+		defer_display(dbg_sm,"<-- %08x",msg32);
+
+		msgUnion msg(msg32);
+
+		if (msg.cable() == SGTL5000_CABLE &&
+			msg.channel() == SGTL5000_CHANNEL &&
+			msg.type() == MIDI_TYPE_CC)
+		{
+			cc_coalescer.handleCC(CC_TARGET_SGTL,msg.param1() & 0x7f,msg.param2());
+		}
+		else if (msg.cable() == TEHUB_CABLE &&
+				 msg.channel() == TEHUB_CHANNEL &&
+				 msg.type() == MIDI_TYPE_CC)
+		{
+			cc_coalescer.handleCC(CC_TARGET_TEHUB,msg.param1() & 0x7f,msg.param2());
+		}
+		else if (msg.cable() == TEHUB_CABLE &&
+				 (msg32 & 0x0f) >= 0x4 &&
+				 (msg32 & 0x0f) <= 0x7)
+		{
+			handleSysexPacket(msg32);
+		}
+
+		else
+		{
+			defer_error("TE3_hub: unexpected serial midi(0x%08x)",msg32);
+		}
 	}
 
+	cc_coalescer.dispatchPending();
 }
 
 
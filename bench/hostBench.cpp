@@ -0,0 +1,181 @@
+//-------------------------------------------------------
+// hostBench.cpp
+//-------------------------------------------------------
+// The control bench (../src/controlBench.h) built for the host, with
+// plain g++ (see the Makefile), against the mocks in mock/.
+//
+// The CCs go in as 4 byte packets on the mock Serial1, through the real
+// serialMidi framing, the same ccCoalescer the .ino uses,
+// SGTL5000::dispatchCC() and i2cQueue, down to a mock LPI2C1 bus that
+// counts what went out.  After each pass it also shows the serial and
+// I2C bytes per CC.
+//
+// The cpu timings are of this machine, so they only mean something
+// against each other, from one build to the next.  The bytes and
+// transactions are the same as on the teensy.
+
+#include <Arduino.h>
+#include <myDebug.h>
+#include <sgtl5000midi.h>
+#include "sgtl5000.h"
+#include "serialMidi.h"
+#include "deferLog.h"
+#include "controlBench.h"
+#include "ccCoalescer.h"
+#include "mock.h"
+
+
+#define HOST_BENCH_PASSES	2
+#define HOST_BENCH_LOOP_US	50
+	// between loop()s
+#define HOST_CABLE			0
+#define HOST_CHANNEL		0
+#define CIN_CC				0x0B
+
+
+SGTL5000 sgtl5000;
+
+
+#define SGTL_MOVE(ms, cc, from, to, dur)	{ ms, CC_TARGET_SGTL, SGTL_CC_##cc, from, to, dur }
+
+static const benchMove_t bench_trace[] = {
+
+	// the SGTL5000 part of bench_trace[] in TE3_hub.ino
+
+	SGTL_MOVE(0,	EQ_SELECT,		0,	3,		0),
+	SGTL_MOVE(100,	EQ_BAND2,		47,	95,		1000),
+	SGTL_MOVE(1100,	EQ_BAND2,		95,	0,		2000),
+	SGTL_MOVE(3100,	EQ_BAND2,		0,	47,		1000),
+	SGTL_MOVE(4200,	EQ_BAND0,		47,	95,		1000),
+	SGTL_MOVE(4200,	EQ_BAND4,		47,	0,		1000),
+
+	SGTL_MOVE(5300,	EQ_SELECT,		3,	1,		0),
+	SGTL_MOVE(5300,	PEQ_COUNT,		0,	3,		0),
+	SGTL_MOVE(5400,	PEQ_GAIN(1),	64,	112,	500),
+	SGTL_MOVE(5400,	PEQ_Q(1),		6,	40,		500),
+	SGTL_MOVE(6000,	PEQ_FREQ(1),	28,	110,	1500),
+	SGTL_MOVE(7500,	PEQ_FREQ(1),	110, 28,	1500),
+	SGTL_MOVE(9000,	PEQ_GAIN(1),	112, 64,	500),
+
+	SGTL_MOVE(9600,	HP_VOLUME,		100, 40,	1000),
+	SGTL_MOVE(10600, HP_VOLUME,		40,	100,	1000),
+
+	SGTL_MOVE(11700, EQ_SELECT,		1,	0,		0),
+};
+
+
+//------------------------------
+// handleSerialMidi()
+//------------------------------
+
+static bool sgtl_isContinuousCC(uint8_t cc)	{ return sgtl5000.isContinuousCC(cc); }
+static bool sgtl_dispatchCC(uint8_t cc, uint8_t val)	{ return sgtl5000.dispatchCC(cc,val); }
+static bool tehub_none(uint8_t cc, uint8_t val)	{ return false; }
+static bool tehub_noneContinuous(uint8_t cc)	{ return false; }
+	// the bench only moves SGTL5000 CCs
+
+static const ccTarget_t cc_targets[NUM_CC_TARGETS] =
+{
+	{ sgtl_isContinuousCC,	sgtl_dispatchCC },		// CC_TARGET_SGTL
+	{ tehub_noneContinuous,	tehub_none },			// CC_TARGET_TEHUB
+};
+
+static ccCoalescer cc_coalescer(cc_targets);
+
+
+static void handleSerialMidi()
+{
+	uint32_t msg32;
+	while (serial_midi.read(&msg32))
+	{
+		uint8_t cc = (msg32 >> 16) & 0x7f;
+		uint8_t val = msg32 >> 24;
+		cc_coalescer.handleCC(CC_TARGET_SGTL,cc,val);
+	}
+	cc_coalescer.dispatchPending();
+}
+
+
+static void benchHandler(const uint8_t *targets, const uint8_t *ccs, const uint8_t *vals, int count)
+	// TE3 sends them, and the serial interrupt frames them
+{
+	for (int i=0; i<count; i++)
+	{
+		uint8_t packet[4] = {
+			(HOST_CABLE << 4) | CIN_CC,
+			0xB0 | HOST_CHANNEL,
+			ccs[i],
+			vals[i] };
+		Serial1.receive(packet,4);
+	}
+	handleSerialMidi();
+}
+
+
+static controlBench control_bench(
+	bench_trace,
+	sizeof(bench_trace) / sizeof(bench_trace[0]),
+	benchHandler);
+
+
+//------------------------------
+// main
+//------------------------------
+
+static void showCounts(uint32_t pass, uint32_t ccs, const mockCounts_t *counts)
+{
+	display(0,"host bench pass(%d) ccs(%d) serial(%d bytes) i2c(%d transactions, %d bytes) per CC serial(%0.2f) i2c(%0.2f, %0.2f)",
+		pass,
+		ccs,
+		counts->serial_bytes,
+		counts->i2c_transactions,
+		counts->i2c_bytes,
+		ccs ? (double) counts->serial_bytes / ccs : 0.0,
+		ccs ? (double) counts->i2c_transactions / ccs : 0.0,
+		ccs ? (double) counts->i2c_bytes / ccs : 0.0);
+}
+
+
+int main()
+{
+	Serial1.begin(31250);
+	serial_midi.begin(&Serial1, 1 << HOST_CABLE, 1 << CIN_CC);
+
+	if (!sgtl5000.enable() || !sgtl5000.setDefaults())
+	{
+		my_error("host bench: sgtl5000 did not start");
+		return 1;
+	}
+
+	// a pass is reported, and the next one started, at the end of
+	// a task(), except the first one, which sends its first CCs in
+	// the same task() that starts it
+
+	uint32_t pass = 0;
+	mockCounts_t start = mock_counts;
+	while (control_bench.passes() <= HOST_BENCH_PASSES)
+	{
+		mockAdvance(HOST_BENCH_LOOP_US);
+		mockCounts_t before = mock_counts;
+		control_bench.task(&sgtl5000);
+		defer_log.task();
+
+		if (control_bench.passes() != pass)
+		{
+			if (pass)
+			{
+				mockCounts_t counts;
+				counts.serial_bytes = mock_counts.serial_bytes - start.serial_bytes;
+				counts.i2c_transactions = mock_counts.i2c_transactions - start.i2c_transactions;
+				counts.i2c_bytes = mock_counts.i2c_bytes - start.i2c_bytes;
+				showCounts(pass,counts.serial_bytes / 4,&counts);
+			}
+			start = pass ? mock_counts : before;
+			pass = control_bench.passes();
+		}
+	}
+	return 0;
+}
+
+
+// end of hostBench.cpp
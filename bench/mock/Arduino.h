@@ -0,0 +1,156 @@
+//-------------------------------------------------------
+// Arduino.h - host bench mock
+//-------------------------------------------------------
+// Just enough of the teensy 4 core for the control path sources
+// in ../../src to compile and run on the host.  See mock.cpp.
+//
+// millis() and micros() are a virtual clock, which moves on with
+// each call (a spinning cpu) and with mockAdvance().  ARM_DWT_CYCCNT
+// is the host's own clock scaled to F_CPU_ACTUAL, so the timings are
+// of this machine, not of a teensy.
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <stdarg.h>
+
+
+#define F_CPU_ACTUAL	600000000
+#define ARM_DWT_CYCCNT	(mockCycles())
+
+#define IRQ_LPUART6		25
+#define IRQ_LPI2C1		28
+#define NVIC_NUM_INTERRUPTS	160
+
+#define OUTPUT			1
+#define INPUT			0
+
+extern void (*_VectorsRam[NVIC_NUM_INTERRUPTS + 16])(void);
+
+uint32_t mockCycles();
+uint32_t millis();
+uint32_t micros();
+void delay(uint32_t ms);
+void delayMicroseconds(uint32_t us);
+void mockAdvance(uint32_t us);
+	// time passes without the cpu doing anything, e.g. between loop()s
+
+void __disable_irq();
+void __enable_irq();
+void attachInterruptVector(int irq, void (*fxn)(void));
+inline void NVIC_ENABLE_IRQ(int irq)				{}
+inline void NVIC_DISABLE_IRQ(int irq)				{}
+inline void NVIC_SET_PRIORITY(int irq, int prio)	{}
+
+inline void pinMode(int pin, int mode)				{}
+inline void digitalWrite(int pin, int val)			{}
+
+__asm__(".macro dmb\n.endm\n.macro dsb\n.endm\n");
+	// the barriers the sources use are ARM instructions, so they
+	// assemble to nothing here.  Needs -fno-toplevel-reorder, so
+	// this comes before any function in the assembly output.
+
+
+//------------------------------
+// LPI2C1
+//------------------------------
+// Only the registers and bits that i2cQueue uses.  MCR, MTDR, MSR
+// and MFSR are hooked, so writes go to the mock bus in mock.cpp.
+
+#define LPI2C_MSR_TDF		((uint32_t)(1 << 0))
+#define LPI2C_MSR_RDF		((uint32_t)(1 << 1))
+#define LPI2C_MSR_EPF		((uint32_t)(1 << 8))
+#define LPI2C_MSR_SDF		((uint32_t)(1 << 9))
+#define LPI2C_MSR_NDF		((uint32_t)(1 << 10))
+#define LPI2C_MSR_ALF		((uint32_t)(1 << 11))
+#define LPI2C_MSR_FEF		((uint32_t)(1 << 12))
+#define LPI2C_MSR_PLTF		((uint32_t)(1 << 13))
+#define LPI2C_MSR_MBF		((uint32_t)(1 << 24))
+
+#define LPI2C_MIER_TDIE		LPI2C_MSR_TDF
+#define LPI2C_MIER_SDIE		LPI2C_MSR_SDF
+#define LPI2C_MIER_NDIE		LPI2C_MSR_NDF
+#define LPI2C_MIER_ALIE		LPI2C_MSR_ALF
+#define LPI2C_MIER_FEIE		LPI2C_MSR_FEF
+#define LPI2C_MIER_PLTIE	LPI2C_MSR_PLTF
+
+#define LPI2C_MCR_RTF		((uint32_t)(1 << 8))
+#define LPI2C_MCR_RRF		((uint32_t)(1 << 9))
+
+void mockLpi2cControl(uint32_t bits);
+void mockLpi2cCommand(uint32_t cmd);
+uint32_t mockLpi2cStatus();
+void mockLpi2cClear(uint32_t flags);
+uint32_t mockLpi2cFifoCount();
+
+struct mockMCR
+{
+	operator uint32_t() const			{ return 0; }
+	mockMCR &operator|=(uint32_t bits)	{ mockLpi2cControl(bits); return *this; }
+		// only the self clearing fifo resets
+};
+
+struct mockMTDR
+{
+	mockMTDR &operator=(uint32_t cmd)	{ mockLpi2cCommand(cmd); return *this; }
+};
+
+struct mockMSR
+{
+	operator uint32_t() const			{ return mockLpi2cStatus(); }
+	mockMSR &operator=(uint32_t flags)	{ mockLpi2cClear(flags); return *this; }
+		// write one to clear
+};
+
+struct mockMFSR
+{
+	operator uint32_t() const			{ return mockLpi2cFifoCount(); }
+};
+
+typedef struct
+{
+	mockMCR MCR;
+	mockMSR MSR;
+	uint32_t MIER;
+	mockMFSR MFSR;
+	mockMTDR MTDR;
+} IMXRT_LPI2C_t;
+
+extern IMXRT_LPI2C_t IMXRT_LPI2C1;
+
+
+//------------------------------
+// Serial1
+//------------------------------
+
+class HardwareSerial
+{
+public:
+
+	void begin(uint32_t baud)	{}
+	int available();
+	int read();
+	size_t write(uint8_t byte)	{ return 1; }
+
+	void receive(const uint8_t *data, int len);
+		// the bytes arrive, and the LPUART6 "interrupt" runs
+	uint32_t rxBytes()			{ return m_rx_bytes; }
+
+private:
+
+	uint8_t m_buf[256];
+	uint16_t m_head = 0;
+	uint16_t m_tail = 0;
+	uint32_t m_rx_bytes = 0;
+
+};
+
+extern HardwareSerial Serial1;
+
+
+// end of Arduino.h
@@ -0,0 +1,20 @@
+//-------------------------------------------------------
+// AudioControl.h - host bench mock
+//-------------------------------------------------------
+
+#pragma once
+
+class AudioControl
+{
+public:
+
+	virtual bool enable(void) = 0;
+	virtual bool disable(void) = 0;
+	virtual bool volume(float volume) = 0;
+	virtual bool inputLevel(float volume) = 0;
+	virtual bool inputSelect(int n) = 0;
+
+};
+
+
+// end of AudioControl.h
@@ -0,0 +1,13 @@
+//-------------------------------------------------------
+// AudioStream.h - host bench mock
+//-------------------------------------------------------
+
+#pragma once
+
+#include <Arduino.h>
+
+#define AUDIO_BLOCK_SAMPLES			128
+#define AUDIO_SAMPLE_RATE_EXACT		44117.64706f
+
+
+// end of AudioStream.h
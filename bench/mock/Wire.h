@@ -0,0 +1,48 @@
+//-------------------------------------------------------
+// Wire.h - host bench mock
+//-------------------------------------------------------
+// SGTL5000 only uses Wire for the address probe and for reads, in
+// enable().  They go to the same mock chip as the LPI2C1 writes,
+// and are counted separately.
+
+#pragma once
+
+#include <Arduino.h>
+
+
+class TwoWire
+{
+public:
+
+	void begin()	{}
+	void setClock(uint32_t hz)	{}
+
+	void beginTransmission(uint8_t addr);
+	size_t write(uint8_t byte);
+	uint8_t endTransmission(bool stop = true);
+	uint8_t requestFrom(int addr, int count);
+	int available();
+	int read();
+
+	uint32_t transactions()		{ return m_transactions; }
+	uint32_t bytes()			{ return m_bytes; }
+
+private:
+
+	uint8_t m_tx[64];
+	int m_tx_len = 0;
+	uint16_t m_reg = 0;
+		// the chip's register pointer
+	uint8_t m_rx[64];
+	int m_rx_len = 0;
+	int m_rx_pos = 0;
+
+	uint32_t m_transactions = 0;
+	uint32_t m_bytes = 0;
+
+};
+
+extern TwoWire Wire;
+
+
+// end of Wire.h
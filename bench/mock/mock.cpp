@@ -0,0 +1,405 @@
+//-------------------------------------------------------
+// mock.cpp
+//-------------------------------------------------------
+// The teensy underneath the control path, for the host bench.
+//
+// The LPI2C1 mock is a bus that takes MOCK_I2C_BYTE_US per byte from
+// the 4 word transmit fifo, as virtual time passes, and raises the
+// same MSR flags the real one does, so the real i2cQueue interrupt
+// code runs against it.  It decodes each transaction into register
+// writes on a mock SGTL5000, which Wire reads back, and counts the
+// transactions and the bytes on the bus.
+//
+// An "interrupt" is a call through _VectorsRam[], made whenever the
+// flags change or time passes, unless __disable_irq() is in force
+// or we are already in one.
+
+#include <Arduino.h>
+#include <Wire.h>
+#include <myDebug.h>
+#include <chrono>
+#include "mock.h"
+
+
+#define MOCK_I2C_BYTE_US	23
+	// 9 bits at 400kHz
+#define MOCK_FIFO_SIZE		4
+
+#define CMD_TRANSMIT		0
+#define CMD_STOP			2
+#define CMD_START			4
+
+#define CHIP_REGS			0x200
+#define CHIP_ID_RESET		0xA011
+#define CHIP_I2S_RESET		0x0010
+
+
+void (*_VectorsRam[NVIC_NUM_INTERRUPTS + 16])(void);
+
+IMXRT_LPI2C_t IMXRT_LPI2C1;
+HardwareSerial Serial1;
+TwoWire Wire;
+mockCounts_t mock_counts;
+
+static uint64_t s_now_us = 0;
+static bool s_irq_off = false;
+static bool s_in_irq = false;
+
+static uint16_t s_chip[CHIP_REGS];
+static bool s_chip_reset = false;
+
+
+//------------------------------
+// clocks
+//------------------------------
+
+uint32_t mockCycles()
+{
+	static auto start = std::chrono::steady_clock::now();
+	auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now() - start).count();
+	return (uint32_t) (ns * (F_CPU_ACTUAL / 1000000) / 1000);
+}
+
+
+static void runBus(uint32_t us);
+static void runInterrupts();
+
+
+void mockAdvance(uint32_t us)
+{
+	s_now_us += us;
+	runBus(us);
+	runInterrupts();
+}
+
+uint32_t micros()
+{
+	mockAdvance(1);
+	return (uint32_t) s_now_us;
+}
+
+uint32_t millis()
+{
+	mockAdvance(1);
+	return (uint32_t) (s_now_us / 1000);
+}
+
+void delay(uint32_t ms)					{ mockAdvance(ms * 1000); }
+void delayMicroseconds(uint32_t us)		{ mockAdvance(us); }
+
+
+//------------------------------
+// interrupts
+//------------------------------
+
+void __disable_irq()	{ s_irq_off = true; }
+
+void __enable_irq()
+{
+	s_irq_off = false;
+	runInterrupts();
+}
+
+void attachInterruptVector(int irq, void (*fxn)(void))
+{
+	_VectorsRam[irq + 16] = fxn;
+}
+
+
+static bool callVector(int irq)
+{
+	void (*fxn)(void) = _VectorsRam[irq + 16];
+	if (!fxn)
+		return false;
+	s_in_irq = true;
+	fxn();
+	s_in_irq = false;
+	return true;
+}
+
+
+//------------------------------
+// LPI2C1 and the chip
+//------------------------------
+
+static uint32_t s_fifo[MOCK_FIFO_SIZE];
+static int s_fifo_count = 0;
+static uint32_t s_msr = LPI2C_MSR_TDF;
+static uint32_t s_byte_us = 0;
+	// progress on the byte at the front of the fifo
+
+static uint8_t s_txn[64];
+static int s_txn_len = 0;
+static bool s_in_txn = false;
+
+static bool s_nack_next = false;
+static bool s_stop_pending = false;
+	// after a nack, until the master's own STOP is out
+
+
+static void chipReset()
+{
+	memset(s_chip,0,sizeof(s_chip));
+	s_chip[0x0000] = CHIP_ID_RESET;
+	s_chip[0x0006] = CHIP_I2S_RESET;
+	s_chip_reset = true;
+}
+
+
+static void chipWrite(const uint8_t *data, int len)
+	// register address, then values, auto-incrementing by 2
+{
+	if (!s_chip_reset)
+		chipReset();
+	if (len < 4)
+		return;
+	uint16_t reg = (data[0] << 8) | data[1];
+	for (int i=2; i+1<len; i+=2, reg+=2)
+		s_chip[reg % CHIP_REGS] = (data[i] << 8) | data[i + 1];
+}
+
+
+static uint16_t chipRead(uint16_t reg)
+{
+	if (!s_chip_reset)
+		chipReset();
+	return s_chip[reg % CHIP_REGS];
+}
+
+
+void mockLpi2cCommand(uint32_t cmd)
+{
+	if (s_fifo_count >= MOCK_FIFO_SIZE)
+	{
+		s_msr |= LPI2C_MSR_FEF;
+		return;
+	}
+	s_fifo[s_fifo_count++] = cmd;
+	s_msr &= ~LPI2C_MSR_TDF;
+}
+
+void mockLpi2cControl(uint32_t bits)
+{
+	if (bits & LPI2C_MCR_RTF)
+	{
+		s_fifo_count = 0;
+		s_msr |= LPI2C_MSR_TDF;
+	}
+}
+
+void mockI2CNack()						{ s_nack_next = true; }
+
+uint32_t mockLpi2cStatus()
+{
+	bool busy = s_fifo_count || s_in_txn || s_stop_pending;
+	return s_msr | (busy ? LPI2C_MSR_MBF : 0);
+}
+
+void mockLpi2cClear(uint32_t flags)		{ s_msr &= ~(flags & ~LPI2C_MSR_TDF); }
+uint32_t mockLpi2cFifoCount()			{ return s_fifo_count; }
+
+
+static void runBus(uint32_t us)
+{
+	s_byte_us += us;
+	if (s_stop_pending)
+	{
+		if (s_byte_us < MOCK_I2C_BYTE_US)
+			return;
+		s_byte_us -= MOCK_I2C_BYTE_US;
+		s_stop_pending = false;
+		s_msr |= LPI2C_MSR_SDF;
+	}
+
+	while (s_fifo_count && !(s_msr & LPI2C_MSR_NDF))
+		// the master holds the fifo while NDF is set
+	{
+		uint32_t cmd = s_fifo[0];
+		uint32_t type = (cmd >> 8) & 0x7;
+		uint32_t cost = type == CMD_STOP ? 1 : MOCK_I2C_BYTE_US;
+		if (s_byte_us < cost)
+			break;
+		s_byte_us -= cost;
+
+		if (type == CMD_START && s_nack_next)
+		{
+			s_nack_next = false;
+			mock_counts.i2c_transactions++;
+			mock_counts.i2c_bytes++;
+			s_msr |= LPI2C_MSR_NDF;
+			s_stop_pending = true;
+		}
+		else if (type == CMD_START)
+		{
+			s_in_txn = true;
+			s_txn_len = 0;
+			mock_counts.i2c_transactions++;
+			mock_counts.i2c_bytes++;
+		}
+		else if (type == CMD_TRANSMIT)
+		{
+			if (s_txn_len < (int) sizeof(s_txn))
+				s_txn[s_txn_len++] = cmd & 0xff;
+			mock_counts.i2c_bytes++;
+		}
+		else if (type == CMD_STOP)
+		{
+			if (s_in_txn)
+				chipWrite(s_txn,s_txn_len);
+			s_in_txn = false;
+			s_msr |= LPI2C_MSR_SDF;
+		}
+
+		memmove(s_fifo,&s_fifo[1],--s_fifo_count * sizeof(uint32_t));
+	}
+	if (!s_fifo_count)
+	{
+		s_msr |= LPI2C_MSR_TDF;
+		if (!s_stop_pending)
+			s_byte_us = 0;
+			// an idle bus does not save up time
+	}
+}
+
+
+static void runInterrupts()
+{
+	if (s_irq_off || s_in_irq)
+		return;
+	for (int i=0; i<64; i++)
+	{
+		if (!(s_msr & IMXRT_LPI2C1.MIER) ||
+			!callVector(IRQ_LPI2C1))
+			break;
+		runBus(0);
+	}
+}
+
+
+//------------------------------
+// Wire
+//------------------------------
+
+void TwoWire::beginTransmission(uint8_t addr)
+{
+	m_tx_len = 0;
+}
+
+size_t TwoWire::write(uint8_t byte)
+{
+	if (m_tx_len < (int) sizeof(m_tx))
+		m_tx[m_tx_len++] = byte;
+	return 1;
+}
+
+uint8_t TwoWire::endTransmission(bool stop)
+{
+	m_transactions++;
+	m_bytes += 1 + m_tx_len;
+	mockAdvance((1 + m_tx_len) * MOCK_I2C_BYTE_US);
+	if (m_tx_len >= 2)
+		m_reg = (m_tx[0] << 8) | m_tx[1];
+	chipWrite(m_tx,m_tx_len);
+	return 0;
+}
+
+uint8_t TwoWire::requestFrom(int addr, int count)
+{
+	if (count > (int) sizeof(m_rx))
+		count = sizeof(m_rx);
+	m_transactions++;
+	m_bytes += 1 + count;
+	mockAdvance((1 + count) * MOCK_I2C_BYTE_US);
+	for (int i=0; i<count; i+=2, m_reg+=2)
+	{
+		uint16_t val = chipRead(m_reg);
+		m_rx[i] = val >> 8;
+		if (i + 1 < count)
+			m_rx[i + 1] = val & 0xff;
+	}
+	m_rx_len = count;
+	m_rx_pos = 0;
+	return count;
+}
+
+int TwoWire::available()	{ return m_rx_len - m_rx_pos; }
+int TwoWire::read()			{ return m_rx_pos < m_rx_len ? m_rx[m_rx_pos++] : -1; }
+
+
+//------------------------------
+// Serial1
+//------------------------------
+
+int HardwareSerial::available()
+{
+	return (uint16_t) (m_head - m_tail) % sizeof(m_buf);
+}
+
+int HardwareSerial::read()
+{
+	if (m_head == m_tail)
+		return -1;
+	uint8_t byte = m_buf[m_tail];
+	m_tail = (m_tail + 1) % sizeof(m_buf);
+	return byte;
+}
+
+void HardwareSerial::receive(const uint8_t *data, int len)
+{
+	for (int i=0; i<len; i++)
+	{
+		uint16_t next = (m_head + 1) % sizeof(m_buf);
+		if (next == m_tail)
+			break;
+		m_buf[m_head] = data[i];
+		m_head = next;
+		m_rx_bytes++;
+		mock_counts.serial_bytes++;
+	}
+	if (!s_irq_off && !s_in_irq)
+		callVector(IRQ_LPUART6);
+}
+
+
+//------------------------------
+// myDebug
+//------------------------------
+
+static void output(const char *prefix, const char *format, va_list args)
+{
+	printf("%s",prefix);
+	vprintf(format,args);
+	printf("\n");
+}
+
+void display(int level, const char *format, ...)
+{
+	if (level > MOCK_DEBUG_LEVEL)
+		return;
+	va_list args;
+	va_start(args,format);
+	output("",format,args);
+	va_end(args);
+}
+
+void warning(int level, const char *format, ...)
+{
+	if (level > MOCK_DEBUG_LEVEL)
+		return;
+	va_list args;
+	va_start(args,format);
+	output("WARNING - ",format,args);
+	va_end(args);
+}
+
+void my_error(const char *format, ...)
+{
+	va_list args;
+	va_start(args,format);
+	output("ERROR - ",format,args);
+	va_end(args);
+}
+
+
+// end of mock.cpp
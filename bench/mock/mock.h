@@ -0,0 +1,29 @@
+//-------------------------------------------------------
+// mock.h
+//-------------------------------------------------------
+// What the host bench can see of the mocks, beyond the core API.
+
+#pragma once
+
+#include <Arduino.h>
+
+
+typedef struct
+{
+	uint32_t serial_bytes;
+		// into Serial1
+	uint32_t i2c_transactions;
+	uint32_t i2c_bytes;
+		// on the LPI2C1 bus, including the address bytes,
+		// the i2cQueue writes only, Wire keeps its own
+} mockCounts_t;
+
+extern mockCounts_t mock_counts;
+
+void mockI2CNack();
+	// the chip nacks the address of the next transaction, and the
+	// master sends its own STOP a bus byte time later, as the real
+	// LPI2C does
+
+
+// end of mock.h
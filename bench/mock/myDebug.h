@@ -0,0 +1,18 @@
+//-------------------------------------------------------
+// myDebug.h - host bench mock
+//-------------------------------------------------------
+// Output goes to stdout.  Levels over MOCK_DEBUG_LEVEL are dropped.
+
+#pragma once
+
+#define MOCK_DEBUG_LEVEL	0
+
+void display(int level, const char *format, ...);
+void warning(int level, const char *format, ...);
+void my_error(const char *format, ...);
+
+inline void proc_entry()	{}
+inline void proc_leave()	{}
+
+
+// end of myDebug.h
@@ -0,0 +1,80 @@
+//-------------------------------------------------------
+// sgtl5000midi.h - host bench mock
+//-------------------------------------------------------
+// The real one is shared with TE3, and is not in this repo.  The CC
+// numbers here are just in table order; the bench only uses the names.
+
+#pragma once
+
+
+#define SGTL_CC_DUMP						1
+#define SGTL_CC_SET_DEFAULTS				2
+#define SGTL_CC_INPUT_SELECT				3
+#define SGTL_CC_MIC_GAIN_					4
+#define SGTL_CC_LINEIN_LEVEL				5
+#define SGTL_CC_LINEIN_LEVEL_LEFT			6
+#define SGTL_CC_LINEIN_LEVEL_RIGHT			7
+#define SGTL_CC_DAC_VOLUME					8
+#define SGTL_CC_DAC_VOLUME_LEFT				9
+#define SGTL_CC_DAC_VOLUME_RIGHT			10
+#define SGTL_CC_DAC_VOLUME_RAMP				11
+#define SGTL_CC_LINEOUT_LEVEL				12
+#define SGTL_CC_LINEOUT_LEVEL_LEFT			13
+#define SGTL_CC_LINEOUT_LEVEL_RIGHT			14
+#define SGTL_CC_HP_SELECT					15
+#define SGTL_CC_HP_VOLUME					16
+#define SGTL_CC_HP_VOLUME_LEFT				17
+#define SGTL_CC_HP_VOLUME_RIGHT				18
+#define SGTL_CC_MUTE_HP						19
+#define SGTL_CC_MUTE_LINEOUT				20
+#define SGTL_CC_ADC_HIGH_PASS				21
+#define SGTL_CC_DAP_ENABLE					22
+#define SGTL_CC_SURROUND_ENABLE				23
+#define SGTL_CC_SURROUND_WIDTH				24
+#define SGTL_CC_BASS_ENHANCE_ENABLE			25
+#define SGTL_CC_BASS_CUTOFF_ENABLE			26
+#define SGTL_CC_BASS_CUTOFF_FREQ			27
+#define SGTL_CC_BASS_BOOST					28
+#define SGTL_CC_BASS_VOLUME					29
+#define SGTL_CC_EQ_SELECT					30
+#define SGTL_CC_EQ_BAND0					31
+#define SGTL_CC_EQ_BAND1					32
+#define SGTL_CC_EQ_BAND2					33
+#define SGTL_CC_EQ_BAND3					34
+#define SGTL_CC_EQ_BAND4					35
+#define SGTL_CC_MAX							35
+
+#define SGTL_INPUT_LINEIN			0
+#define SGTL_INPUT_MIC				1
+
+#define DAC_VOLUME_RAMP_DISABLE		0
+#define DAC_VOLUME_RAMP_LINEAR		1
+#define DAC_VOLUME_RAMP_EXPONENTIAL	2
+
+#define HEADPHONE_NORMAL			0
+#define HEADPHONE_LINEIN			1
+
+#define ADC_HIGH_PASS_ENABLE		0
+#define ADC_HIGH_PASS_FREEZE		1
+#define ADC_HIGH_PASS_DISABLE		2
+
+#define DAP_DISABLE					0
+#define DAP_ENABLE_POST				1
+#define DAP_ENABLE_PRE				2
+
+#define SURROUND_DISABLED			0
+#define SURROUND_MONO				1
+#define SURROUND_STEREO				2
+
+#define EQ_FLAT						0
+
+#define FILTER_LOPASS				0
+#define FILTER_HIPASS				1
+#define FILTER_BANDPASS				2
+#define FILTER_NOTCH				3
+#define FILTER_PARAEQ				4
+#define FILTER_LOSHELF				5
+#define FILTER_HISHELF				6
+
+
+// end of sgtl5000midi.h
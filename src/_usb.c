@@ -20,10 +20,8 @@
 #include <string.h>
 #include "debug/printf.h"
 
-//#define LOG_SIZE  20
-//uint32_t transfer_log_head=0;
-//uint32_t transfer_log_count=0;
-//uint32_t transfer_log[LOG_SIZE];
+#include "usbTrace.h"
+#include "usbAudio.h"
 
 // device mode, page 3155
 
@@ -97,6 +95,127 @@ static uint8_t endpoint0_buffer[8];
 static uint8_t sof_usage = 0;
 static uint8_t usb_reboot_timer = 0;
 
+// prh - the MIDI partial buffer flush only happens every
+// usb_midi_flush_divider SOFs, set by midiOut for the bus speed,
+// so the teensy's transmit buffer can fill up first.
+
+volatile uint8_t usb_midi_flush_divider = 1;
+static uint8_t usb_midi_flush_count = 0;
+
+// prh - usb_isr() runs the isochronous (audio) completions first,
+// and only then the bulk and interrupt endpoint callbacks (MIDI,
+// serial), the timers, and the SOF housekeeping, so a burst of serial
+// or MIDI completions does not delay an audio packet within the ISR.
+//
+// They all have to stay in usb_isr() itself.  The core usb_serial.c
+// and usb_midi.c protect their queues from their own callbacks with
+// NVIC_DISABLE_IRQ(IRQ_USB1), so moving those callbacks to any other
+// IRQ lets them race with loop().
+//
+// The critical sections that used to __disable_irq() now only mask
+// USB_ISR_PRIORITY and below with BASEPRI (usb_mask()), which is
+// everything that can touch the endpoint lists, and leaves the serial
+// port and systick alone.
+
+#define USB_ISR_PRIORITY		128
+
+static uint32_t endpointN_iso_mask = 0;
+	// ENDPTCOMPLETE bits of the isochronous endpoints
+
+static inline uint32_t usb_mask(void)
+{
+	uint32_t basepri;
+	__asm__ volatile("mrs %0, basepri" : "=r" (basepri));
+	__asm__ volatile("msr basepri_max, %0" : : "r" (USB_ISR_PRIORITY) : "memory");
+	return basepri;
+}
+
+static inline void usb_unmask(uint32_t basepri)
+{
+	__asm__ volatile("msr basepri, %0" : : "r" (basepri) : "memory");
+}
+
+
+// prh - USB_TRACE, see usbTrace.h
+
+#if USB_TRACE
+
+	typedef struct {
+		uint32_t cycles;
+		uint32_t info;
+	} usb_trace_t;
+
+	static usb_trace_t usb_trace_ring[USB_TRACE_SIZE];
+	static volatile uint32_t usb_trace_head = 0;
+		// total events recorded since the last rearm
+	static volatile int usb_trace_post = -1;
+		// -1 = running, >0 = events to go after a trigger, 0 = frozen
+
+	static void usb_trace(uint8_t type, uint8_t ep, uint16_t arg)
+	{
+		uint32_t cycles = ARM_DWT_CYCCNT;
+		uint32_t mask = usb_mask();
+		if (usb_trace_post) {
+			usb_trace_t *t = &usb_trace_ring[usb_trace_head++ & (USB_TRACE_SIZE - 1)];
+			t->cycles = cycles;
+			t->info = ((uint32_t)type << 24) | ((uint32_t)ep << 16) | arg;
+			if (usb_trace_post > 0) usb_trace_post--;
+		}
+		usb_unmask(mask);
+	}
+
+	void usb_trace_trigger(uint16_t cause)
+	{
+		uint32_t mask = usb_mask();
+		if (usb_trace_post < 0) {
+			usb_trace_post = USB_TRACE_POST + 1;
+			usb_unmask(mask);
+			usb_trace(USB_TRACE_TRIGGER, 0, cause);
+			return;
+		}
+		usb_unmask(mask);
+	}
+
+	int usb_trace_frozen(void)
+	{
+		return usb_trace_post == 0;
+	}
+
+	int usb_trace_count(void)
+	{
+		return usb_trace_head < USB_TRACE_SIZE ? usb_trace_head : USB_TRACE_SIZE;
+	}
+
+	void usb_trace_get(int n, uint32_t *cycles, uint32_t *info)
+	{
+		uint32_t i = (usb_trace_head - usb_trace_count() + n) & (USB_TRACE_SIZE - 1);
+		*cycles = usb_trace_ring[i].cycles;
+		*info = usb_trace_ring[i].info;
+	}
+
+	void usb_trace_rearm(void)
+	{
+		uint32_t mask = usb_mask();
+		usb_trace_head = 0;
+		usb_trace_post = -1;
+		usb_unmask(mask);
+	}
+
+	#define USB_TRACE_EVENT(type, ep, arg)	usb_trace(type, ep, arg)
+	#define USB_TRACE_EP(p, tx)				((p) | ((tx) ? 0x80 : 0))
+
+#else
+
+	#define USB_TRACE_EVENT(type, ep, arg)
+
+	void usb_trace_trigger(uint16_t cause)	{}
+	int usb_trace_frozen(void)				{ return 0; }
+	int usb_trace_count(void)				{ return 0; }
+	void usb_trace_get(int n, uint32_t *cycles, uint32_t *info)	{ *cycles = 0; *info = 0; }
+	void usb_trace_rearm(void)				{}
+
+#endif
+
 extern uint8_t usb_descriptor_buffer[]; // defined in usb_desc.c
 extern const uint8_t usb_config_descriptor_480[];
 extern const uint8_t usb_config_descriptor_12[];
@@ -112,6 +231,7 @@ static void endpoint0_complete(void);
 
 
 static void run_callbacks(endpoint_t *ep);
+static void run_completions(uint32_t completestatus);
 
 
 // prh created empty usb_init() method to be called by paul's static code,
@@ -209,14 +329,13 @@ FLASHMEM void my_usb_init(void)
 		USB_USBINTR_URE | USB_USBINTR_SLE;
 	//_VectorsRam[IRQ_USB1+16] = &usb_isr;
 	attachInterruptVector(IRQ_USB1, &usb_isr);
+	NVIC_SET_PRIORITY(IRQ_USB1, USB_ISR_PRIORITY);
 	NVIC_ENABLE_IRQ(IRQ_USB1);
 	//printf("USB1_ENDPTCTRL0=%08lX\n", USB1_ENDPTCTRL0);
 	//printf("USB1_ENDPTCTRL1=%08lX\n", USB1_ENDPTCTRL1);
 	//printf("USB1_ENDPTCTRL2=%08lX\n", USB1_ENDPTCTRL2);
 	//printf("USB1_ENDPTCTRL3=%08lX\n", USB1_ENDPTCTRL3);
 	USB1_USBCMD = USB_USBCMD_RS;
-	//transfer_log_head = 0;
-	//transfer_log_count = 0;
 	//USB1_PORTSC1 |= USB_PORTSC1_PFSC; // force 12 Mbit/sec
 }
 
@@ -270,6 +389,7 @@ void usb_isr(void)
 			USB1_ENDPTFLUSH = (1<<16) | (1<<0); // page 3174
 			while (USB1_ENDPTFLUSH & ((1<<16) | (1<<0))) ;
 			endpoint0_notify_mask = 0;
+			USB_TRACE_EVENT(USB_TRACE_SETUP, 0, s.wRequestAndType);
 			endpoint0_setup(s.bothwords);
 			setupstatus = USB1_ENDPTSETUPSTAT; // page 3175
 		}
@@ -282,25 +402,12 @@ void usb_isr(void)
 				endpoint0_complete();
 			}
 			completestatus &= endpointN_notify_mask;
-#if 1
-			if (completestatus) {
 
-				// transmit:
-				uint32_t tx = completestatus >> 16;
-				while (tx) {
-					int p=__builtin_ctz(tx);
-					run_callbacks(endpoint_queue_head + p * 2 + 1);
-					tx &= ~(1<<p);
-				}
+#if 1
+			// prh - the audio first, then everything else
 
-				// receive:
-				uint32_t rx = completestatus & 0xffff;
-				while(rx) {
-					int p=__builtin_ctz(rx);
-					run_callbacks(endpoint_queue_head + p * 2);
-					rx &= ~(1<<p);
-				};
-			}
+			run_completions(completestatus & endpointN_iso_mask);
+			run_completions(completestatus & ~endpointN_iso_mask);
 #else
 			if (completestatus) {
 				int i;   // TODO: optimize with __builtin_ctz()
@@ -318,6 +425,7 @@ void usb_isr(void)
 		}
 	}
 	if (status & USB_USBSTS_URI) { // page 3164
+		USB_TRACE_EVENT(USB_TRACE_RESET, 0, 0);
 		USB1_ENDPTSETUPSTAT = USB1_ENDPTSETUPSTAT; // Clear all setup token semaphores
 		USB1_ENDPTCOMPLETE = USB1_ENDPTCOMPLETE; // Clear all the endpoint complete status
 		while (USB1_ENDPTPRIME != 0) ; // Wait for any endpoint priming
@@ -333,6 +441,7 @@ void usb_isr(void)
 		usb_serial_reset();
 		#endif
 		endpointN_notify_mask = 0;
+		endpointN_iso_mask = 0;
 		// TODO: Free all allocated dTDs
 		//if (++reset_count >= 3) {
 			// shut off USB - easier to see results in protocol analyzer
@@ -362,6 +471,12 @@ void usb_isr(void)
 		//printf("error\n");
 	}
 	if ((USB1_USBINTR & USB_USBINTR_SRE) && (status & USB_USBSTS_SRI)) {
+		#if USB_TRACE
+			uint32_t frindex = USB1_FRINDEX;
+			if (!(frindex & 7))
+				USB_TRACE_EVENT(USB_TRACE_SOF, 0, frindex);
+					// just the 1ms frames, not every microframe
+		#endif
 		//printf("sof %d\n", usb_reboot_timer);
 		if (usb_reboot_timer) {
 			if (--usb_reboot_timer == 0) {
@@ -370,7 +485,10 @@ void usb_isr(void)
 			}
 		}
 		#ifdef MIDI_INTERFACE
-		usb_midi_flush_output();
+		if (++usb_midi_flush_count >= usb_midi_flush_divider) {
+			usb_midi_flush_count = 0;
+			usb_midi_flush_output();
+		}
 		#endif
 		#ifdef MULTITOUCH_INTERFACE
 		usb_touchscreen_update_callback();
@@ -679,9 +797,10 @@ static void endpoint0_setup(uint64_t setupdata)
 		break;
 	  case 0x81A2: // GET_CUR (wValue=0, wIndex=interface, wLength=len)
 		if (setup.wLength >= 3) {
-			endpoint0_buffer[0] = 44100 & 255;
-			endpoint0_buffer[1] = 44100 >> 8;
-			endpoint0_buffer[2] = 0;
+			// prh - the rate from usbAudio.h
+			endpoint0_buffer[0] = USB_AUDIO_RATE & 255;
+			endpoint0_buffer[1] = (USB_AUDIO_RATE >> 8) & 255;
+			endpoint0_buffer[2] = USB_AUDIO_RATE >> 16;
 			endpoint0_transmit(endpoint0_buffer, 3, 0);
 			return;
 		}
@@ -884,6 +1003,7 @@ void usb_config_rx(uint32_t ep, uint32_t packet_size, int do_zlp, void (*cb)(tra
 	if (ep < 2 || ep > NUM_ENDPOINTS) return;
 	usb_endpoint_config(endpoint_queue_head + ep * 2, config, cb);
 	if (cb) endpointN_notify_mask |= (1 << ep);
+	endpointN_iso_mask &= ~(1 << ep);
 }
 
 void usb_config_tx(uint32_t ep, uint32_t packet_size, int do_zlp, void (*cb)(transfer_t *))
@@ -892,6 +1012,7 @@ void usb_config_tx(uint32_t ep, uint32_t packet_size, int do_zlp, void (*cb)(tra
 	if (ep < 2 || ep > NUM_ENDPOINTS) return;
 	usb_endpoint_config(endpoint_queue_head + ep * 2 + 1, config, cb);
 	if (cb) endpointN_notify_mask |= (1 << (ep + 16));
+	endpointN_iso_mask &= ~(1 << (ep + 16));
 }
 
 void usb_config_rx_iso(uint32_t ep, uint32_t packet_size, int mult, void (*cb)(transfer_t *))
@@ -901,6 +1022,7 @@ void usb_config_rx_iso(uint32_t ep, uint32_t packet_size, int mult, void (*cb)(t
 	if (ep < 2 || ep > NUM_ENDPOINTS) return;
 	usb_endpoint_config(endpoint_queue_head + ep * 2, config, cb);
 	if (cb) endpointN_notify_mask |= (1 << ep);
+	endpointN_iso_mask |= (1 << ep);
 }
 
 void usb_config_tx_iso(uint32_t ep, uint32_t packet_size, int mult, void (*cb)(transfer_t *))
@@ -910,6 +1032,7 @@ void usb_config_tx_iso(uint32_t ep, uint32_t packet_size, int mult, void (*cb)(t
 	if (ep < 2 || ep > NUM_ENDPOINTS) return;
 	usb_endpoint_config(endpoint_queue_head + ep * 2 + 1, config, cb);
 	if (cb) endpointN_notify_mask |= (1 << (ep + 16));
+	endpointN_iso_mask |= (1 << (ep + 16));
 }
 
 
@@ -927,46 +1050,39 @@ void usb_prepare_transfer(transfer_t *transfer, const void *data, uint32_t len,
 	transfer->callback_param = param;
 }
 
-#if 0
-void usb_print_transfer_log(void)
-{
-	uint32_t i, count;
-	printf("log %d transfers\n", transfer_log_count);
-	count = transfer_log_count;
-	if (count > LOG_SIZE) count = LOG_SIZE;
-
-	for (i=0; i < count; i++) {
-		if (transfer_log_head == 0) transfer_log_head = LOG_SIZE;
-		transfer_log_head--;
-		uint32_t log = transfer_log[transfer_log_head];
-		printf(" %c %X\n", log >> 8, (int)(log & 255));
-	}
-}
-#endif
 
 static void schedule_transfer(endpoint_t *endpoint, uint32_t epmask, transfer_t *transfer)
 {
-	// when we stop at 6, why is the last transfer missing from the USB output?
-	//if (transfer_log_count >= 6) return;
-
 	//uint32_t ret = (*(const uint8_t *)transfer->pointer0) << 8;
 	if (endpoint->callback_function) {
 		transfer->status |= (1<<15);
 	}
-	__disable_irq();
+	uint32_t mask = usb_mask();
+		// prh - was __disable_irq()
 	//digitalWriteFast(1, HIGH);
 	// Executing A Transfer Descriptor, page 2468 (RT1060 manual, Rev 1, 12/2018)
 	transfer_t *last = endpoint->last_transfer;
 	if (last) {
 		last->next = (uint32_t)transfer;
+		USB_TRACE_EVENT(USB_TRACE_PRIME, USB_TRACE_EP(__builtin_ctz(epmask) & 15, epmask >> 16), 1);
 		if (USB1_ENDPTPRIME & epmask) goto end;
 		//digitalWriteFast(2, HIGH);
 		//ret |= 0x01;
 		uint32_t status, cyccnt=ARM_DWT_CYCCNT;
+		#if USB_TRACE
+			uint16_t retries = 0;
+		#endif
 		do {
 			USB1_USBCMD |= USB_USBCMD_ATDTW;
 			status = USB1_ENDPTSTATUS;
+			#if USB_TRACE
+				retries++;
+			#endif
 		} while (!(USB1_USBCMD & USB_USBCMD_ATDTW) && (ARM_DWT_CYCCNT - cyccnt < 2400));
+		#if USB_TRACE
+			if (retries > 1)
+				USB_TRACE_EVENT(USB_TRACE_ATDTW, USB_TRACE_EP(__builtin_ctz(epmask) & 15, epmask >> 16), retries - 1);
+		#endif
 		//USB1_USBCMD &= ~USB_USBCMD_ATDTW;
 		if (status & epmask) goto end;
 		//ret |= 0x02;
@@ -976,20 +1092,18 @@ static void schedule_transfer(endpoint_t *endpoint, uint32_t epmask, transfer_t
 		goto end;
 	}
 	//digitalWriteFast(4, HIGH);
+	USB_TRACE_EVENT(USB_TRACE_PRIME, USB_TRACE_EP(__builtin_ctz(epmask) & 15, epmask >> 16), 0);
 	endpoint->next = (uint32_t)transfer;
 	endpoint->status = 0;
 	USB1_ENDPTPRIME |= epmask;
 	endpoint->first_transfer = transfer;
 end:
 	endpoint->last_transfer = transfer;
-	__enable_irq();
+	usb_unmask(mask);
 	//digitalWriteFast(4, LOW);
 	//digitalWriteFast(3, LOW);
 	//digitalWriteFast(2, LOW);
 	//digitalWriteFast(1, LOW);
-	//if (transfer_log_head > LOG_SIZE) transfer_log_head = 0;
-	//transfer_log[transfer_log_head++] = ret;
-	//transfer_log_count++;
 }
 	// ENDPTPRIME -  Software should write a one to the corresponding bit when
 	//		 posting a new transfer descriptor to an endpoint queue head.
@@ -1032,11 +1146,38 @@ end:
 	uint32_t unused1;
 };*/
 
+static void run_completions(uint32_t completestatus)
+	// prh - the transmit and receive callbacks for ENDPTCOMPLETE bits
+{
+	// transmit:
+	uint32_t tx = completestatus >> 16;
+	while (tx) {
+		int p=__builtin_ctz(tx);
+		run_callbacks(endpoint_queue_head + p * 2 + 1);
+		tx &= ~(1<<p);
+	}
+
+	// receive:
+	uint32_t rx = completestatus & 0xffff;
+	while(rx) {
+		int p=__builtin_ctz(rx);
+		run_callbacks(endpoint_queue_head + p * 2);
+		rx &= ~(1<<p);
+	};
+}
+
+
 static void run_callbacks(endpoint_t *ep)
 {
 	//printf("run_callbacks\n");
+	// prh - the list is walked with the USB masked, but not the callbacks
+
+	uint32_t mask = usb_mask();
 	transfer_t *first = ep->first_transfer;
-	if (first == NULL) return;
+	if (first == NULL) {
+		usb_unmask(mask);
+		return;
+	}
 
 	// count how many transfers are completed, then remove them from the endpoint's list
 	uint32_t count = 0;
@@ -1058,13 +1199,25 @@ static void run_callbacks(endpoint_t *ep)
 			break;
 		}
 	}
+	usb_unmask(mask);
+
 	// do all the callbacks
+	#if USB_TRACE
+		int index = ep - endpoint_queue_head;
+		uint8_t trace_ep = USB_TRACE_EP(index >> 1, index & 1);
+		USB_TRACE_EVENT(USB_TRACE_COMPLETE, trace_ep, count);
+		uint32_t start = ARM_DWT_CYCCNT;
+	#endif
 	while (count) {
 		transfer_t *next = (transfer_t *)first->next;
 		ep->callback_function(first);
 		first = next;
 		count--;
 	}
+	#if USB_TRACE
+		uint32_t cycles = ARM_DWT_CYCCNT - start;
+		USB_TRACE_EVENT(USB_TRACE_CALLBACK, trace_ep, cycles > 0xffff ? 0xffff : cycles);
+	#endif
 }
 
 void usb_transmit(int endpoint_number, transfer_t *transfer)
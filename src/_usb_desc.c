@@ -37,6 +37,8 @@
 #include "imxrt.h"
 #include "avr_functions.h"
 #include "avr/pgmspace.h"
+#include "usbAudio.h"
+	// prh - the audio stream format
 
 // At very slow CPU speeds, the OCRAM just isn't fast enough for
 // USB to work reliably.  But the precious/limited DTCM is.  So
@@ -636,7 +638,7 @@ static uint8_t microsoft_os_compatible_id_desc[] = {
 
 #define AUDIO_INTERFACE_DESC_POS	KEYMEDIA_INTERFACE_DESC_POS+KEYMEDIA_INTERFACE_DESC_SIZE
 #ifdef  AUDIO_INTERFACE
-#define AUDIO_INTERFACE_DESC_SIZE	8 + 9+10+12+9+12+10+9 + 9+9+7+11+9+7 + 9+9+7+11+9+7+9
+#define AUDIO_INTERFACE_DESC_SIZE	8 + 9+10+12+9+12+USB_AUDIO_FEATURE_SIZE+9 + 9+9+7+11+9+7 + 9+9+7+11+9+7+9
 #else
 #define AUDIO_INTERFACE_DESC_SIZE	0
 #endif
@@ -1437,7 +1439,7 @@ PROGMEM const uint8_t usb_config_descriptor_480[CONFIG_DESC_SIZE] = {
 	0x24,					// bDescriptorType, 0x24 = CS_INTERFACE
 	0x01,					// bDescriptorSubtype, 1 = HEADER
 	0x00, 0x01,				// bcdADC (version 1.0)
-	LSB(62), MSB(62),			// wTotalLength
+	LSB(52+USB_AUDIO_FEATURE_SIZE), MSB(52+USB_AUDIO_FEATURE_SIZE),	// wTotalLength
 	2,					// bInCollection
 	AUDIO_INTERFACE+1,			// baInterfaceNr(1) - Transmit to PC
 	AUDIO_INTERFACE+2,			// baInterfaceNr(2) - Receive from PC
@@ -1451,8 +1453,8 @@ PROGMEM const uint8_t usb_config_descriptor_480[CONFIG_DESC_SIZE] = {
 	//0x03, 0x06,				// wTerminalType, 0x0603 = Line Connector
 	0x02, 0x06,				// wTerminalType, 0x0602 = Digital Audio
 	0,					// bAssocTerminal, 0 = unidirectional
-	2,					// bNrChannels
-	0x03, 0x00,				// wChannelConfig, 0x0003 = Left & Right Front
+	USB_AUDIO_CHANNELS,			// bNrChannels (prh - usbAudio.h)
+	LSB(USB_AUDIO_CHANNEL_CONFIG), MSB(USB_AUDIO_CHANNEL_CONFIG),	// wChannelConfig
 	0,					// iChannelNames
 	0, 					// iTerminal
 	// Output Terminal Descriptor
@@ -1473,20 +1475,24 @@ PROGMEM const uint8_t usb_config_descriptor_480[CONFIG_DESC_SIZE] = {
 	3,					// bTerminalID
 	0x01, 0x01,				// wTerminalType, 0x0101 = USB_STREAMING
 	0,					// bAssocTerminal, 0 = unidirectional
-	2,					// bNrChannels
-	0x03, 0x00,				// wChannelConfig, 0x0003 = Left & Right Front
+	USB_AUDIO_CHANNELS,			// bNrChannels (prh - usbAudio.h)
+	LSB(USB_AUDIO_CHANNEL_CONFIG), MSB(USB_AUDIO_CHANNEL_CONFIG),	// wChannelConfig
 	0,					// iChannelNames
 	0, 					// iTerminal
 	// Volume feature descriptor
-	10,					// bLength
+	USB_AUDIO_FEATURE_SIZE,			// bLength
 	0x24, 				// bDescriptorType = CS_INTERFACE
 	0x06, 				// bDescriptorSubType = FEATURE_UNIT
 	0x31, 				// bUnitID
 	0x03, 				// bSourceID (Input Terminal)
-	0x01, 				// bControlSize (each channel is 1 byte, 3 channels)
+	0x01, 				// bControlSize (each channel is 1 byte)
 	0x01, 				// bmaControls(0) Master: Mute
 	0x02, 				// bmaControls(1) Left: Volume
 	0x02, 				// bmaControls(2) Right: Volume
+#if USB_AUDIO_CHANNELS == 4
+	0x02, 				// bmaControls(3) Looper Left: Volume
+	0x02, 				// bmaControls(4) Looper Right: Volume
+#endif
 	0x00,				// iFeature
 	// Output Terminal Descriptor
 	// USB DCD for Audio Devices 1.0, Table 4-4, page 40
@@ -1535,18 +1541,18 @@ PROGMEM const uint8_t usb_config_descriptor_480[CONFIG_DESC_SIZE] = {
 	0x24,					// bDescriptorType = CS_INTERFACE
 	2,					// bDescriptorSubtype = FORMAT_TYPE
 	1,					// bFormatType = FORMAT_TYPE_I
-	2,					// bNrChannels = 2
-	2,					// bSubFrameSize = 2 byte
-	16,					// bBitResolution = 16 bits
+	USB_AUDIO_CHANNELS,			// bNrChannels
+	USB_AUDIO_SUBFRAME,			// bSubFrameSize (prh - usbAudio.h)
+	USB_AUDIO_BITS,				// bBitResolution
 	1,					// bSamFreqType = 1 frequency
-	LSB(44100), MSB(44100), 0,		// tSamFreq
+	LSB(USB_AUDIO_RATE), MSB(USB_AUDIO_RATE), (USB_AUDIO_RATE >> 16),	// tSamFreq
 	// Standard AS Isochronous Audio Data Endpoint Descriptor
 	// USB DCD for Audio Devices 1.0, Section 4.6.1.1, Table 4-20, page 61-62
 	9, 					// bLength
 	5, 					// bDescriptorType, 5 = ENDPOINT_DESCRIPTOR
 	AUDIO_TX_ENDPOINT | 0x80,		// bEndpointAddress
 	0x09, 					// bmAttributes = isochronous, adaptive
-	LSB(AUDIO_TX_SIZE), MSB(AUDIO_TX_SIZE),	// wMaxPacketSize
+	LSB(USB_AUDIO_TX_SIZE), MSB(USB_AUDIO_TX_SIZE),	// wMaxPacketSize
 	4,			 		// bInterval, 4 = every 8 micro-frames
 	0,					// bRefresh
 	0,					// bSynchAddress
@@ -1594,18 +1600,18 @@ PROGMEM const uint8_t usb_config_descriptor_480[CONFIG_DESC_SIZE] = {
 	0x24,					// bDescriptorType = CS_INTERFACE
 	2,					// bDescriptorSubtype = FORMAT_TYPE
 	1,					// bFormatType = FORMAT_TYPE_I
-	2,					// bNrChannels = 2
-	2,					// bSubFrameSize = 2 byte
-	16,					// bBitResolution = 16 bits
+	USB_AUDIO_CHANNELS,			// bNrChannels
+	USB_AUDIO_SUBFRAME,			// bSubFrameSize (prh - usbAudio.h)
+	USB_AUDIO_BITS,				// bBitResolution
 	1,					// bSamFreqType = 1 frequency
-	LSB(44100), MSB(44100), 0,		// tSamFreq
+	LSB(USB_AUDIO_RATE), MSB(USB_AUDIO_RATE), (USB_AUDIO_RATE >> 16),	// tSamFreq
 	// Standard AS Isochronous Audio Data Endpoint Descriptor
 	// USB DCD for Audio Devices 1.0, Section 4.6.1.1, Table 4-20, page 61-62
 	9, 					// bLength
 	5, 					// bDescriptorType, 5 = ENDPOINT_DESCRIPTOR
 	AUDIO_RX_ENDPOINT,			// bEndpointAddress
 	0x05, 					// bmAttributes = isochronous, asynchronous
-	LSB(AUDIO_RX_SIZE), MSB(AUDIO_RX_SIZE),	// wMaxPacketSize
+	LSB(USB_AUDIO_RX_SIZE), MSB(USB_AUDIO_RX_SIZE),	// wMaxPacketSize
 	4,			 		// bInterval, 4 = every 8 micro-frames
 	0,					// bRefresh
 	AUDIO_SYNC_ENDPOINT | 0x80,		// bSynchAddress
@@ -2464,7 +2470,7 @@ PROGMEM const uint8_t usb_config_descriptor_12[CONFIG_DESC_SIZE] = {
 	0x24,					// bDescriptorType, 0x24 = CS_INTERFACE
 	0x01,					// bDescriptorSubtype, 1 = HEADER
 	0x00, 0x01,				// bcdADC (version 1.0)
-	LSB(62), MSB(62),			// wTotalLength
+	LSB(52+USB_AUDIO_FEATURE_SIZE), MSB(52+USB_AUDIO_FEATURE_SIZE),	// wTotalLength
 	2,					// bInCollection
 	AUDIO_INTERFACE+1,			// baInterfaceNr(1) - Transmit to PC
 	AUDIO_INTERFACE+2,			// baInterfaceNr(2) - Receive from PC
@@ -2478,8 +2484,8 @@ PROGMEM const uint8_t usb_config_descriptor_12[CONFIG_DESC_SIZE] = {
 	//0x03, 0x06,				// wTerminalType, 0x0603 = Line Connector
 	0x02, 0x06,				// wTerminalType, 0x0602 = Digital Audio
 	0,					// bAssocTerminal, 0 = unidirectional
-	2,					// bNrChannels
-	0x03, 0x00,				// wChannelConfig, 0x0003 = Left & Right Front
+	USB_AUDIO_CHANNELS,			// bNrChannels (prh - usbAudio.h)
+	LSB(USB_AUDIO_CHANNEL_CONFIG), MSB(USB_AUDIO_CHANNEL_CONFIG),	// wChannelConfig
 	0,					// iChannelNames
 	0, 					// iTerminal
 	// Output Terminal Descriptor
@@ -2500,20 +2506,24 @@ PROGMEM const uint8_t usb_config_descriptor_12[CONFIG_DESC_SIZE] = {
 	3,					// bTerminalID
 	0x01, 0x01,				// wTerminalType, 0x0101 = USB_STREAMING
 	0,					// bAssocTerminal, 0 = unidirectional
-	2,					// bNrChannels
-	0x03, 0x00,				// wChannelConfig, 0x0003 = Left & Right Front
+	USB_AUDIO_CHANNELS,			// bNrChannels (prh - usbAudio.h)
+	LSB(USB_AUDIO_CHANNEL_CONFIG), MSB(USB_AUDIO_CHANNEL_CONFIG),	// wChannelConfig
 	0,					// iChannelNames
 	0, 					// iTerminal
 	// Volume feature descriptor
-	10,					// bLength
+	USB_AUDIO_FEATURE_SIZE,			// bLength
 	0x24, 				// bDescriptorType = CS_INTERFACE
 	0x06, 				// bDescriptorSubType = FEATURE_UNIT
 	0x31, 				// bUnitID
 	0x03, 				// bSourceID (Input Terminal)
-	0x01, 				// bControlSize (each channel is 1 byte, 3 channels)
+	0x01, 				// bControlSize (each channel is 1 byte)
 	0x01, 				// bmaControls(0) Master: Mute
 	0x02, 				// bmaControls(1) Left: Volume
 	0x02, 				// bmaControls(2) Right: Volume
+#if USB_AUDIO_CHANNELS == 4
+	0x02, 				// bmaControls(3) Looper Left: Volume
+	0x02, 				// bmaControls(4) Looper Right: Volume
+#endif
 	0x00,				// iFeature
 	// Output Terminal Descriptor
 	// USB DCD for Audio Devices 1.0, Table 4-4, page 40
@@ -2562,18 +2572,18 @@ PROGMEM const uint8_t usb_config_descriptor_12[CONFIG_DESC_SIZE] = {
 	0x24,					// bDescriptorType = CS_INTERFACE
 	2,					// bDescriptorSubtype = FORMAT_TYPE
 	1,					// bFormatType = FORMAT_TYPE_I
-	2,					// bNrChannels = 2
-	2,					// bSubFrameSize = 2 byte
-	16,					// bBitResolution = 16 bits
+	USB_AUDIO_CHANNELS,			// bNrChannels
+	USB_AUDIO_SUBFRAME,			// bSubFrameSize (prh - usbAudio.h)
+	USB_AUDIO_BITS,				// bBitResolution
 	1,					// bSamFreqType = 1 frequency
-	LSB(44100), MSB(44100), 0,		// tSamFreq
+	LSB(USB_AUDIO_RATE), MSB(USB_AUDIO_RATE), (USB_AUDIO_RATE >> 16),	// tSamFreq
 	// Standard AS Isochronous Audio Data Endpoint Descriptor
 	// USB DCD for Audio Devices 1.0, Section 4.6.1.1, Table 4-20, page 61-62
 	9, 					// bLength
 	5, 					// bDescriptorType, 5 = ENDPOINT_DESCRIPTOR
 	AUDIO_TX_ENDPOINT | 0x80,		// bEndpointAddress
 	0x09, 					// bmAttributes = isochronous, adaptive
-	LSB(AUDIO_TX_SIZE), MSB(AUDIO_TX_SIZE),	// wMaxPacketSize
+	LSB(USB_AUDIO_TX_SIZE), MSB(USB_AUDIO_TX_SIZE),	// wMaxPacketSize
 	1,			 		// bInterval, 1 = every frame
 	0,					// bRefresh
 	0,					// bSynchAddress
@@ -2621,18 +2631,18 @@ PROGMEM const uint8_t usb_config_descriptor_12[CONFIG_DESC_SIZE] = {
 	0x24,					// bDescriptorType = CS_INTERFACE
 	2,					// bDescriptorSubtype = FORMAT_TYPE
 	1,					// bFormatType = FORMAT_TYPE_I
-	2,					// bNrChannels = 2
-	2,					// bSubFrameSize = 2 byte
-	16,					// bBitResolution = 16 bits
+	USB_AUDIO_CHANNELS,			// bNrChannels
+	USB_AUDIO_SUBFRAME,			// bSubFrameSize (prh - usbAudio.h)
+	USB_AUDIO_BITS,				// bBitResolution
 	1,					// bSamFreqType = 1 frequency
-	LSB(44100), MSB(44100), 0,		// tSamFreq
+	LSB(USB_AUDIO_RATE), MSB(USB_AUDIO_RATE), (USB_AUDIO_RATE >> 16),	// tSamFreq
 	// Standard AS Isochronous Audio Data Endpoint Descriptor
 	// USB DCD for Audio Devices 1.0, Section 4.6.1.1, Table 4-20, page 61-62
 	9, 					// bLength
 	5, 					// bDescriptorType, 5 = ENDPOINT_DESCRIPTOR
 	AUDIO_RX_ENDPOINT,			// bEndpointAddress
 	0x05, 					// bmAttributes = isochronous, asynchronous
-	LSB(AUDIO_RX_SIZE), MSB(AUDIO_RX_SIZE),	// wMaxPacketSize
+	LSB(USB_AUDIO_RX_SIZE), MSB(USB_AUDIO_RX_SIZE),	// wMaxPacketSize
 	1,			 		// bInterval, 1 = every frame
 	0,					// bRefresh
 	AUDIO_SYNC_ENDPOINT | 0x80,		// bSynchAddress
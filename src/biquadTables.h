@@ -0,0 +1,137 @@
+//-------------------------------------------------------
+// biquadTables.h
+//-------------------------------------------------------
+// Compile time tables for SGTL5000::calcBiquad().
+//
+// The cookbook biquad math itself is just a few single precision
+// multiplies, and the divides by Q, A and a0, which the M7 FPU does
+// in hardware.  What costs is the software double pow(), and
+// sinf()/cosf().
+// So those are replaced by tables built by the compiler:
+//
+//		cos(w0) and sin(w0) at BIQUAD_NUM_FREQS log spaced
+//		frequencies from 20Hz to 20kHz at AUDIO_SAMPLE_RATE_EXACT
+//
+//		10^(dB/40) and its square root 10^(dB/80) in 0.5dB
+//		steps from -48dB to +48dB
+//
+// and calcBiquad() interpolates linearly between grid points.
+// Measured against double precision at 44.1kHz, over 20Hz..20kHz and
+// -48..+48dB, the worst case errors are 7e-4 in cos(w0) and 4e-4 in
+// sin(w0), both just under 20kHz, and 1.1e-4 relative in A.  They only
+// get smaller as the frequency goes down, or the sample rate goes up.
+//
+// Everything here is constexpr, with our own little sin() and exp()
+// series, so the tables end up in flash and there is no startup code.
+
+#pragma once
+
+#include <Arduino.h>
+#include <AudioStream.h>
+
+
+#define BIQUAD_NUM_FREQS	256
+#define BIQUAD_MIN_FREQ		20.0
+#define BIQUAD_MAX_FREQ		20000.0
+
+#define BIQUAD_MIN_DB		-48
+#define BIQUAD_MAX_DB		48
+#define BIQUAD_DB_STEPS		2
+	// table entries per dB
+#define BIQUAD_NUM_GAINS	((BIQUAD_MAX_DB - BIQUAD_MIN_DB) * BIQUAD_DB_STEPS + 1)
+
+
+namespace biquad
+{
+	constexpr double c_pi = 3.14159265358979323846;
+	constexpr double c_ln10 = 2.30258509299404568402;
+
+	constexpr double cx_sin(double x)
+		// range reduce to -pi..pi and sum the taylor series
+	{
+		while (x > c_pi) x -= 2 * c_pi;
+		while (x < -c_pi) x += 2 * c_pi;
+		double term = x;
+		double sum = x;
+		for (int n=1; n<16; n++)
+		{
+			term *= -x * x / ((2*n) * (2*n+1));
+			sum += term;
+		}
+		return sum;
+	}
+
+	constexpr double cx_cos(double x)
+	{
+		return cx_sin(x + c_pi / 2);
+	}
+
+	constexpr double cx_exp(double x)
+		// exp(x) = exp(x / 2^k) ^ (2^k)
+	{
+		int k = 0;
+		while (x > 0.5 || x < -0.5)
+		{
+			x /= 2;
+			k++;
+		}
+		double term = 1;
+		double sum = 1;
+		for (int n=1; n<16; n++)
+		{
+			term *= x / n;
+			sum += term;
+		}
+		while (k--)
+			sum *= sum;
+		return sum;
+	}
+
+
+	struct freqTable
+	{
+		float freq[BIQUAD_NUM_FREQS];
+		float cos_w0[BIQUAD_NUM_FREQS];
+		float sin_w0[BIQUAD_NUM_FREQS];
+
+		constexpr freqTable() : freq(), cos_w0(), sin_w0()
+		{
+			// ln(20000/20) = ln(1000) = 3 * ln(10)
+			for (int i=0; i<BIQUAD_NUM_FREQS; i++)
+			{
+				double f = BIQUAD_MIN_FREQ * cx_exp(3 * c_ln10 * i / (BIQUAD_NUM_FREQS - 1));
+				double w0 = 2 * c_pi * f / AUDIO_SAMPLE_RATE_EXACT;
+				freq[i] = f;
+				cos_w0[i] = cx_cos(w0);
+				sin_w0[i] = cx_sin(w0);
+			}
+		}
+	};
+
+
+	struct gainTable
+	{
+		float A[BIQUAD_NUM_GAINS];
+			// 10^(dB/40)
+		float sqrt_A[BIQUAD_NUM_GAINS];
+			// 10^(dB/80)
+
+		constexpr gainTable() : A(), sqrt_A()
+		{
+			for (int i=0; i<BIQUAD_NUM_GAINS; i++)
+			{
+				double dB = BIQUAD_MIN_DB + (double) i / BIQUAD_DB_STEPS;
+				A[i] = cx_exp(dB * c_ln10 / 40);
+				sqrt_A[i] = cx_exp(dB * c_ln10 / 80);
+			}
+		}
+	};
+
+
+	constexpr freqTable freq_table;
+	constexpr gainTable gain_table;
+
+}	// namespace biquad
+
+
+// end of biquadTables.h
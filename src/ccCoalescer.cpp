@@ -0,0 +1,52 @@
+//-------------------------------------------------------
+// ccCoalescer.cpp
+//-------------------------------------------------------
+// See ccCoalescer.h.  Everything here runs in loop().
+
+#include "ccCoalescer.h"
+
+
+ccCoalescer::ccCoalescer(const ccTarget_t *targets) :
+	m_targets(targets),
+	m_num_pending(0)
+{
+	memset(m_pending,0,sizeof(m_pending));
+}
+
+
+void ccCoalescer::queue(uint8_t target, uint8_t cc, uint8_t val)
+{
+	if (!m_pending[target][cc])
+		m_order[m_num_pending++] = (target << 7) | cc;
+	m_pending[target][cc] = val + 1;
+}
+
+
+void ccCoalescer::dispatchPending()
+{
+	for (int i=0; i<m_num_pending; i++)
+	{
+		uint8_t target = m_order[i] >> 7;
+		uint8_t cc = m_order[i] & 0x7f;
+		uint8_t val = m_pending[target][cc] - 1;
+		m_pending[target][cc] = 0;
+		m_targets[target].dispatch(cc,val);
+	}
+	m_num_pending = 0;
+}
+
+
+void ccCoalescer::handleCC(uint8_t target, uint8_t cc, uint8_t val)
+{
+	if (m_targets[target].is_continuous(cc))
+	{
+		queue(target,cc,val);
+		return;
+	}
+
+	dispatchPending();
+	m_targets[target].dispatch(cc,val);
+}
+
+
+// end of ccCoalescer.cpp
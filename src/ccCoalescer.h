@@ -0,0 +1,74 @@
+//-------------------------------------------------------
+// ccCoalescer.h
+//-------------------------------------------------------
+// The CC handling between serialMidi::read() and the dispatchCC()s,
+// for handleSerialMidi(), and built as is by the control bench.
+//
+// For continuous CCs, last value wins.  Those are the ones that are
+// ramped anyway (CC_AUTO_RAMP and CC_AUTO_MIXER in the descriptor
+// tables), where only the latest value matters.  Each pass reads every
+// waiting packet, and keeps each continuous CC in m_pending[], which
+// holds the value+1 (0 = nothing pending), remembering the order in
+// which they first arrived.  An expression pedal sweep that queued 20
+// values for one CC while the SGTL5000 was busy costs one dispatch,
+// not 20.
+//
+// Everything else (switches, selects, mutes, and commands) is not
+// coalesced, since the order and every toggle matter.  Everything
+// pending before one is dispatched first, and then it is dispatched
+// at once, so a mute pressed twice in one pass is two mutes, and a
+// DUMP shows the values sent just before it.
+//
+// Each target (the SGTL5000 and the tehub itself) is a pair of
+// functions, given to the constructor, that say whether a CC is
+// continuous, and dispatch it.
+
+#pragma once
+
+#include <Arduino.h>
+
+
+#define CC_TARGET_SGTL		0
+#define CC_TARGET_TEHUB		1
+#define NUM_CC_TARGETS		2
+
+
+typedef bool (*ccContinuousFxn)(uint8_t cc);
+typedef bool (*ccDispatchFxn)(uint8_t cc, uint8_t val);
+
+typedef struct
+{
+	ccContinuousFxn is_continuous;
+	ccDispatchFxn dispatch;
+} ccTarget_t;
+
+
+class ccCoalescer
+{
+public:
+
+	ccCoalescer(const ccTarget_t *targets);
+		// NUM_CC_TARGETS of them, indexed by CC_TARGET_XXX
+
+	void handleCC(uint8_t target, uint8_t cc, uint8_t val);
+		// continuous CCs are coalesced, everything else goes
+		// out at once, after whatever was queued before it
+	void dispatchPending();
+		// at the end of each pass, and before anything
+		// that has to come after the CCs so far
+
+private:
+
+	void queue(uint8_t target, uint8_t cc, uint8_t val);
+
+	const ccTarget_t *m_targets;
+
+	uint8_t m_pending[NUM_CC_TARGETS][128];
+	uint8_t m_order[NUM_CC_TARGETS * 128];
+		// (target << 7) | cc, in order of first arrival
+	int m_num_pending;
+
+};
+
+
+// end of ccCoalescer.h
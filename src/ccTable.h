@@ -0,0 +1,80 @@
+//-------------------------------------------------------
+// ccTable.h
+//-------------------------------------------------------
+// Common bits of the SGTL5000 and tehub CC descriptor tables.
+//
+// Each cable has one constexpr table of descriptors, in flash,
+// holding the CC number, its max value, flags, automation class, and
+// the setter and getter.  A ccIndex, also built by the compiler from
+// the same table, maps a CC number straight to its descriptor, so
+// dispatch, get, dump, the coalescing in handleSerialMidi() and
+// snapshots are all one array lookup, from a single source.
+
+#pragma once
+
+#include <Arduino.h>
+
+
+#define CC_NONE				0xff
+	// ccIndex value for CC numbers that are not in the table
+
+// descriptor flags
+
+#define CC_WRITE_ONLY		0x01
+	// no getter; commands, and the left+right "both" setters
+#define CC_COMMAND			0x02
+	// does something, rather than setting a value.  Commands are
+	// never coalesced, and act as a barrier for the CCs before them.
+
+// automation classes
+
+#define CC_AUTO_NONE		0
+	// takes effect at once, and is never coalesced
+#define CC_AUTO_RAMP		1
+	// ramped by the SGTL5000 scheduler in loop()
+#define CC_AUTO_MIXER		2
+	// ramped per sample by a stereo mixer
+	// Both ramped classes are continuous, so TE3_hub coalesces
+	// them, and only dispatches the latest value.
+
+
+template <int NUM_CCS>
+struct ccIndex
+{
+	uint8_t index[128];
+	bool valid;
+		// false if a CC is in the table twice, or is over 127,
+		// for a static_assert next to the table
+
+	template <typename DESC>
+	constexpr ccIndex(const DESC (&table)[NUM_CCS]) : index(), valid(true)
+	{
+		for (int i=0; i<128; i++)
+			index[i] = CC_NONE;
+		for (int i=0; i<NUM_CCS; i++)
+		{
+			uint8_t cc = table[i].cc;
+			if (cc > 127 || index[cc] != CC_NONE)
+				valid = false;
+			else
+				index[cc] = i;
+		}
+	}
+
+	constexpr uint8_t operator[](uint8_t cc) const
+	{
+		return index[cc & 0x7f];
+	}
+
+	constexpr bool any(uint8_t first, uint8_t last) const
+		// true if any of the CCs first..last are in the table
+	{
+		for (int cc=first; cc<=last; cc++)
+			if (index[cc & 0x7f] != CC_NONE)
+				return true;
+		return false;
+	}
+};
+
+
+// end of ccTable.h
@@ -0,0 +1,168 @@
+//-------------------------------------------------------
+// configStore.cpp
+//-------------------------------------------------------
+// See configStore.h.  A slot header is
+//
+//		0..1	CONFIG_MAGIC
+//		2..5	sequence number
+//		6..7	data length
+//		8..9	CRC16 (CCITT) of the sequence number, length, and data
+//
+// all little endian, followed by the data.
+
+#include "configStore.h"
+#include <EEPROM.h>
+#include <myDebug.h>
+
+#define dbg_config	0
+
+#define CONFIG_MAGIC	0x3EC0
+
+configStore config_store;
+
+
+static uint16_t crc16(uint16_t crc, const uint8_t *data, int len)
+{
+	while (len--)
+	{
+		crc ^= (uint16_t) *data++ << 8;
+		for (int i=0; i<8; i++)
+			crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	return crc;
+}
+
+
+static uint16_t headerCrc(uint32_t seq, uint16_t len, const uint8_t *data)
+{
+	uint8_t buf[6];
+	buf[0] = seq;
+	buf[1] = seq >> 8;
+	buf[2] = seq >> 16;
+	buf[3] = seq >> 24;
+	buf[4] = len;
+	buf[5] = len >> 8;
+	return crc16(crc16(0xffff,buf,6),data,len);
+}
+
+
+configStore::configStore() :
+	m_slot(-1),
+	m_seq(0),
+	m_saved_len(-1),
+	m_saves(0)
+{}
+
+
+bool configStore::readSlot(int slot, uint32_t *seq, uint8_t *data, int *len)
+{
+	int addr = CONFIG_STORE_BASE + slot * CONFIG_SLOT_SIZE;
+	uint8_t hdr[CONFIG_HEADER_SIZE];
+	for (int i=0; i<CONFIG_HEADER_SIZE; i++)
+		hdr[i] = EEPROM.read(addr + i);
+
+	uint16_t magic = hdr[0] | (hdr[1] << 8);
+	uint32_t s = hdr[2] | (hdr[3] << 8) | (hdr[4] << 16) | ((uint32_t) hdr[5] << 24);
+	uint16_t l = hdr[6] | (hdr[7] << 8);
+	uint16_t crc = hdr[8] | (hdr[9] << 8);
+	if (magic != CONFIG_MAGIC || l > CONFIG_MAX_DATA)
+		return false;
+
+	for (int i=0; i<l; i++)
+		data[i] = EEPROM.read(addr + CONFIG_HEADER_SIZE + i);
+	if (headerCrc(s,l,data) != crc)
+	{
+		warning(0,"configStore slot(%d) seq(%d) bad CRC",slot,s);
+		return false;
+	}
+	*seq = s;
+	*len = l;
+	return true;
+}
+
+
+void configStore::writeSlot(int slot, uint32_t seq, const uint8_t *data, int len)
+	// data first, header last.  update() only writes
+	// the bytes that differ, which saves erase cycles.
+{
+	int addr = CONFIG_STORE_BASE + slot * CONFIG_SLOT_SIZE;
+	for (int i=0; i<len; i++)
+		EEPROM.update(addr + CONFIG_HEADER_SIZE + i, data[i]);
+
+	uint16_t crc = headerCrc(seq,len,data);
+	uint8_t hdr[CONFIG_HEADER_SIZE] = {
+		CONFIG_MAGIC & 0xff, CONFIG_MAGIC >> 8,
+		(uint8_t) seq, (uint8_t) (seq >> 8), (uint8_t) (seq >> 16), (uint8_t) (seq >> 24),
+		(uint8_t) len, (uint8_t) (len >> 8),
+		(uint8_t) crc, (uint8_t) (crc >> 8) };
+	for (int i=CONFIG_HEADER_SIZE-1; i>=0; i--)
+		EEPROM.update(addr + i, hdr[i]);
+		// backwards, so the magic goes last
+}
+
+
+int configStore::load(uint8_t *data, int max_len)
+{
+	uint8_t buf[CONFIG_MAX_DATA];
+	m_slot = -1;
+	m_saved_len = -1;
+
+	for (int slot=0; slot<CONFIG_NUM_SLOTS; slot++)
+	{
+		uint32_t seq;
+		int len;
+		if (readSlot(slot,&seq,buf,&len) &&
+			(m_slot < 0 || (int32_t) (seq - m_seq) > 0))
+		{
+			m_slot = slot;
+			m_seq = seq;
+			m_saved_len = len;
+			memcpy(m_saved,buf,len);
+		}
+	}
+
+	if (m_slot < 0)
+	{
+		display(0,"configStore: no saved configuration",0);
+		return -1;
+	}
+	display(dbg_config,"configStore: slot(%d) seq(%d) len(%d)",m_slot,m_seq,m_saved_len);
+	if (m_saved_len > max_len)
+	{
+		my_error("configStore: record(%d) bigger than buffer(%d)",m_saved_len,max_len);
+		return -1;
+	}
+	memcpy(data,m_saved,m_saved_len);
+	return m_saved_len;
+}
+
+
+bool configStore::save(const uint8_t *data, int len)
+{
+	if (len > CONFIG_MAX_DATA)
+	{
+		my_error("configStore: configuration(%d) too big for a slot(%d)",len,CONFIG_MAX_DATA);
+		return false;
+	}
+	if (len == m_saved_len && !memcmp(data,m_saved,len))
+	{
+		display(dbg_config,"configStore: already saved",0);
+		return false;
+	}
+
+	int slot = m_slot < 0 ? 0 : (m_slot + 1) % CONFIG_NUM_SLOTS;
+	uint32_t seq = m_seq + 1;
+	uint32_t start = millis();
+	writeSlot(slot,seq,data,len);
+
+	m_slot = slot;
+	m_seq = seq;
+	memcpy(m_saved,data,len);
+	m_saved_len = len;
+	m_saves++;
+	display(dbg_config,"configStore: saved slot(%d) seq(%d) len(%d) in %d ms",slot,seq,len,millis()-start);
+	return true;
+}
+
+
+// end of configStore.cpp
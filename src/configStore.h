@@ -0,0 +1,80 @@
+//-------------------------------------------------------
+// configStore.h
+//-------------------------------------------------------
+// Keeps the last applied configuration in the teensy's EEPROM
+// (which, on the teensy 4, is emulated in flash, with its own wear
+// leveling underneath) so that setup() can put it back at boot
+// without waiting for TE3 to send it.
+//
+// The contents are an opaque blob to us; TE3_hub.ino uses the same
+// (target, count, cc/val pairs) sections as a scene recall SysEx.
+//
+// The EEPROM is split into CONFIG_NUM_SLOTS slots, each a header
+// (sequence number, length, CRC16) followed by the data.  Each save
+// goes to the slot after the newest one, so the writes are spread
+// over all the slots, and load() takes the valid slot with the
+// highest sequence number.  The header is written after the data,
+// so a save that gets cut off by a power down just leaves a bad CRC,
+// and the previous slot wins.
+//
+// save() writes the given configuration, if it differs from the last
+// saved one.  Writing the flash can hold off interrupts for a while, so
+// a save will usually cause an audio glitch.  That is why nothing here
+// saves by itself: TE3_hub.ino only calls save() for the explicit
+// TEHUB_CC_SAVE_CONFIG command, which TE3 sends when the user asks for
+// it, and never from the middle of a performance.
+
+#pragma once
+
+#include <Arduino.h>
+
+
+#define CONFIG_STORE_BASE		0
+	// EEPROM address of the first slot
+#define CONFIG_SLOT_SIZE		256
+#define CONFIG_NUM_SLOTS		4
+	// 1024 of the teensy 4.0's 1080 bytes of EEPROM
+
+#define CONFIG_HEADER_SIZE		10
+#define CONFIG_MAX_DATA			(CONFIG_SLOT_SIZE - CONFIG_HEADER_SIZE)
+
+
+class configStore
+{
+public:
+
+	configStore();
+
+	int load(uint8_t *data, int max_len);
+		// copies the newest valid record into data and
+		// returns its length, or -1 if there is none
+	bool save(const uint8_t *data, int len);
+		// returns true if it was written, false if
+		// it was already saved, or is too big
+
+	// diagnostics
+
+	uint32_t saves()		{ return m_saves; }
+	uint32_t sequence()		{ return m_seq; }
+
+private:
+
+	bool readSlot(int slot, uint32_t *seq, uint8_t *data, int *len);
+	void writeSlot(int slot, uint32_t seq, const uint8_t *data, int len);
+
+	int m_slot;
+		// of the newest record, -1 if none
+	uint32_t m_seq;
+
+	uint8_t m_saved[CONFIG_MAX_DATA];
+	int m_saved_len;
+
+	uint32_t m_saves;
+
+};
+
+
+extern configStore config_store;
+
+
+// end of configStore.h
@@ -0,0 +1,204 @@
+//-------------------------------------------------------
+// controlBench.cpp
+//-------------------------------------------------------
+// See controlBench.h.  Working out what to send is done outside of the
+// timed sections, so only the handler, SGTL5000::loop() and calcBiquad()
+// themselves are measured.
+
+#include "controlBench.h"
+#include <sgtl5000midi.h>
+#include <myDebug.h>
+
+
+//-----------------------------------
+// benchTimer
+//-----------------------------------
+
+void benchTimer::clear()
+{
+	m_start = 0;
+	m_count = 0;
+	m_max = 0;
+	m_total = 0;
+}
+
+
+void benchTimer::add(uint32_t cycles)
+{
+	m_count++;
+	m_total += cycles;
+	if (cycles > m_max)
+		m_max = cycles;
+}
+
+
+double benchTimer::seconds()
+{
+	return (double) m_total / F_CPU_ACTUAL;
+}
+
+
+void benchTimer::show(const char *what)
+{
+	double us = 1000000.0 / F_CPU_ACTUAL;
+	display(0,"    %-10s calls(%d) mean(%0.2f us) max(%0.2f us) total(%0.3f ms)",
+		what,
+		m_count,
+		m_count ? us * m_total / m_count : 0.0,
+		us * m_max,
+		seconds() * 1000);
+}
+
+
+//-----------------------------------
+// controlBench
+//-----------------------------------
+
+controlBench::controlBench(const benchMove_t *trace, int num_moves, benchHandlerFxn handler) :
+	m_trace(trace),
+	m_num_moves(num_moves),
+	m_handler(handler),
+	m_end_ms(0),
+	m_start_ms(0),
+	m_pass(0),
+	m_num_ccs(0),
+	m_batch(0)
+{
+	if (m_num_moves > CONTROL_BENCH_MAX_MOVES)
+		m_num_moves = CONTROL_BENCH_MAX_MOVES;
+	for (int i=0; i<m_num_moves; i++)
+	{
+		uint32_t end = trace[i].ms + trace[i].dur_ms;
+		if (end > m_end_ms)
+			m_end_ms = end;
+	}
+}
+
+
+void controlBench::benchBiquad(SGTL5000 *sgtl)
+	// the same ranges as the PEQ CCs
+{
+	int coef[5];
+	for (int i=0; i<CONTROL_BENCH_BIQUADS; i++)
+	{
+		uint8_t type = i % (FILTER_HISHELF + 1);
+		float freq = 20.0 * pow(1000.0,(i % 127) / 127.0);
+		float gain = ((i * 7) % 128 - 64) / 4.0;
+		float q = ((i * 3) % 128 + 1) / 10.0;
+
+		m_biquad_timer.start();
+		sgtl->calcBiquad(type,freq,gain,q,524288,AUDIO_SAMPLE_RATE_EXACT,coef);
+		m_biquad_timer.stop();
+	}
+}
+
+
+void controlBench::startPass(SGTL5000 *sgtl)
+{
+	m_cc_timer.clear();
+	m_loop_timer.clear();
+	m_biquad_timer.clear();
+	benchBiquad(sgtl);
+
+	uint32_t count, fails, max_us;
+	sgtl->getI2CStats(&count,&fails,&max_us);
+		// clear them
+
+	for (int i=0; i<m_num_moves; i++)
+		m_sent[i] = -1;
+	m_num_ccs = 0;
+	m_pass++;
+	m_start_ms = millis();
+}
+
+
+void controlBench::report(SGTL5000 *sgtl)
+{
+	uint32_t count, fails, max_us;
+	sgtl->getI2CStats(&count,&fails,&max_us);
+
+	double secs = m_cc_timer.seconds();
+	display(0,"control bench pass(%d) ccs(%d) %0.0f CCs/sec of cpu  i2c(%d) %0.2f per CC fails(%d) longest(%d us)",
+		m_pass,
+		m_num_ccs,
+		secs > 0 ? m_num_ccs / secs : 0.0,
+		count,
+		m_num_ccs ? (double) count / m_num_ccs : 0.0,
+		fails,
+		max_us);
+	m_cc_timer.show("ccs");
+	m_loop_timer.show("sgtl loop");
+	m_biquad_timer.show("biquad");
+}
+
+
+void controlBench::flush()
+{
+	if (!m_batch)
+		return;
+	m_cc_timer.start();
+	m_handler(m_targets,m_ccs,m_vals,m_batch);
+	m_cc_timer.stop();
+	m_batch = 0;
+}
+
+
+void controlBench::send(uint8_t target, uint8_t cc, uint8_t val)
+{
+	m_targets[m_batch] = target;
+	m_ccs[m_batch] = cc;
+	m_vals[m_batch++] = val;
+	m_num_ccs++;
+	if (m_batch == CONTROL_BENCH_BATCH)
+		flush();
+}
+
+
+void controlBench::task(SGTL5000 *sgtl)
+{
+	if (!m_pass)
+	{
+		display(0,"control bench moves(%d) %d ms per pass",m_num_moves,m_end_ms + CONTROL_BENCH_SETTLE_MS);
+		startPass(sgtl);
+	}
+
+	uint32_t now = millis() - m_start_ms;
+
+	// what TE3 would have sent by now, one CC
+	// per move at most, as it only sends the latest
+
+	for (int i=0; i<m_num_moves; i++)
+	{
+		const benchMove_t *move = &m_trace[i];
+		if (now < move->ms || m_sent[i] == move->to)
+			continue;
+
+		int val = move->to;
+		if (move->dur_ms)
+		{
+			uint32_t at = now - move->ms;
+			at -= at % CONTROL_BENCH_CC_MS;
+			if (at < move->dur_ms)
+				val = move->from + ((int) move->to - move->from) * (int) at / move->dur_ms;
+		}
+		if (val != m_sent[i])
+		{
+			m_sent[i] = val;
+			send(move->target,move->cc,val);
+		}
+	}
+	flush();
+
+	m_loop_timer.start();
+	sgtl->loop();
+	m_loop_timer.stop();
+
+	if (now >= m_end_ms + CONTROL_BENCH_SETTLE_MS)
+	{
+		report(sgtl);
+		startPass(sgtl);
+	}
+}
+
+
+// end of controlBench.cpp
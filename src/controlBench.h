@@ -0,0 +1,143 @@
+//-------------------------------------------------------
+// controlBench.h
+//-------------------------------------------------------
+// Benchmark for the control path, from TE3's CCs to the SGTL5000.
+//
+// A controlBench replays a trace of pedal moves, in place of the CCs
+// that TE3 would send, through the same handling that handleSerialMidi()
+// does, and times, in ARM_DWT_CYCCNT cycles:
+//
+//		each batch of CCs handled in one pass of loop(), which is the
+//			coalescing and dispatchCC(), including calcBiquad() for PEQ CCs.
+//			i2cQueue::write() never waits for the bus, so this is all cpu.
+//		each SGTL5000::loop(), the EQ, PEQ and volume ramp automation
+//		calcBiquad() by itself, over a sweep of types, frequencies and gains
+//
+// It also counts the CCs it sent and, from SGTL5000::getI2CStats(), the
+// I2C transactions that they caused, and the writes that failed, which
+// includes any dropped because the queue was full.  After each pass
+// through the trace, plus CONTROL_BENCH_SETTLE_MS for the ramps to
+// finish, it displays the CCs per second of CPU, the I2C transactions
+// per CC, and the mean and max of each timing, and then starts over.  On the teensy these are the real chip and the real
+// I2C bus, so a regression in the control path shows up as a number on
+// the bench, and not as zipper noise on stage.  bench/ builds the same
+// code on the host, against a mock bus, with plain g++.
+//
+// A trace is a table of moves.  A move is a pedal going from one value to
+// another over dur_ms, sent every CONTROL_BENCH_CC_MS like TE3 does, and
+// only when the value changes.  A move with a dur_ms of zero is a single
+// CC, so a captured TE3 session (see dbg_sm in handleSerialMidi()) goes in
+// as one line per CC.  Moves may overlap, like two pedals at once.
+//
+// The telemetry record also clears the I2C stats, so leave it off
+// (TEHUB_CC_TELEMETRY 0, the default) while benchmarking.
+
+#pragma once
+
+#include <Arduino.h>
+#include "sgtl5000.h"
+
+
+#define CONTROL_BENCH_CC_MS			10
+	// how often TE3 sends a moving pedal
+#define CONTROL_BENCH_SETTLE_MS		1000
+	// after the last move, for the ramps and the I2C queue, before reporting
+#define CONTROL_BENCH_BATCH			32
+	// most CCs handed to the handler in one call
+#define CONTROL_BENCH_MAX_MOVES		64
+#define CONTROL_BENCH_BIQUADS		256
+	// calcBiquad() calls timed at the start of each pass
+
+
+typedef struct
+{
+	uint32_t ms;
+		// from the start of the trace
+	uint8_t target;
+		// passed to the handler, CC_TARGET_XXX in TE3_hub.ino
+	uint8_t cc;
+	uint8_t from;
+	uint8_t to;
+	uint16_t dur_ms;
+		// 0 = a single CC with the 'to' value
+} benchMove_t;
+
+
+typedef void (*benchHandlerFxn)(const uint8_t *targets, const uint8_t *ccs, const uint8_t *vals, int count);
+	// handle count CCs, as if they all came in one pass of handleSerialMidi()
+
+
+class benchTimer
+{
+public:
+
+	benchTimer()	{ clear(); }
+
+	void clear();
+	void start()	{ m_start = ARM_DWT_CYCCNT; }
+	void stop()		{ add(ARM_DWT_CYCCNT - m_start); }
+	void add(uint32_t cycles);
+
+	uint32_t count()	{ return m_count; }
+	double seconds();
+		// the total of all of them
+	void show(const char *what);
+		// display() the count, mean and max in us
+
+private:
+
+	uint32_t m_start;
+	uint32_t m_count;
+	uint32_t m_max;
+	uint64_t m_total;
+
+};
+
+
+class controlBench
+{
+public:
+
+	controlBench(const benchMove_t *trace, int num_moves, benchHandlerFxn handler);
+
+	void task(SGTL5000 *sgtl);
+		// from loop(), instead of handleSerialMidi() and sgtl->loop()
+	uint32_t passes()	{ return m_pass; }
+		// started so far
+
+private:
+
+	void startPass(SGTL5000 *sgtl);
+	void report(SGTL5000 *sgtl);
+	void benchBiquad(SGTL5000 *sgtl);
+	void send(uint8_t target, uint8_t cc, uint8_t val);
+	void flush();
+
+	const benchMove_t *m_trace;
+	int m_num_moves;
+	benchHandlerFxn m_handler;
+
+	uint32_t m_end_ms;
+		// of the last move in the trace
+	uint32_t m_start_ms;
+		// of this pass
+	uint32_t m_pass;
+		// 0 before the first one
+
+	int16_t m_sent[CONTROL_BENCH_MAX_MOVES];
+		// last value sent for each move in this pass, -1 = none yet
+	uint32_t m_num_ccs;
+
+	uint8_t m_targets[CONTROL_BENCH_BATCH];
+	uint8_t m_ccs[CONTROL_BENCH_BATCH];
+	uint8_t m_vals[CONTROL_BENCH_BATCH];
+	int m_batch;
+
+	benchTimer m_cc_timer;
+	benchTimer m_loop_timer;
+	benchTimer m_biquad_timer;
+
+};
+
+
+// end of controlBench.h
@@ -0,0 +1,179 @@
+//-------------------------------------------------------
+// deferLog.cpp
+//-------------------------------------------------------
+// See deferLog.h.  Indexes are free running and only masked
+// into the ring.  Producers reserve m_head with a compare-and-swap,
+// so an interrupt can reserve a slot in the middle of a loop() record
+// and both still get their own slot.  The ready flag, set after the
+// contents, is what tells task() that a reserved slot is complete, so
+// out of order completion just makes task() wait for the older one.
+
+#include "deferLog.h"
+#include <myDebug.h>
+
+#define DEFER_LOG_MASK		(DEFER_LOG_SIZE - 1)
+#define DEFER_LOG_BUFSIZE	200
+	// longest formatted record
+
+
+deferLog defer_log;
+
+
+deferLog::deferLog() :
+	m_head(0),
+	m_tail(0),
+	m_dropped(0)
+{
+	for (int i=0; i<DEFER_LOG_SIZE; i++)
+		m_ring[i].ready = 0;
+}
+
+
+deferRecord_t *deferLog::reserve()
+{
+	uint32_t head = __atomic_load_n(&m_head,__ATOMIC_RELAXED);
+	while (1)
+	{
+		if (head - m_tail >= DEFER_LOG_SIZE)
+		{
+			__atomic_fetch_add(&m_dropped,1,__ATOMIC_RELAXED);
+			return NULL;
+		}
+		if (__atomic_compare_exchange_n(&m_head,&head,head + 1,
+				true,__ATOMIC_ACQUIRE,__ATOMIC_RELAXED))
+			return &m_ring[head & DEFER_LOG_MASK];
+		// head was reloaded by the failed exchange
+	}
+}
+
+
+void deferLog::commit(deferRecord_t *rec)
+{
+	asm volatile ("dmb");
+		// the contents before the flag
+	rec->ready = 1;
+}
+
+
+void deferLog::task()
+{
+	for (int count=0; count<DEFER_LOG_PER_TASK; count++)
+	{
+		if (m_tail == m_head)
+			return;
+		deferRecord_t *rec = &m_ring[m_tail & DEFER_LOG_MASK];
+		if (!rec->ready)
+			return;
+		asm volatile ("dmb");
+		output(rec);
+		rec->ready = 0;
+		asm volatile ("dmb");
+		m_tail = m_tail + 1;
+	}
+}
+
+
+void deferLog::output(deferRecord_t *rec)
+	// Walk the format, copying literal text, and hand each
+	// conversion, with its own argument, to snprintf()
+{
+	char buf[DEFER_LOG_BUFSIZE];
+	char spec[16];
+	int len = 0;
+	int arg = 0;
+	int word = 0;
+
+	#if DEFER_LOG_SHOW_LAG
+		len = snprintf(buf,DEFER_LOG_BUFSIZE,"(%lu) ",micros() - rec->time);
+	#endif
+
+	const char *p = rec->fmt;
+	while (*p && len < DEFER_LOG_BUFSIZE - 1)
+	{
+		if (*p != '%')
+		{
+			buf[len++] = *p++;
+			continue;
+		}
+		if (p[1] == '%')
+		{
+			buf[len++] = '%';
+			p += 2;
+			continue;
+		}
+
+		// copy the spec up to and including the conversion,
+		// dropping length modifiers, which we don't need
+
+		int n = 0;
+		spec[n++] = *p++;
+		while (*p && !strchr("diouxXcsfFeEgGp",*p))
+		{
+			if (!strchr("hlLqjzt",*p) && n < 14)
+				spec[n++] = *p;
+			p++;
+		}
+		if (!*p)
+			break;
+		char conv = *p++;
+		spec[n++] = conv;
+		spec[n] = 0;
+
+		int room = DEFER_LOG_BUFSIZE - len;
+		int got = 0;
+		if (arg >= rec->num_args)
+		{
+			got = snprintf(&buf[len],room,"<?>");
+		}
+		else if (rec->arg_type[arg] == DEFER_ARG_DOUBLE)
+		{
+			if (word & 1)
+				word++;
+			double val;
+			memcpy(&val,&rec->words[word],8);
+			word += 2;
+			if (strchr("fFeEgG",conv))
+				got = snprintf(&buf[len],room,spec,val);
+			else
+				got = snprintf(&buf[len],room,spec,(int) val);
+		}
+		else if (rec->arg_type[arg] == DEFER_ARG_STR)
+		{
+			const char *val;
+			memcpy(&val,&rec->words[word],sizeof(val));
+			word += DEFER_PTR_WORDS;
+			if (conv == 's')
+				got = snprintf(&buf[len],room,spec,val ? val : "(null)");
+			else
+				got = snprintf(&buf[len],room,"<?>");
+		}
+		else if (conv == 's')
+		{
+			word++;
+			got = snprintf(&buf[len],room,"<?>");
+		}
+		else if (strchr("fFeEgG",conv))
+		{
+			got = snprintf(&buf[len],room,spec,(double) (int32_t) rec->words[word++]);
+		}
+		else
+		{
+			got = snprintf(&buf[len],room,spec,rec->words[word++]);
+		}
+		arg++;
+
+		if (got > 0)
+			len += got < room ? got : room - 1;
+	}
+	buf[len] = 0;
+
+	if (rec->type == DEFER_ERROR)
+		my_error("%s",buf);
+	else if (rec->type == DEFER_WARNING)
+		warning(rec->level,"%s",buf);
+	else
+		display(rec->level,"%s",buf);
+}
+
+
+// end of deferLog.cpp
@@ -0,0 +1,179 @@
+//-------------------------------------------------------
+// deferLog.h
+//-------------------------------------------------------
+// Deferred debug output for hot paths and interrupts.
+//
+// defer_display(), defer_warning() and defer_error() take the same
+// parameters as myDebug's display(), warning() and my_error(), but
+// only store the format pointer, a micros() timestamp, and the raw
+// arguments in a lock-free ring.  deferLog::task(), called from loop(),
+// formats a few records per call and hands them to the real myDebug
+// functions, which do the level filtering and the actual output.
+//
+// Capturing a record is a compare-and-swap to reserve a slot and a
+// copy of at most DEFER_LOG_MAX_WORDS words, so it is safe from any
+// interrupt, and a full ring just drops (and counts) the record.
+//
+// Restrictions, since the formatting happens later:
+//
+//		the format, and any %s arguments, must be string literals or
+//		otherwise still be around when the record is drained.
+//		at most DEFER_LOG_MAX_ARGS arguments, up to 32 bits each,
+//		plus floats and doubles (which take two words).
+//		no %lld, and no * widths.
+
+#pragma once
+
+#include <Arduino.h>
+
+
+#define DEFER_LOG_SIZE			128
+	// records, must be a power of two
+#define DEFER_LOG_MAX_ARGS		6
+#define DEFER_LOG_MAX_WORDS		8
+#define DEFER_LOG_PER_TASK		4
+	// most records formatted by one task() call
+#define DEFER_LOG_LEVEL			0
+	// display() and warning() records with a higher level are
+	// thrown away when they are made, like myDebug would, so that
+	// disabled dbg_xxx displays do not take up room in the ring
+#define DEFER_LOG_SHOW_LAG		0
+	// if 1, prefix the output with how long the record
+	// waited in the ring, in microseconds
+
+#define DEFER_DISPLAY			0
+#define DEFER_WARNING			1
+#define DEFER_ERROR				2
+
+#define DEFER_ARG_INT			0
+#define DEFER_ARG_DOUBLE		1
+#define DEFER_ARG_STR			2
+
+#define DEFER_PTR_WORDS			((int) (sizeof(const char *) / sizeof(uint32_t)))
+	// one on the teensy, two in the host bench build (bench/)
+
+
+typedef struct
+{
+	const char *fmt;
+	uint32_t time;
+	int16_t level;
+	uint8_t type;
+	uint8_t num_args;
+	uint8_t arg_type[DEFER_LOG_MAX_ARGS];
+	uint8_t num_words;
+	volatile uint8_t ready;
+	uint32_t words[DEFER_LOG_MAX_WORDS];
+} deferRecord_t;
+
+
+class deferLog
+{
+public:
+
+	deferLog();
+
+	deferRecord_t *reserve();
+		// returns NULL if the ring is full
+	void commit(deferRecord_t *rec);
+	void task();
+		// from loop()
+
+	uint32_t dropped()		{ return m_dropped; }
+
+private:
+
+	void output(deferRecord_t *rec);
+
+	deferRecord_t m_ring[DEFER_LOG_SIZE];
+	volatile uint32_t m_head;
+		// reserved by producers with a compare-and-swap
+	volatile uint32_t m_tail;
+		// only task() advances this
+	volatile uint32_t m_dropped;
+
+};
+
+
+extern deferLog defer_log;
+
+
+//------------------------------------
+// argument packing
+//------------------------------------
+
+inline void deferPackWord(deferRecord_t *rec, uint8_t type, uint32_t word)
+{
+	if (rec->num_args >= DEFER_LOG_MAX_ARGS ||
+		rec->num_words >= DEFER_LOG_MAX_WORDS)
+		return;
+	rec->arg_type[rec->num_args++] = type;
+	rec->words[rec->num_words++] = word;
+}
+
+inline void deferPackArg(deferRecord_t *rec, int val)				{ deferPackWord(rec,DEFER_ARG_INT,(uint32_t)val); }
+inline void deferPackArg(deferRecord_t *rec, unsigned val)			{ deferPackWord(rec,DEFER_ARG_INT,val); }
+inline void deferPackArg(deferRecord_t *rec, long val)				{ deferPackWord(rec,DEFER_ARG_INT,(uint32_t)val); }
+inline void deferPackArg(deferRecord_t *rec, unsigned long val)		{ deferPackWord(rec,DEFER_ARG_INT,(uint32_t)val); }
+inline void deferPackArg(deferRecord_t *rec, const char *val)
+	// DEFER_PTR_WORDS words
+{
+	if (rec->num_args >= DEFER_LOG_MAX_ARGS ||
+		rec->num_words + DEFER_PTR_WORDS > DEFER_LOG_MAX_WORDS)
+		return;
+	rec->arg_type[rec->num_args++] = DEFER_ARG_STR;
+	memcpy(&rec->words[rec->num_words],&val,sizeof(val));
+	rec->num_words += DEFER_PTR_WORDS;
+}
+inline void deferPackArg(deferRecord_t *rec, const void *val)		{ deferPackWord(rec,DEFER_ARG_INT,(uint32_t)(uintptr_t)val); }
+
+inline void deferPackArg(deferRecord_t *rec, double val)
+	// two words, the first one at an even index, so task()
+	// can just memcpy it back out
+{
+	if (rec->num_words & 1)
+		rec->num_words++;
+	if (rec->num_args >= DEFER_LOG_MAX_ARGS ||
+		rec->num_words + 2 > DEFER_LOG_MAX_WORDS)
+		return;
+	rec->arg_type[rec->num_args++] = DEFER_ARG_DOUBLE;
+	memcpy(&rec->words[rec->num_words],&val,8);
+	rec->num_words += 2;
+}
+
+inline void deferPackArg(deferRecord_t *rec, float val)			{ deferPackArg(rec,(double)val); }
+inline void deferPackArg(deferRecord_t *rec, signed char val)		{ deferPackArg(rec,(int)val); }
+inline void deferPackArg(deferRecord_t *rec, unsigned char val)		{ deferPackArg(rec,(int)val); }
+inline void deferPackArg(deferRecord_t *rec, short val)		{ deferPackArg(rec,(int)val); }
+inline void deferPackArg(deferRecord_t *rec, unsigned short val)		{ deferPackArg(rec,(int)val); }
+inline void deferPackArg(deferRecord_t *rec, char val)			{ deferPackArg(rec,(int)val); }
+inline void deferPackArg(deferRecord_t *rec, bool val)			{ deferPackArg(rec,(int)val); }
+
+
+template<typename... Args>
+inline void deferLogRecord(uint8_t type, int level, const char *fmt, Args... args)
+{
+	static_assert(sizeof...(Args) <= DEFER_LOG_MAX_ARGS, "too many deferLog arguments");
+	if (type != DEFER_ERROR && level > DEFER_LOG_LEVEL)
+		return;
+	deferRecord_t *rec = defer_log.reserve();
+	if (!rec)
+		return;
+	rec->fmt = fmt;
+	rec->time = micros();
+	rec->level = level;
+	rec->type = type;
+	rec->num_args = 0;
+	rec->num_words = 0;
+	int unused[] = { 0, (deferPackArg(rec,args), 0)... };
+	(void) unused;
+	defer_log.commit(rec);
+}
+
+
+#define defer_display(level, fmt, ...)	deferLogRecord(DEFER_DISPLAY, level, fmt, ##__VA_ARGS__)
+#define defer_warning(level, fmt, ...)	deferLogRecord(DEFER_WARNING, level, fmt, ##__VA_ARGS__)
+#define defer_error(fmt, ...)			deferLogRecord(DEFER_ERROR, 0, fmt, ##__VA_ARGS__)
+
+
+// end of deferLog.h
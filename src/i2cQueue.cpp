@@ -0,0 +1,310 @@
+//-------------------------------------------------------
+// i2cQueue.cpp
+//-------------------------------------------------------
+// See i2cQueue.h.  The LPI2C master takes 11 bit commands in MTDR:
+// a START with the address, data bytes, and a STOP, through a 4 word
+// transmit fifo.  MSR gives us TDF (fifo wants more), SDF (STOP sent),
+// MBF (master busy), and the error flags NDF (nack), ALF (arbitration
+// lost), FEF (fifo error) and PLTF (pin low timeout).
+
+#include "i2cQueue.h"
+#include <myDebug.h>
+
+#define I2C_QUEUE_MASK		(I2C_QUEUE_SIZE - 1)
+#define LPI2C_FIFO_SIZE		4
+
+#ifndef LPI2C_MSR_MBF
+	#define LPI2C_MSR_MBF				((uint32_t)(1 << 24))
+#endif
+#ifndef LPI2C_MTDR_CMD_TRANSMIT
+	#define LPI2C_MTDR_CMD_TRANSMIT		((uint32_t)(0 << 8))
+	#define LPI2C_MTDR_CMD_STOP			((uint32_t)(2 << 8))
+	#define LPI2C_MTDR_CMD_START		((uint32_t)(4 << 8))
+#endif
+
+#define MSR_ERRORS	(LPI2C_MSR_NDF | LPI2C_MSR_ALF | LPI2C_MSR_FEF | LPI2C_MSR_PLTF)
+#define MSR_CLEAR	(MSR_ERRORS | LPI2C_MSR_SDF | LPI2C_MSR_EPF)
+#define MIER_DONE	(LPI2C_MIER_SDIE | LPI2C_MIER_NDIE | LPI2C_MIER_ALIE | LPI2C_MIER_FEIE | LPI2C_MIER_PLTIE)
+
+static IMXRT_LPI2C_t * const port = &IMXRT_LPI2C1;
+static i2cQueue *s_queue = 0;
+	// there is only one LPI2C1, so only one queue
+
+
+i2cQueue::i2cQueue() :
+	m_addr(0),
+	m_done_fxn(0),
+	m_done_obj(0),
+	m_head(0),
+	m_tail(0),
+	m_busy(false),
+	m_recovering(false),
+	m_epoch(0),
+	m_num_cmds(0),
+	m_next_cmd(0),
+	m_start_cycles(0),
+	m_coalesced(0),
+	m_full_drops(0)
+{}
+
+
+void i2cQueue::begin(uint8_t i2c_addr)
+{
+	flush();
+	m_addr = i2c_addr;
+	s_queue = this;
+	port->MIER = 0;
+	attachInterruptVector(IRQ_LPI2C1, isr);
+	NVIC_SET_PRIORITY(IRQ_LPI2C1, 192);
+		// way less important than USB and the I2S dma (both 128),
+		// but above the audio update (208), which can run for a
+		// good fraction of a block.
+	NVIC_ENABLE_IRQ(IRQ_LPI2C1);
+}
+
+
+void i2cQueue::setDoneCallback(i2cQueueDoneFxn fxn, void *obj)
+{
+	__disable_irq();
+	m_done_fxn = fxn;
+	m_done_obj = obj;
+	__enable_irq();
+}
+
+
+void i2cQueue::fence()
+{
+	__disable_irq();
+	m_epoch++;
+	__enable_irq();
+}
+
+
+bool i2cQueue::write(uint16_t reg, uint16_t val)
+{
+	__disable_irq();
+	checkRecovery();
+
+	// coalesce into a queued (not started) single write
+	// to the same register in the same fence
+
+	uint16_t idx = m_busy ? ((m_head + 1) & I2C_QUEUE_MASK) : m_head;
+	while (idx != m_tail)
+	{
+		entry_t *e = &m_ring[idx];
+		if (e->reg == reg && e->count == 1 && e->epoch == m_epoch)
+		{
+			e->val[0] = val;
+			m_coalesced++;
+			__enable_irq();
+			return true;
+		}
+		idx = (idx + 1) & I2C_QUEUE_MASK;
+	}
+
+	return enqueue(reg,&val,1);
+}
+
+
+bool i2cQueue::writeBurst(uint16_t reg, const uint16_t *vals, uint8_t count)
+{
+	if (!count || count > I2C_QUEUE_MAX_BURST)
+	{
+		my_error("i2cQueue::writeBurst(0x%04x) bad count(%d)",reg,count);
+		return false;
+	}
+	__disable_irq();
+	checkRecovery();
+	return enqueue(reg,vals,count);
+}
+
+
+bool i2cQueue::enqueue(uint16_t reg, const uint16_t *vals, uint8_t count)
+	// called with interrupts disabled, and enables them
+{
+	// a full ring drops the write, so loop() never waits on the bus.
+	// The done callback would have got it anyway, from the interrupt,
+	// so it is called with interrupts still disabled.
+
+	uint16_t next = (m_tail + 1) & I2C_QUEUE_MASK;
+	if (next == m_head)
+	{
+		m_full_drops++;
+		if (m_done_fxn)
+			m_done_fxn(m_done_obj, reg, vals[0], false, 0);
+		__enable_irq();
+		return false;
+	}
+
+	entry_t *e = &m_ring[m_tail];
+	e->reg = reg;
+	e->epoch = m_epoch;
+	e->count = count;
+	for (uint8_t i=0; i<count; i++)
+		e->val[i] = vals[i];
+	m_tail = next;
+
+	if (!m_busy)
+		startNext();
+
+	__enable_irq();
+	return true;
+}
+
+
+bool i2cQueue::flush(uint32_t timeout_ms /* = 100 */)
+{
+	uint32_t start = millis();
+	while (!idle())
+	{
+		__disable_irq();
+		checkRecovery();
+		__enable_irq();
+		if (millis() - start > timeout_ms)
+		{
+			my_error("i2cQueue::flush() timeout head(%d) tail(%d)",m_head,m_tail);
+			return false;
+		}
+	}
+	return true;
+}
+
+
+//------------------------------------
+// interrupt side
+//------------------------------------
+// startNext() and finish() are only called with
+// interrupts disabled, or from the interrupt.
+
+void i2cQueue::fillFifo()
+{
+	while (m_next_cmd < m_num_cmds &&
+		   (port->MFSR & 0x07) < LPI2C_FIFO_SIZE)
+	{
+		port->MTDR = m_cmd[m_next_cmd++];
+	}
+}
+
+
+void i2cQueue::startNext()
+{
+	if (m_head == m_tail)
+	{
+		m_busy = false;
+		port->MIER = 0;
+			// hand the port back to Wire
+		return;
+	}
+
+	entry_t *e = &m_ring[m_head];
+	uint8_t n = 0;
+	m_cmd[n++] = LPI2C_MTDR_CMD_START | (m_addr << 1);
+	m_cmd[n++] = LPI2C_MTDR_CMD_TRANSMIT | (e->reg >> 8);
+	m_cmd[n++] = LPI2C_MTDR_CMD_TRANSMIT | (e->reg & 0xff);
+	for (uint8_t i=0; i<e->count; i++)
+	{
+		m_cmd[n++] = LPI2C_MTDR_CMD_TRANSMIT | (e->val[i] >> 8);
+		m_cmd[n++] = LPI2C_MTDR_CMD_TRANSMIT | (e->val[i] & 0xff);
+	}
+	m_cmd[n++] = LPI2C_MTDR_CMD_STOP;
+	m_num_cmds = n;
+	m_next_cmd = 0;
+	m_busy = true;
+
+	port->MSR = MSR_CLEAR;
+	m_start_cycles = ARM_DWT_CYCCNT;
+	fillFifo();
+	port->MIER = MIER_DONE | (m_next_cmd < m_num_cmds ? LPI2C_MIER_TDIE : 0);
+}
+
+
+void i2cQueue::checkRecovery()
+	// in case the STOP of a failed transaction never
+	// gave us an SDF.  Called with interrupts disabled.
+{
+	if (m_recovering && !(port->MSR & LPI2C_MSR_MBF))
+	{
+		port->MSR = MSR_CLEAR;
+		m_recovering = false;
+		finish(false);
+	}
+}
+
+
+void i2cQueue::finish(bool ok)
+{
+	entry_t *e = &m_ring[m_head];
+	if (m_done_fxn)
+		m_done_fxn(m_done_obj, e->reg, e->val[0], ok, ARM_DWT_CYCCNT - m_start_cycles);
+	m_head = (m_head + 1) & I2C_QUEUE_MASK;
+	startNext();
+}
+
+
+void i2cQueue::isr()
+{
+	if (s_queue)
+		s_queue->handleInterrupt();
+}
+
+
+void i2cQueue::handleInterrupt()
+{
+	uint32_t msr = port->MSR;
+
+	if (!m_busy)
+	{
+		port->MIER = 0;
+		return;
+	}
+
+	if (m_recovering)
+	{
+		// the STOP of the failed transaction is out, or
+		// the bus is stuck low, and we give up on it
+
+		if ((msr & (LPI2C_MSR_SDF | LPI2C_MSR_PLTF)) || !(msr & LPI2C_MSR_MBF))
+		{
+			port->MSR = MSR_CLEAR;
+			m_recovering = false;
+			finish(false);
+		}
+	}
+	else if (msr & MSR_ERRORS)
+	{
+		// the master sends a STOP by itself on a nack.
+		// throw away what is left of this transaction, and
+		// only start the next one once that STOP is out, or
+		// its SDF would look like the next one finishing
+
+		port->MCR |= LPI2C_MCR_RTF | LPI2C_MCR_RRF;
+		port->MSR = MSR_CLEAR;
+		if (msr & (LPI2C_MSR_ALF | LPI2C_MSR_PLTF))
+			port->MTDR = LPI2C_MTDR_CMD_STOP;
+		if (port->MSR & LPI2C_MSR_MBF)
+		{
+			m_recovering = true;
+			port->MIER = LPI2C_MIER_SDIE | LPI2C_MIER_PLTIE;
+		}
+		else
+		{
+			finish(false);
+		}
+	}
+	else if (msr & LPI2C_MSR_SDF)
+	{
+		port->MSR = LPI2C_MSR_SDF;
+		finish(true);
+	}
+	else if (msr & LPI2C_MSR_TDF)
+	{
+		fillFifo();
+		if (m_next_cmd >= m_num_cmds)
+			port->MIER = MIER_DONE;
+	}
+	asm volatile ("dsb");
+		// make sure the flags are cleared before we return
+}
+
+
+// end of i2cQueue.cpp
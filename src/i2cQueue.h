@@ -0,0 +1,128 @@
+//-------------------------------------------------------
+// i2cQueue.h
+//-------------------------------------------------------
+// An interrupt driven queue of 16 bit register writes to a
+// single I2C device (the SGTL5000) on the teensy 4.x LPI2C1
+// port (Wire, pins 18/19).
+//
+// Wire.endTransmission() busy waits for the whole transaction,
+// which is about 60us per register at 400kHz and a lot more at
+// the default 100kHz.  setDefaults() does 30+ of them, and every
+// CC from the pedals does at least one, all from loop().
+//
+// write() only puts the register and value in a ring buffer and
+// returns.  The LPI2C interrupt feeds the transmit fifo, and starts
+// the next entry when it sees the STOP, so loop() never waits for
+// the bus.  Not even when the ring is full: then the write is dropped,
+// and fails through the done callback, like a nack would.
+//
+// After an error (nack, arbitration lost, pin low timeout) the next
+// entry is only started once the bus has gone idle, so the STOP of
+// the failed transaction is not taken for the end of the next one.
+//
+// A write to a register that is still waiting in the queue just
+// replaces the queued value, so a fast pedal sweep turns into at
+// most one pending write per register.  Coalescing is only done
+// within the current "fence".  Callers call fence() when the order
+// of the writes matters, i.e. mute, change stuff, unmute, or the
+// PEQ coefficient registers followed by the strobe.
+//
+// writeBurst() sends up to I2C_QUEUE_MAX_BURST consecutive registers
+// in one transaction, using the chip's register address auto-increment.
+// Bursts are never coalesced.
+//
+// Wire is still used, unchanged, for begin() and for reads.
+// The interrupt is disabled (MIER=0) whenever the queue is idle,
+// and clients must call flush() before doing anything with Wire.
+
+#pragma once
+
+#include <Arduino.h>
+
+
+#define I2C_QUEUE_SIZE			128
+	// must be a power of two
+#define I2C_QUEUE_MAX_BURST		8
+	// most 16 bit registers in one writeBurst()
+
+
+typedef void (*i2cQueueDoneFxn)(void *obj, uint16_t reg, uint16_t val, bool ok, uint32_t cycles);
+	// called from the interrupt when an entry completes (or fails)
+	// with the ARM_DWT_CYCCNT cycles from START to STOP.
+	// For bursts, reg and val are the first register and value.
+
+
+class i2cQueue
+{
+public:
+
+	i2cQueue();
+
+	void begin(uint8_t i2c_addr);
+		// call after Wire.begin()
+	void setDoneCallback(i2cQueueDoneFxn fxn, void *obj);
+
+	bool write(uint16_t reg, uint16_t val);
+		// coalesces or enqueues, and starts the bus if idle.
+		// Returns false, and calls the done callback with ok=false,
+		// if the ring is full.
+	bool writeBurst(uint16_t reg, const uint16_t *vals, uint8_t count);
+		// writes count (1..I2C_QUEUE_MAX_BURST) registers starting at reg.
+		// The register number goes up by two per word on the SGTL5000.
+	void fence();
+		// writes after the fence will not be merged into
+		// writes before it.
+	bool flush(uint32_t timeout_ms = 100);
+		// waits for the queue to drain, for enable(), and before
+		// any Wire.requestFrom().  Returns false on timeout.
+
+	bool idle()					{ return m_head == m_tail && !m_busy; }
+	uint32_t coalesced()		{ return m_coalesced; }
+	uint32_t fullDrops()		{ return m_full_drops; }
+		// writes dropped because the ring was full
+
+private:
+
+	typedef struct
+	{
+		uint16_t reg;
+		uint16_t epoch;
+		uint8_t count;
+		uint16_t val[I2C_QUEUE_MAX_BURST];
+	} entry_t;
+
+	bool enqueue(uint16_t reg, const uint16_t *vals, uint8_t count);
+
+	static void isr();
+	void handleInterrupt();
+	void startNext();
+	void finish(bool ok);
+	void fillFifo();
+	void checkRecovery();
+
+	uint8_t m_addr;
+	i2cQueueDoneFxn m_done_fxn;
+	void *m_done_obj;
+
+	entry_t m_ring[I2C_QUEUE_SIZE];
+	volatile uint16_t m_head;
+		// the entry in progress, or next to start
+	volatile uint16_t m_tail;
+	volatile bool m_busy;
+	volatile bool m_recovering;
+		// after an error, until the bus is idle again
+	uint16_t m_epoch;
+
+	uint32_t m_cmd[4 + 2 * I2C_QUEUE_MAX_BURST];
+		// MTDR words for the transaction in progress
+	uint8_t m_num_cmds;
+	volatile uint8_t m_next_cmd;
+	uint32_t m_start_cycles;
+
+	volatile uint32_t m_coalesced;
+	volatile uint32_t m_full_drops;
+
+};
+
+
+// end of i2cQueue.h
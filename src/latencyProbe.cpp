@@ -0,0 +1,291 @@
+//-------------------------------------------------------
+// latencyProbe.cpp
+//-------------------------------------------------------
+// See latencyProbe.h.  While waiting for the return, every input sample
+// gets a LATENCY_PROBE_LEN point correlation, which is about 8K
+// multiply-adds per block, nothing next to the rest of the graph.
+// Once the correlation goes over the threshold we keep going for one
+// more signal length to find the actual peak, then interpolate it with
+// a parabola through the peak and its two neighbours.  The peak is the
+// largest |corr|, so a return that comes back inverted (some interfaces
+// flip the polarity) is found at the same place.
+//
+// The test signal can be longer than a block, so update() sends it
+// over as many blocks as it takes, starting at m_sent.
+
+#include "latencyProbe.h"
+#include <myDebug.h>
+
+#define PERIOD_SAMPLES	((uint32_t) (AUDIO_SAMPLE_RATE_EXACT * LATENCY_PROBE_PERIOD_MS / 1000))
+#define TIMEOUT_SAMPLES	((uint32_t) (AUDIO_SAMPLE_RATE_EXACT * LATENCY_PROBE_TIMEOUT_MS / 1000))
+#define HISTORY			(LATENCY_PROBE_LEN - 1)
+
+#define CHIRP_START_HZ	1000.0
+#define CHIRP_END_HZ	8000.0
+
+
+AudioLatencyProbe::AudioLatencyProbe() :
+	AudioStream(1, m_input_queue),
+	m_samples(0),
+	m_sent(0),
+	m_waiting(false),
+	m_send_pos(LATENCY_PROBE_LEN),
+	m_found(false),
+	m_result(-1),
+	m_num_results(0),
+	m_timeouts(0)
+{
+	for (int i=0; i<LATENCY_PROBE_LEN; i++)
+	{
+		#if LATENCY_PROBE_CHIRP
+			// linear chirp with a hann window
+			double t = i / AUDIO_SAMPLE_RATE_EXACT;
+			double dur = LATENCY_PROBE_LEN / AUDIO_SAMPLE_RATE_EXACT;
+			double k = (CHIRP_END_HZ - CHIRP_START_HZ) / dur;
+			double phase = 2 * M_PI * (CHIRP_START_HZ * t + k * t * t / 2);
+			double window = 0.5 - 0.5 * cos(2 * M_PI * i / (LATENCY_PROBE_LEN - 1));
+			m_signal[i] = LATENCY_PROBE_LEVEL * window * sin(phase);
+		#else
+			m_signal[i] = i < LATENCY_PROBE_LEN/2 ? LATENCY_PROBE_LEVEL : -LATENCY_PROBE_LEVEL;
+		#endif
+		m_template[i] = m_signal[i] >> 8;
+	}
+
+	// what a full level return would correlate to
+
+	int32_t full = 0;
+	for (int i=0; i<LATENCY_PROBE_LEN; i++)
+		full += m_template[i] * m_signal[i];
+	m_threshold = full / LATENCY_PROBE_THRESHOLD;
+
+	memset(m_history,0,sizeof(m_history));
+}
+
+
+void AudioLatencyProbe::correlate(const int16_t *data)
+	// data is the history (HISTORY samples) followed by
+	// the current block.  Correlation n covers data[n..n+LEN-1],
+	// which started at sample clock m_samples + n - HISTORY.
+{
+	for (int n=0; n<AUDIO_BLOCK_SAMPLES && m_waiting; n++)
+	{
+		int32_t corr = 0;
+		const int16_t *x = &data[n];
+		for (int k=0; k<LATENCY_PROBE_LEN; k++)
+			corr += x[k] * m_template[k];
+		uint32_t at = m_samples + n - HISTORY;
+
+		// only returns that started after we sent count
+
+		if ((int32_t) (at - m_sent) < 0)
+		{
+			m_prev_corr = corr;
+			continue;
+		}
+
+		if (m_want_next)
+		{
+			m_peak_next = corr;
+			m_want_next = false;
+		}
+		if (abs(corr) > m_threshold && abs(corr) > abs(m_peak))
+		{
+			m_found = true;
+			m_peak = corr;
+			m_peak_prev = m_prev_corr;
+			m_peak_at = at;
+			m_want_next = true;
+		}
+		m_prev_corr = corr;
+
+		if (m_found && !m_want_next &&
+			at - m_peak_at >= LATENCY_PROBE_LEN)
+		{
+			finish();
+		}
+	}
+}
+
+
+void AudioLatencyProbe::finish()
+{
+	// parabolic interpolation, in 1/256ths of a sample
+
+	if (m_peak < 0)
+	{
+		m_peak = -m_peak;
+		m_peak_prev = -m_peak_prev;
+		m_peak_next = -m_peak_next;
+	}
+
+	int32_t result = (m_peak_at - m_sent) << 8;
+	int32_t denom = m_peak_prev - 2 * m_peak + m_peak_next;
+	if (denom < 0)
+	{
+		int32_t frac = (int32_t) (128.0 * (m_peak_prev - m_peak_next) / denom);
+		if (frac > 128) frac = 128;
+		if (frac < -128) frac = -128;
+		result += frac;
+	}
+
+	m_result = result;
+	m_num_results++;
+	m_waiting = false;
+}
+
+
+void AudioLatencyProbe::update(void)
+{
+	audio_block_t *in = receiveReadOnly(0);
+
+	if (m_waiting)
+	{
+		int16_t *block = &m_history[HISTORY];
+		if (in)
+			memcpy(block,in->data,sizeof(in->data));
+		else
+			memset(block,0,AUDIO_BLOCK_SAMPLES * sizeof(int16_t));
+		correlate(m_history);
+		memmove(m_history,&m_history[AUDIO_BLOCK_SAMPLES],HISTORY * sizeof(int16_t));
+
+		if (m_waiting && m_samples - m_sent > TIMEOUT_SAMPLES)
+		{
+			m_waiting = false;
+			m_timeouts++;
+		}
+	}
+	if (in)
+		release(in);
+
+	// start the next test signal at the start of a block,
+	// or just carry on with silence
+
+	if (!m_waiting && m_samples - m_sent >= PERIOD_SAMPLES)
+	{
+		m_sent = m_samples;
+		m_send_pos = 0;
+		m_waiting = true;
+		m_found = false;
+		m_want_next = false;
+		m_peak = 0;
+		m_prev_corr = 0;
+		memset(m_history,0,HISTORY * sizeof(int16_t));
+	}
+
+	// and send as much of it as fits in this block
+
+	if (m_send_pos < LATENCY_PROBE_LEN)
+	{
+		audio_block_t *out = allocate();
+		if (out)
+		{
+			int len = LATENCY_PROBE_LEN - m_send_pos;
+			if (len > AUDIO_BLOCK_SAMPLES)
+				len = AUDIO_BLOCK_SAMPLES;
+			memset(out->data,0,sizeof(out->data));
+			memcpy(out->data,&m_signal[m_send_pos],len * sizeof(int16_t));
+			transmit(out);
+			release(out);
+			m_send_pos += len;
+		}
+		else
+			m_send_pos = LATENCY_PROBE_LEN;
+				// a broken signal, which will just time out
+	}
+
+	m_samples += AUDIO_BLOCK_SAMPLES;
+}
+
+
+//-----------------------------------
+// statistics
+//-----------------------------------
+
+typedef struct
+{
+	uint32_t count;
+	double sum;
+	double sum_sq;
+	double min;
+	double max;
+} latencyStats_t;
+
+
+static void clearStats(latencyStats_t *stats)
+{
+	stats->count = 0;
+	stats->sum = 0;
+	stats->sum_sq = 0;
+	stats->min = 1e9;
+	stats->max = -1e9;
+}
+
+static void addStat(latencyStats_t *stats, double val)
+{
+	stats->count++;
+	stats->sum += val;
+	stats->sum_sq += val * val;
+	if (val < stats->min) stats->min = val;
+	if (val > stats->max) stats->max = val;
+}
+
+static void showStats(const char *what, latencyStats_t *stats)
+	// in milliseconds, jitter in microseconds
+{
+	double mean = stats->sum / stats->count;
+	double var = stats->sum_sq / stats->count - mean * mean;
+	double jitter = var > 0 ? sqrt(var) : 0;
+	double ms = 1000.0 / AUDIO_SAMPLE_RATE_EXACT;
+	display(0,"latency %-5s n(%d) mean(%0.3f ms) jitter(%0.1f us) min(%0.3f) max(%0.3f)",
+		what,
+		stats->count,
+		mean * ms,
+		jitter * ms * 1000,
+		stats->min * ms,
+		stats->max * ms);
+}
+
+
+void AudioLatencyProbe::task()
+{
+	static bool started = false;
+	static uint32_t last_results = 0;
+	static uint32_t last_timeouts = 0;
+	static latencyStats_t batch;
+	static latencyStats_t total;
+
+	if (!started)
+	{
+		started = true;
+		clearStats(&batch);
+		clearStats(&total);
+		display(0,"latency benchmark %s(%d samples) block(%d) every %d ms",
+			LATENCY_PROBE_CHIRP ? "chirp" : "click",
+			LATENCY_PROBE_LEN,
+			AUDIO_BLOCK_SAMPLES,
+			LATENCY_PROBE_PERIOD_MS);
+	}
+
+	if (m_num_results != last_results)
+	{
+		last_results = m_num_results;
+		double samples = m_result / 256.0;
+		addStat(&batch,samples);
+		addStat(&total,samples);
+
+		if (batch.count >= LATENCY_PROBE_REPORT_EVERY)
+		{
+			showStats("batch",&batch);
+			showStats("total",&total);
+			clearStats(&batch);
+		}
+	}
+	if (m_timeouts != last_timeouts)
+	{
+		last_timeouts = m_timeouts;
+		warning(0,"latency test signal did not come back (%d times)",m_timeouts);
+	}
+}
+
+
+// end of latencyProbe.cpp
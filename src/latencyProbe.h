@@ -0,0 +1,102 @@
+//-------------------------------------------------------
+// latencyProbe.h
+//-------------------------------------------------------
+// Round trip latency and jitter benchmark for the audio graph.
+//
+// The output sends a short test signal every LATENCY_PROBE_PERIOD_MS
+// and silence otherwise.  The signal is a windowed chirp (or, with
+// LATENCY_PROBE_CHIRP 0, one cycle of a square wave), and the input runs
+// a correlation against the same signal to find it coming back, even at
+// a low level or under some noise.  The correlation peak, interpolated to
+// a fraction of a sample, minus the sample at which the signal was sent,
+// is the latency, including the block of graph delay that any real
+// signal sees.
+//
+// In TE3_hub.ino the output replaces the sine on the in_mix to usb_out, and
+// the input is either usb_in (hub -> iPad -> hub, with the iPad app
+// monitoring its input) or the Looper return on i2s_in channel 2.
+//
+// task(), from loop(), collects the measurements and every
+// LATENCY_PROBE_REPORT_EVERY of them displays the mean latency, the
+// jitter (standard deviation), and the min and max, both for that batch
+// and since the start, so different buffer and drift settings can be
+// compared over thousands of iterations.
+
+#pragma once
+
+#include <Arduino.h>
+#include <AudioStream.h>
+
+
+#define LATENCY_PROBE_CHIRP			1
+	// 0 = a square wave click
+#define LATENCY_PROBE_LEN			64
+	// samples in the test signal, and the correlation.
+	// May be more than AUDIO_BLOCK_SAMPLES.
+#define LATENCY_PROBE_PERIOD_MS		250
+#define LATENCY_PROBE_TIMEOUT_MS	200
+	// give up on a test signal after this
+#define LATENCY_PROBE_LEVEL			24000
+#define LATENCY_PROBE_THRESHOLD		8
+	// the return must be at least 1/8 of the level sent
+#define LATENCY_PROBE_REPORT_EVERY	100
+
+
+class AudioLatencyProbe : public AudioStream
+{
+public:
+
+	AudioLatencyProbe();
+
+	virtual void update(void);
+	void task();
+		// from loop()
+
+	int32_t latency()		{ return m_result; }
+		// last measurement in 1/256ths of a sample, -1 if none yet
+
+private:
+
+	void correlate(const int16_t *data);
+	void finish();
+
+	audio_block_t *m_input_queue[1];
+
+	int16_t m_signal[LATENCY_PROBE_LEN];
+		// what we send
+	int16_t m_template[LATENCY_PROBE_LEN];
+		// the same, scaled down so the correlation fits in 32 bits
+	int32_t m_threshold;
+
+	int16_t m_history[LATENCY_PROBE_LEN - 1 + AUDIO_BLOCK_SAMPLES];
+		// the end of the previous block, then this one
+
+	uint32_t m_samples;
+		// the sample clock, at the start of the current block
+	uint32_t m_sent;
+		// m_samples when the test signal started
+	bool m_waiting;
+	int m_send_pos;
+		// next sample of m_signal to send, LATENCY_PROBE_LEN = all sent
+
+	// peak tracking
+
+	bool m_found;
+	int32_t m_peak;
+	int32_t m_peak_prev;
+	int32_t m_peak_next;
+	uint32_t m_peak_at;
+		// sample clock of the start of the signal at the peak
+	int32_t m_prev_corr;
+	bool m_want_next;
+
+	// results, for task()
+
+	volatile int32_t m_result;
+	volatile uint32_t m_num_results;
+	volatile uint32_t m_timeouts;
+
+};
+
+
+// end of latencyProbe.h
@@ -0,0 +1,102 @@
+//-------------------------------------------------------
+// memoryProbe.cpp
+//-------------------------------------------------------
+// See memoryProbe.h
+
+#include "memoryProbe.h"
+#include <myDebug.h>
+
+
+AudioMemoryProbe *AudioMemoryProbe::s_probes[AUDIO_MEMORY_MAX_PROBES];
+int AudioMemoryProbe::s_num_probes = 0;
+
+
+AudioMemoryProbe::AudioMemoryProbe(const char *name) :
+	AudioStream(0,NULL),
+	m_name(name),
+	m_prev(0),
+	m_used(0),
+	m_used_max(0),
+	m_delta(0),
+	m_delta_max(0)
+{
+	active = true;
+		// not connected to anything, but
+		// we still need update() to be called
+	if (s_num_probes)
+		m_prev = s_probes[s_num_probes - 1];
+	if (s_num_probes < AUDIO_MEMORY_MAX_PROBES)
+		s_probes[s_num_probes++] = this;
+}
+
+
+void AudioMemoryProbe::update(void)
+{
+	int16_t used = AudioMemoryUsage();
+	int16_t delta = used - (m_prev ? m_prev->m_used : 0);
+	m_used = used;
+	m_delta = delta;
+	if (used > m_used_max)
+		m_used_max = used;
+	if (delta > m_delta_max)
+		m_delta_max = delta;
+}
+
+
+int AudioMemoryProbe::minimumSafe()
+{
+	return AudioMemoryUsageMax() + AUDIO_MEMORY_MARGIN;
+}
+
+
+void AudioMemoryProbe::report()
+{
+	display(0,"AudioMemory usage(%d) peak(%d) minimum safe AudioMemory(%d)",
+		AudioMemoryUsage(),
+		AudioMemoryUsageMax(),
+		minimumSafe());
+	for (int i=0; i<s_num_probes; i++)
+	{
+		AudioMemoryProbe *p = s_probes[i];
+		display(0,"    probe %-12s used(%d) peak(%d)  added(%d) peak(%d)",
+			p->m_name,
+			p->m_used,
+			p->m_used_max,
+			p->m_delta,
+			p->m_delta_max);
+	}
+}
+
+
+void AudioMemoryProbe::task()
+{
+	static uint32_t start = 0;
+	static bool calibrated = false;
+	static int last_max = 0;
+
+	if (!start)
+	{
+		start = millis();
+		AudioMemoryUsageMaxReset();
+		return;
+	}
+	if (!calibrated)
+	{
+		if (millis() - start < AUDIO_MEMORY_CALIBRATE_MS)
+			return;
+		calibrated = true;
+		display(0,"AudioMemory calibration after %d ms",AUDIO_MEMORY_CALIBRATE_MS);
+		last_max = AudioMemoryUsageMax();
+		report();
+		return;
+	}
+	if (AudioMemoryUsageMax() > last_max)
+	{
+		last_max = AudioMemoryUsageMax();
+		warning(0,"AudioMemory peak went up after calibration",0);
+		report();
+	}
+}
+
+
+// end of memoryProbe.cpp
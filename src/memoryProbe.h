@@ -0,0 +1,70 @@
+//-------------------------------------------------------
+// memoryProbe.h
+//-------------------------------------------------------
+// Instrumentation for sizing AudioMemory().
+//
+// The audio library only keeps a global count of allocated blocks
+// (AudioMemoryUsage() and AudioMemoryUsageMax()), which says nothing
+// about where they go.  An AudioMemoryProbe is an AudioStream with no
+// inputs or outputs, like AudioUsbDrift, that just samples that count
+// when its update() is called.  update() order is declaration order,
+// so a probe declared after an object sees the blocks that the objects
+// in front of it hold at that point, and the difference from the probe
+// before it is what the objects in between added.  Each probe keeps the
+// current and peak of its own count and of that difference.
+//
+// AudioMemoryProbe::task(), from loop(), runs the calibration.  It
+// waits AUDIO_MEMORY_CALIBRATE_MS after the first call, then reports
+// every probe, the overall peak, and the smallest AudioMemory() that
+// should be safe for this graph (the peak plus AUDIO_MEMORY_MARGIN),
+// and then reports again whenever the overall peak goes up.
+//
+// The peak that matters is the one seen while everything is busy,
+// so during calibration the audio should be running (USB streaming,
+// all mixer levels up) for the whole period.
+
+#pragma once
+
+#include <Arduino.h>
+#include <AudioStream.h>
+
+
+#define AUDIO_MEMORY_MAX_PROBES		8
+#define AUDIO_MEMORY_CALIBRATE_MS	10000
+#define AUDIO_MEMORY_MARGIN			4
+	// blocks on top of the measured peak
+
+
+class AudioMemoryProbe : public AudioStream
+{
+public:
+
+	AudioMemoryProbe(const char *name);
+
+	virtual void update(void);
+
+	static void task();
+		// from loop()
+	static void report();
+		// display() everything now
+
+	static int minimumSafe();
+		// the overall peak plus the margin
+
+private:
+
+	const char *m_name;
+	AudioMemoryProbe *m_prev;
+		// the probe before us in update() order
+	volatile int16_t m_used;
+	volatile int16_t m_used_max;
+	volatile int16_t m_delta;
+	volatile int16_t m_delta_max;
+
+	static AudioMemoryProbe *s_probes[AUDIO_MEMORY_MAX_PROBES];
+	static int s_num_probes;
+
+};
+
+
+// end of memoryProbe.h
@@ -3,20 +3,47 @@
 //-----------------------------------------
 // simple one uni-directional midi host
 // forwards everything from the HOST port
-// to the 1st USB midi port
+// to the 1st USB midi port, through a 256 byte
+// table indexed by the first byte of each packet,
+// that drops it, or gives its new cable.
 
 #include "midiHost.h"
 #include <myDebug.h>
+#include "deferLog.h"
+#include "midiOut.h"
 // #include "midiQueue.h"
 // #include "theSystem.h"
 
 #if WITH_MIDI_HOST
 
+    #define QUEUE_MASK  (MIDI_HOST_QUEUE_SIZE - 1)
+
+    #define MIDI_HOST_BATCH     64
+        // most packets moved to the device per task()
+
     USBHost myusb;
     midiHost midi_host;
 
 
-    midiHost::midiHost() : MIDIDevice(myusb) {}
+    midiHost::midiHost() :
+        MIDIDevice(myusb),
+        m_head(0),
+        m_tail(0),
+        m_rx_held(0),
+        m_overflows(0),
+        m_stalls(0),
+        m_forwarded(0),
+        m_high_water(0),
+        m_filtered(0)
+    {
+        m_cable_mask = 0xffff;
+        m_type_mask = MIDI_HOST_PASS_ALL;
+        for (int i=0; i<MIDI_HOST_NUM_CABLES; i++)
+            m_cable_map[i] = i;
+        m_route = m_route_tables[0];
+        buildRoute();
+    }
+
 
     void midiHost::init()
     {
@@ -24,97 +51,173 @@
     }
 
 
+    //-------------------------------------
+    // filtering
+    //-------------------------------------
+
+    static const uint16_t cin_type[16] = {
+        0,                              // 0x0 reserved
+        0,                              // 0x1 reserved (cable events)
+        MIDI_HOST_PASS_SYSTEM,          // 0x2 two byte system common
+        MIDI_HOST_PASS_SYSTEM,          // 0x3 three byte system common
+        MIDI_HOST_PASS_SYSEX,           // 0x4 sysex start/continue
+        MIDI_HOST_PASS_SYSEX,           // 0x5 sysex end 1 byte (or 1 byte common)
+        MIDI_HOST_PASS_SYSEX,           // 0x6 sysex end 2 bytes
+        MIDI_HOST_PASS_SYSEX,           // 0x7 sysex end 3 bytes
+        MIDI_HOST_PASS_NOTES,           // 0x8 note off
+        MIDI_HOST_PASS_NOTES,           // 0x9 note on
+        MIDI_HOST_PASS_AFTERTOUCH,      // 0xA poly pressure
+        MIDI_HOST_PASS_CCS,             // 0xB control change
+        MIDI_HOST_PASS_PROGRAMS,        // 0xC program change
+        MIDI_HOST_PASS_AFTERTOUCH,      // 0xD channel pressure
+        MIDI_HOST_PASS_BENDS,           // 0xE pitch bend
+        MIDI_HOST_PASS_SYSTEM,          // 0xF single byte (clock, etc)
+    };
+
+
+    void midiHost::setFilter(uint16_t cable_mask, uint16_t type_mask)
+    {
+        m_cable_mask = cable_mask;
+        m_type_mask = type_mask;
+        buildRoute();
+    }
 
-    void midiHost::rx_data(const Transfer_t *transfer)
-        // made virtual in USBHost_t36.h
+    void midiHost::setCableMap(uint8_t host_cable, uint8_t out_cable)
     {
-        uint32_t len = (transfer->length - ((transfer->qtd.token >> 16) & 0x7FFF)) >> 2;
-        if (len)
+        if (host_cable >= MIDI_HOST_NUM_CABLES ||
+            out_cable >= MIDI_HOST_NUM_CABLES)
         {
-            bool any = 0;
-            for (uint32_t i=0; i < len; i++)
-            {
-                uint32_t msg32 = rx_buffer[i];
-                if (msg32)
-                {
-                    any = 1;
-                    usb_midi_write_packed(msg32);
-
-                    #if DEBUG_MIDI_HOST
-                        // debugging withink the irq DEFINITELY mucks things up
-                            display(0,"host:  0x%08x",msg32);
-                    #endif
-
-                    // Not implemented yet
-
-                    // port comes in as 0x00 or 0x10
-                    // we bump it to MIDI_PORT_HOST1 = 0x40 or
-                    // MIDI_PORT_HOST2 = 0x50;
+            my_error("midiHost::setCableMap(%d,%d) bad cable",host_cable,out_cable);
+            return;
+        }
+        m_cable_map[host_cable] = out_cable;
+        buildRoute();
+    }
 
-                    // enqueueMidi(false, MIDI_PORT_HOST1 | (msg32 & MIDI_PORT_NUM_MASK), msg32);
 
-                }
-            }
+    void midiHost::buildRoute()
+        // Only called from loop().  rx_data() reads m_route once
+        // per transfer, so the swap is atomic from its point of view.
+    {
+        uint8_t *table = (uint8_t *) (m_route == m_route_tables[0] ?
+            m_route_tables[1] : m_route_tables[0]);
 
-            if (any)
-                usb_midi_flush_output();
+        for (int i=0; i<256; i++)
+        {
+            uint8_t cable = i >> 4;
+            uint8_t cin = i & 0x0f;
+            bool pass =
+                ((m_cable_mask >> cable) & 1) &&
+                (cin_type[cin] & m_type_mask);
+            table[i] = pass ? (m_cable_map[cable] << 4) | cin : 0;
         }
 
-        queue_Data_Transfer(rxpipe, rx_buffer, rx_size, this);
+        asm volatile ("dmb");
+        m_route = table;
     }
 
-#endif  // WITH_MIDI_HOST
 
+    //-------------------------------------
+    // queue
+    //-------------------------------------
 
-//-----------------------------------------------
-// not implemented yet
-//-----------------------------------------------
+    uint32_t midiHost::roomFor()
+        // free slots in the ring, from either side
+    {
+        return QUEUE_MASK - ((m_head - m_tail) & QUEUE_MASK);
+    }
 
-#if 0   //  not compiled yet
 
-    bool passFilter(uint32_t iii)
+    void midiHost::rx_data(const Transfer_t *transfer)
+        // made virtual in USBHost_t36.h
+        // debugging within the irq DEFINITELY mucks things up,
+        // so there is nothing but counting here
     {
-        // don't pass em if filter is not on
-
-        msgUnion msg(iii);
-        int type = msg.getMsgType();
-        if (getPref8(PREF_PERF_FILTER))        // filter is on
+        uint32_t len = (transfer->length - ((transfer->qtd.token >> 16) & 0x7FFF)) >> 2;
+        const uint8_t *route = m_route;
+        uint16_t head = m_head;
+        for (uint32_t i=0; i < len; i++)
         {
-            // only accept messages from cable 0
+            uint32_t msg32 = rx_buffer[i];
+            uint8_t byte0 = route[msg32 & 0xff];
+                // empty (zero) packets map to zero too
+            if (!byte0)
+            {
+                if (msg32)
+                    m_filtered++;
+            }
+            else
+            {
+                msg32 = (msg32 & 0xffffff00) | byte0;
+                uint16_t next = (head + 1) & QUEUE_MASK;
+                if (next == m_tail)
+                {
+                    m_overflows++;
+                    continue;
+                }
+                m_queue[head] = msg32;
+                head = next;
+            }
+        }
 
-            if (msg.isCable1())
-                return 0;
+        asm volatile ("dmb");
+            // the packets before the index
+        m_head = head;
 
-            // only accept note on, note off, or pitchbends if the pref is cleared
+        uint16_t used = (head - m_tail) & QUEUE_MASK;
+        if (used > m_high_water)
+            m_high_water = used;
 
-            bool filter_bends = getPref8(PREF_PERF_FILTER_BENDS);
-            if (type!=0x08 && type!=0x09 && (type!=0x0E || filter_bends))
-                return 0;
+        if (roomFor() >= (uint32_t)(rx_size >> 2))
+        {
+            queue_Data_Transfer(rxpipe, rx_buffer, rx_size, this);
+        }
+        else
+        {
+            m_rx_held = 1;
+            m_stalls++;
         }
+    }
+
 
-        // prh 2020-08-02 - removed initial hack of layer filters
+    void midiHost::task()
+    {
+        myusb.Task();
 
-        // send it to the teensyduino
+        // the packets are staged in midi_out, which hands
+        // them to the teensy once per microframe
 
-        usb_midi_write_packed(msg.i);
-        theSystem.midiActivity(INDEX_MASK_OUTPUT);
-            // it IS port one, cable 0
+        int count = 0;
+        uint16_t tail = m_tail;
+        while (count < MIDI_HOST_BATCH && tail != m_head)
+        {
+            midi_out.write(m_queue[tail]);
+            tail = (tail + 1) & QUEUE_MASK;
+            count++;
+        }
+        m_tail = tail;
+        m_forwarded += count;
 
-        // if "monitor performanc" pref is set
-        // enqueue it for display as PORT_INDEX_DUINO_OUTPUT0
-        // with the PORT_MASK_PERFORM flag to display it differently
+        // restart a held receive once there is room for it
 
-        if (getPref8(PREF_MONITOR_PERFORMANCE))
+        if (m_rx_held && rxpipe &&
+            roomFor() >= (uint32_t)(rx_size >> 2))
         {
-            msg.i &= ~PORT_MASK;                            // clear the old port
-            msg.i |= PORT_MASK_OUTPUT | PORT_MASK_PERFORM;  // output to teensyDuino0
-            enqueueProcess(msg.i);
+            __disable_irq();
+            m_rx_held = 0;
+            queue_Data_Transfer(rxpipe, rx_buffer, rx_size, this);
+            __enable_irq();
         }
 
-        return 1;   // flush the usb_midi buffer
+        static uint32_t last_overflows = 0;
+        if (m_overflows != last_overflows)
+        {
+            defer_error("midiHost dropped %d packets",m_overflows - last_overflows);
+            last_overflows = m_overflows;
+        }
     }
-#endif
 
+#endif  // WITH_MIDI_HOST
 
 
 //-----------------------------------------------
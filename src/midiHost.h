@@ -1,6 +1,6 @@
 #pragma once
 
-#define WITH_MIDI_HOST  0
+#define WITH_MIDI_HOST  1
     // The MIDI host can be compiled out if I'm paranoid
     // about something not working, but otherwise, there's
     // no reason to ever set this define to zero.
@@ -10,19 +10,100 @@
     #include <Arduino.h>
     #include <USBHost_t36.h>
 
+    #define MIDI_HOST_QUEUE_SIZE    256
+        // packets, must be a power of two, and at least
+        // two full host transfers (rx_size/4 packets each)
+
+    // setFilter() type bits, by code index number (CIN)
+
+    #define MIDI_HOST_PASS_NOTES        0x0001      // 0x8, 0x9
+    #define MIDI_HOST_PASS_AFTERTOUCH   0x0002      // 0xA, 0xD
+    #define MIDI_HOST_PASS_CCS          0x0004      // 0xB
+    #define MIDI_HOST_PASS_PROGRAMS     0x0008      // 0xC
+    #define MIDI_HOST_PASS_BENDS        0x0010      // 0xE
+    #define MIDI_HOST_PASS_SYSEX        0x0020      // 0x4..0x7
+    #define MIDI_HOST_PASS_SYSTEM       0x0040      // 0x2, 0x3, 0xF
+    #define MIDI_HOST_PASS_ALL          0x007F
+
+    #define MIDI_HOST_NUM_CABLES        16
+
     class midiHost : public MIDIDevice
         // requires slightly modified USBHost_t36.h
+        //
+        // rx_data() runs in the USB host interrupt.  It only copies
+        // the packets into a single producer / single consumer ring,
+        // and re-queues the receive transfer if there is room for
+        // another full one.  task(), from loop(), moves the packets
+        // to the device side through midi_out (see midiOut.h), and
+        // never flushes.  The device SOF interrupt (_usb.c) flushes
+        // whatever partial USB packet is pending, so a dense controller
+        // stream goes out in full transfers, not one tiny transfer
+        // per host packet.
+        //
+        // If loop() falls behind and the ring cannot take another
+        // transfer, the receive is not re-queued (the device NAKs and
+        // holds its data) until task() makes room.  That is counted as
+        // a stall.  Packets are only dropped (and counted) if a transfer
+        // somehow brings more than the room that was checked for.
     {
         public:
 
             midiHost();
             void init();
+            void task();
+                // from loop()
+
             virtual void rx_data(const Transfer_t *transfer);
 
+            // filtering and routing, replaces the old passFilter().
+            // Setting either rebuilds the lookup table that rx_data()
+            // uses, so none of this is looked at per message.
+            // The default passes everything through unchanged.
+
+            void setFilter(uint16_t cable_mask, uint16_t type_mask);
+                // bit n of cable_mask passes host cable n
+            void setCableMap(uint8_t host_cable, uint8_t out_cable);
+                // which device side cable a host cable goes out on
+
+            // diagnostics, counted since init()
+
+            uint32_t overflows()    { return m_overflows; }
+            uint32_t stalls()       { return m_stalls; }
+            uint32_t forwarded()    { return m_forwarded; }
+            uint16_t highWater()    { return m_high_water; }
+            uint32_t filtered()     { return m_filtered; }
+
+        private:
+
+            uint32_t roomFor();
+            void buildRoute();
+
+            uint16_t m_cable_mask;
+            uint16_t m_type_mask;
+            uint8_t m_cable_map[MIDI_HOST_NUM_CABLES];
+
+            uint8_t m_route_tables[2][256];
+                // byte0 (cable<<4 | CIN) => new byte0, or 0 to drop
+            const uint8_t * volatile m_route;
+                // the one rx_data() is using; buildRoute()
+                // fills the other, and then swaps them
+
+            uint32_t m_queue[MIDI_HOST_QUEUE_SIZE];
+            volatile uint16_t m_head;
+                // written only by rx_data()
+            volatile uint16_t m_tail;
+                // written only by task()
+            volatile bool m_rx_held;
+                // rx_data() did not re-queue the transfer
+
+            volatile uint32_t m_overflows;
+            volatile uint32_t m_stalls;
+            uint32_t m_forwarded;
+            volatile uint16_t m_high_water;
+            volatile uint32_t m_filtered;
     };
 
 
     extern midiHost midi_host;
 
 #endif
-
@@ -0,0 +1,148 @@
+//-------------------------------------------------------
+// midiOut.cpp
+//-------------------------------------------------------
+// See midiOut.h.  Everything here runs in loop().
+
+#include "midiOut.h"
+#include <myDebug.h>
+
+#define CIN_CC		0x0B
+
+extern "C" {
+	extern volatile uint8_t usb_midi_flush_divider;		// _usb.c
+	extern volatile uint8_t usb_high_speed;				// _usb.c
+}
+
+#define USB_HS_SOF_US	125
+#define USB_FS_SOF_US	1000
+
+midiOut midi_out;
+
+
+midiOut::midiOut() :
+	m_pending(0),
+	m_frindex(0),
+	m_high_speed(0xff),
+	m_coalesced(0),
+	m_stage_full(0)
+{
+	for (int i=0; i<MIDI_OUT_NUM_CABLES; i++)
+	{
+		m_priority[i] = MIDI_OUT_DEFAULT_PRIORITY;
+		m_count[i] = 0;
+	}
+	buildOrder();
+}
+
+
+void midiOut::begin()
+{
+	setFlushDivider();
+	m_frindex = USB1_FRINDEX;
+}
+
+
+void midiOut::setFlushDivider()
+{
+	m_high_speed = usb_high_speed;
+	int divider = MIDI_OUT_FLUSH_US / (m_high_speed ? USB_HS_SOF_US : USB_FS_SOF_US);
+	usb_midi_flush_divider = divider < 1 ? 1 : divider;
+}
+
+
+void midiOut::setPriority(uint8_t cable, uint8_t priority)
+{
+	if (cable >= MIDI_OUT_NUM_CABLES ||
+		priority >= MIDI_OUT_NUM_PRIORITIES)
+	{
+		my_error("midiOut::setPriority(%d,%d) out of range",cable,priority);
+		return;
+	}
+	m_priority[cable] = priority;
+	buildOrder();
+}
+
+
+void midiOut::buildOrder()
+	// stable, so equal priorities go in cable order
+{
+	int n = 0;
+	for (int pri=0; pri<MIDI_OUT_NUM_PRIORITIES; pri++)
+	{
+		for (int cable=0; cable<MIDI_OUT_NUM_CABLES; cable++)
+		{
+			if (m_priority[cable] == pri)
+				m_order[n++] = cable;
+		}
+	}
+}
+
+
+void midiOut::write(uint32_t msg32)
+{
+	uint8_t cable = (msg32 >> 4) & 0x0f;
+	uint8_t count = m_count[cable];
+	uint32_t *stage = m_stage[cable];
+
+	// a CC replaces a staged one for the same controller,
+	// looking back only through the trailing run of CCs.
+	// The low three bytes are cable/CIN, status, and CC number.
+
+	if ((msg32 & 0x0f) == CIN_CC)
+	{
+		for (int i=count-1; i>=0 && (stage[i] & 0x0f) == CIN_CC; i--)
+		{
+			if ((stage[i] & 0x00ffffff) == (msg32 & 0x00ffffff))
+			{
+				stage[i] = msg32;
+				m_coalesced++;
+				return;
+			}
+		}
+	}
+
+	if (count >= MIDI_OUT_STAGE_SIZE)
+	{
+		m_stage_full++;
+		flush();
+		count = 0;
+	}
+
+	stage[count++] = msg32;
+	m_count[cable] = count;
+	m_pending |= (1 << cable);
+}
+
+
+void midiOut::task()
+{
+	if (usb_high_speed != m_high_speed)
+		setFlushDivider();
+	if (!m_pending)
+		return;
+	uint32_t frindex = USB1_FRINDEX;
+	if (frindex != m_frindex)
+	{
+		m_frindex = frindex;
+		flush();
+	}
+}
+
+
+void midiOut::flush()
+{
+	for (int i=0; i<MIDI_OUT_NUM_CABLES && m_pending; i++)
+	{
+		uint8_t cable = m_order[i];
+		if (!(m_pending & (1 << cable)))
+			continue;
+		uint32_t *stage = m_stage[cable];
+		for (int j=0; j<m_count[cable]; j++)
+			usb_midi_write_packed(stage[j]);
+		m_count[cable] = 0;
+		m_pending &= ~(1 << cable);
+	}
+}
+
+
+// end of midiOut.cpp
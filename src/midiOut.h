@@ -0,0 +1,91 @@
+//-------------------------------------------------------
+// midiOut.h
+//-------------------------------------------------------
+// Staging for everything we send out the device side USB MIDI
+// endpoint, on any of the 16 cables.
+//
+// write() only puts the packet in a small per-cable stage.  task(),
+// from loop(), hands the staged packets to the teensy's
+// usb_midi_write_packed() once per USB microframe (a change in
+// USB1_FRINDEX), highest priority cable first.  The teensy packs them
+// into its 512 byte high speed transmit buffer, which goes out when it
+// is full, or on the SOF flush in _usb.c, which we slow down with
+// usb_midi_flush_divider so partial buffers have time to fill.
+//
+// The SOF comes every 125us microframe at high speed, but only every
+// 1ms frame at full speed, where USB1_FRINDEX also only counts frames.
+// So task() sets the divider from usb_high_speed once the host has
+// picked a speed, and at full speed everything here is per 1ms frame.
+//
+// A control change that arrives while an earlier one for the same
+// cable, channel and controller is still staged, with nothing but other
+// control changes after it, just replaces the earlier value.  That is
+// what cuts a dense expression pedal stream down to one packet per
+// controller per microframe, without ever moving a CC across a note.
+
+#pragma once
+
+#include <Arduino.h>
+
+
+#define MIDI_OUT_NUM_CABLES		16
+#define MIDI_OUT_STAGE_SIZE		32
+	// packets per cable per microframe
+#define MIDI_OUT_NUM_PRIORITIES	4
+	// 0 is the highest
+#define MIDI_OUT_DEFAULT_PRIORITY	1
+
+#define MIDI_OUT_FLUSH_US		500
+	// SOF flush of the partial teensy buffer no more often than this.
+	// Every 4th SOF at high speed, and every SOF (the stock behavior)
+	// at full speed, where they are already 1ms apart.
+
+
+class midiOut
+{
+public:
+
+	midiOut();
+
+	void begin();
+	void setPriority(uint8_t cable, uint8_t priority);
+
+	void write(uint32_t msg32);
+	void task();
+		// from loop(); flushes the stages on a new microframe
+	void flush();
+		// flushes the stages right now
+
+	// diagnostics
+
+	uint32_t coalesced()	{ return m_coalesced; }
+	uint32_t stageFull()	{ return m_stage_full; }
+
+private:
+
+	void buildOrder();
+	void setFlushDivider();
+		// in _usb.c, for the current usb_high_speed
+
+	uint8_t m_priority[MIDI_OUT_NUM_CABLES];
+	uint8_t m_order[MIDI_OUT_NUM_CABLES];
+		// cables by priority, rebuilt by setPriority()
+	uint16_t m_pending;
+		// bitmask of cables with staged packets
+
+	uint32_t m_stage[MIDI_OUT_NUM_CABLES][MIDI_OUT_STAGE_SIZE];
+	uint8_t m_count[MIDI_OUT_NUM_CABLES];
+
+	uint32_t m_frindex;
+	uint8_t m_high_speed;
+		// usb_high_speed when the divider was set, 0xff = not yet
+	uint32_t m_coalesced;
+	uint32_t m_stage_full;
+
+};
+
+
+extern midiOut midi_out;
+
+
+// end of midiOut.h
@@ -0,0 +1,112 @@
+//-------------------------------------------------------
+// serialMidi.cpp
+//-------------------------------------------------------
+// See serialMidi.h.  Serial1 is LPUART6 on the teensy 4.0.
+// attachInterruptVector() is just a write to _VectorsRam[],
+// so we read the core's handler out of the same table.
+
+#include "serialMidi.h"
+
+#define SERIAL_MIDI_MASK	(SERIAL_MIDI_RING_SIZE - 1)
+
+serialMidi serial_midi;
+
+static void (*s_core_isr)(void) = 0;
+	// the HardwareSerial handler we chain to
+
+
+serialMidi::serialMidi() :
+	m_port(0),
+	m_cable_mask(0),
+	m_cin_mask(0),
+	m_msg32(0),
+	m_len(0),
+	m_head(0),
+	m_tail(0),
+	m_sync_errors(0),
+	m_overflows(0)
+{}
+
+
+void serialMidi::begin(HardwareSerial *port, uint16_t cable_mask, uint16_t cin_mask)
+{
+	m_port = port;
+	m_cable_mask = cable_mask;
+	m_cin_mask = cin_mask;
+
+	__disable_irq();
+	if (_VectorsRam[IRQ_LPUART6 + 16] != isr)
+		s_core_isr = _VectorsRam[IRQ_LPUART6 + 16];
+	attachInterruptVector(IRQ_LPUART6, isr);
+
+	// anything that arrived before we took over, while the
+	// interrupt still can't run, as handleBytes() and the
+	// framing state are only safe from one place at a time
+
+	handleBytes();
+	__enable_irq();
+}
+
+
+void serialMidi::isr()
+{
+	if (s_core_isr)
+		s_core_isr();
+	serial_midi.handleBytes();
+}
+
+
+void serialMidi::handleBytes()
+	// called from the interrupt, and once from begin()
+	// with interrupts disabled
+{
+	while (m_port->available())
+	{
+		uint8_t byte = m_port->read();
+		if (m_len == 0)
+		{
+			if (!((m_cable_mask >> (byte >> 4)) & 1) ||
+				!((m_cin_mask >> (byte & 0x0f)) & 1))
+			{
+				m_sync_errors++;
+				continue;
+			}
+		}
+
+		((uint8_t *) &m_msg32)[m_len++] = byte;
+		if (m_len == 4)
+		{
+			m_len = 0;
+			uint16_t next = (m_head + 1) & SERIAL_MIDI_MASK;
+			if (next == m_tail)
+			{
+				m_overflows++;
+				continue;
+			}
+			m_ring[m_head] = m_msg32;
+			asm volatile ("dmb");
+				// the packet before the index
+			m_head = next;
+		}
+	}
+}
+
+
+int serialMidi::available()
+{
+	return (m_head - m_tail) & SERIAL_MIDI_MASK;
+}
+
+
+bool serialMidi::read(uint32_t *msg32)
+{
+	uint16_t tail = m_tail;
+	if (tail == m_head)
+		return false;
+	*msg32 = m_ring[tail];
+	m_tail = (tail + 1) & SERIAL_MIDI_MASK;
+	return true;
+}
+
+
+// end of serialMidi.cpp
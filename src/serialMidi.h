@@ -0,0 +1,78 @@
+//-------------------------------------------------------
+// serialMidi.h
+//-------------------------------------------------------
+// Interrupt side framing of the 4 byte USB-MIDI style packets
+// that TE3 sends us over the MIDI_SERIAL_PORT (Serial1 = LPUART6).
+//
+// begin() chains our own handler onto the LPUART6 interrupt vector.
+// It calls the core's Serial1 handler first (so transmit, and the
+// debug output, work exactly as before), then pulls whatever bytes
+// the core just put in its receive buffer, frames them into packets,
+// and pushes complete packets into a single producer / single consumer
+// ring that loop() drains with read().
+//
+// A first byte is only accepted if its cable and CIN (code index
+// number, the low nibble) are in the masks given to begin().  Bytes
+// that are skipped while looking for a valid first byte are counted,
+// not printed, as printing from here would be a disaster, and printing
+// from loop() made the sync loss worse when debugging to Serial1.
+
+#pragma once
+
+#include <Arduino.h>
+
+
+#define SERIAL_MIDI_RING_SIZE	128
+	// packets, must be a power of two.  Big
+	// enough for a whole scene recall SysEx.
+
+
+class serialMidi
+{
+public:
+
+	serialMidi();
+
+	void begin(HardwareSerial *port, uint16_t cable_mask, uint16_t cin_mask);
+		// call after port->begin().  Bit n of cable_mask accepts
+		// cable n, and bit n of cin_mask accepts CIN n.
+
+	bool read(uint32_t *msg32);
+		// returns false if no packets are waiting
+	int available();
+
+	// diagnostics, counted since begin()
+
+	uint32_t syncErrors()	{ return m_sync_errors; }
+		// bytes skipped looking for a valid first byte
+	uint32_t overflows()	{ return m_overflows; }
+		// complete packets dropped because the ring was full
+
+private:
+
+	static void isr();
+	void handleBytes();
+
+	HardwareSerial *m_port;
+	uint16_t m_cable_mask;
+	uint16_t m_cin_mask;
+
+	uint32_t m_msg32;
+	uint8_t m_len;
+
+	uint32_t m_ring[SERIAL_MIDI_RING_SIZE];
+	volatile uint16_t m_head;
+		// written only by the interrupt
+	volatile uint16_t m_tail;
+		// written only by read()
+
+	volatile uint32_t m_sync_errors;
+	volatile uint32_t m_overflows;
+
+};
+
+
+extern serialMidi serial_midi;
+
+
+// end of serialMidi.h
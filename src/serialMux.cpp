@@ -0,0 +1,160 @@
+//-------------------------------------------------------
+// serialMux.cpp
+//-------------------------------------------------------
+// See serialMux.h.  The rings are written from loop() and,
+// for debug text, possibly from interrupts, so the writers
+// briefly disable interrupts.  Only task() reads them.
+
+#include "serialMux.h"
+
+#define CONTROL_MASK	(SERIAL_MUX_CONTROL_SIZE - 1)
+#define DEBUG_MASK		(SERIAL_MUX_DEBUG_SIZE - 1)
+
+#define inInterrupt()	((SCB_ICSR & 0x1ff) != 0)
+	// VECTACTIVE
+
+serialMux serial_mux;
+
+
+serialMux::serialMux() :
+	m_port(0),
+	m_framed(false),
+	m_tx_size(0),
+	m_control_head(0),
+	m_control_tail(0),
+	m_debug_head(0),
+	m_debug_tail(0),
+	m_debug_dropped(0),
+	m_control_dropped(0),
+	m_in_task(false)
+{}
+
+
+void serialMux::begin(HardwareSerial *port, bool framed)
+{
+	port->flush();
+	m_tx_size = port->availableForWrite();
+	m_framed = framed;
+	m_port = port;
+}
+
+
+bool serialMux::writeControl(const uint8_t *packet)
+{
+	uint32_t pkt;
+	memcpy(&pkt,packet,4);
+
+	__disable_irq();
+	uint16_t next = (m_control_head + 1) & CONTROL_MASK;
+	if (next == m_control_tail)
+	{
+		m_control_dropped++;
+		__enable_irq();
+		return false;
+	}
+	m_control[m_control_head] = pkt;
+	m_control_head = next;
+	__enable_irq();
+
+	if (!inInterrupt())
+		task();
+	return true;
+}
+
+
+size_t serialMux::write(const uint8_t *buf, size_t len)
+{
+	__disable_irq();
+	for (size_t i=0; i<len; i++)
+	{
+		uint16_t next = (m_debug_head + 1) & DEBUG_MASK;
+		if (next == m_debug_tail)
+		{
+			m_debug_dropped += len - i;
+			break;
+		}
+		m_debug[m_debug_head] = buf[i];
+		m_debug_head = next;
+	}
+	__enable_irq();
+
+	if (!inInterrupt())
+		task();
+	return len;
+}
+
+
+void serialMux::task()
+{
+	if (!m_port)
+		return;
+	__disable_irq();
+	if (m_in_task)
+	{
+		__enable_irq();
+		return;
+	}
+	m_in_task = true;
+	__enable_irq();
+
+	// control packets first, whenever there is room
+
+	while (m_control_tail != m_control_head &&
+		   m_port->availableForWrite() >= 4)
+	{
+		uint32_t pkt = m_control[m_control_tail];
+		m_port->write((const uint8_t *) &pkt,4);
+		m_control_tail = (m_control_tail + 1) & CONTROL_MASK;
+	}
+
+	// debug only with no control waiting, and only
+	// while there is little in front of the next one
+
+	while (m_control_tail == m_control_head &&
+		   m_debug_tail != m_debug_head)
+	{
+		int room = m_port->availableForWrite();
+		int in_flight = m_tx_size - room;
+		if (room < 4 || in_flight + 4 > SERIAL_MUX_DEBUG_INFLIGHT)
+			break;
+
+		uint8_t packet[4];
+		int n = 0;
+		while (n < 3 && m_debug_tail != m_debug_head)
+		{
+			packet[1 + n++] = m_debug[m_debug_tail];
+			m_debug_tail = (m_debug_tail + 1) & DEBUG_MASK;
+		}
+
+		if (m_framed)
+		{
+			packet[0] = (SERIAL_DEBUG_CABLE << 4) | n;
+			while (n < 3)
+				packet[1 + n++] = 0;
+			m_port->write(packet,4);
+		}
+		else
+		{
+			m_port->write(&packet[1],n);
+		}
+	}
+
+	m_in_task = false;
+}
+
+
+void serialMux::flush()
+{
+	uint32_t start = millis();
+	while ((m_control_tail != m_control_head ||
+			m_debug_tail != m_debug_head) &&
+		   millis() - start < 500)
+	{
+		task();
+	}
+	if (m_port)
+		m_port->flush();
+}
+
+
+// end of serialMux.cpp
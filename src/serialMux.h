@@ -0,0 +1,100 @@
+//-------------------------------------------------------
+// serialMux.h
+//-------------------------------------------------------
+// Transmit side of the MIDI_SERIAL_PORT link to TE3, which carries
+// both the 4 byte control packets (telemetry, replies) and all of the
+// forwarded display() debug output.
+//
+// Control packets go into their own ring, and always go out first.
+// Debug text goes into a second ring, and is only moved to the port
+// while there is spare room in its transmit buffer, with at most
+// SERIAL_MUX_DEBUG_INFLIGHT debug bytes ever sitting in front of a
+// control packet.  Writing debug text never blocks; if the debug ring
+// is full the text is dropped and counted.
+//
+// In the default (raw) mode the debug text is sent as is, like before,
+// but never in the middle of a control packet.  In framed mode, used
+// with the high speed link, the debug text is carried in 4 byte packets
+// on SERIAL_DEBUG_CABLE with the CIN (low nibble) giving the number of
+// text bytes, 1..3, so TE3 never has to resync on text.
+//
+// An instance of this is installed as dbgSerial.  The Stream input
+// methods exist only to satisfy the interface and return nothing.
+// The receive side is in serialMidi.h.
+
+#pragma once
+
+#include <Arduino.h>
+
+
+#define SERIAL_MUX_CONTROL_SIZE		64
+	// packets, must be a power of two
+#define SERIAL_MUX_DEBUG_SIZE		4096
+	// bytes, must be a power of two
+#define SERIAL_MUX_DEBUG_INFLIGHT	64
+	// most debug bytes in the port's transmit buffer at once
+
+#define SERIAL_DEBUG_CABLE			0x0F
+	// framed mode only
+
+
+class serialMux : public Stream
+{
+public:
+
+	serialMux();
+
+	void begin(HardwareSerial *port, bool framed);
+
+	bool writeControl(const uint8_t *packet);
+		// queues one 4 byte packet, returns false if the ring is full
+	void task();
+		// moves queued bytes to the port.  Called from loop(),
+		// and opportunistically by the write methods.
+
+	// Print
+
+	virtual size_t write(uint8_t c)		{ return write(&c,1); }
+	virtual size_t write(const uint8_t *buf, size_t len);
+
+	// Stream
+
+	virtual int available()		{ return 0; }
+	virtual int read()			{ return -1; }
+	virtual int peek()			{ return -1; }
+	virtual void flush();
+		// blocks until both rings are empty (or 500ms), for reboots
+
+	// diagnostics
+
+	uint32_t debugDropped()		{ return m_debug_dropped; }
+	uint32_t controlDropped()	{ return m_control_dropped; }
+	int controlFree()			{ return (m_control_tail - m_control_head - 1) & (SERIAL_MUX_CONTROL_SIZE - 1); }
+		// packets writeControl() can take right now
+
+private:
+
+	HardwareSerial *m_port;
+	bool m_framed;
+	int m_tx_size;
+		// availableForWrite() of the empty port
+
+	uint32_t m_control[SERIAL_MUX_CONTROL_SIZE];
+	volatile uint16_t m_control_head;
+	volatile uint16_t m_control_tail;
+
+	uint8_t m_debug[SERIAL_MUX_DEBUG_SIZE];
+	volatile uint16_t m_debug_head;
+	volatile uint16_t m_debug_tail;
+
+	volatile uint32_t m_debug_dropped;
+	volatile uint32_t m_control_dropped;
+	volatile bool m_in_task;
+
+};
+
+
+extern serialMux serial_mux;
+
+
+// end of serialMux.h
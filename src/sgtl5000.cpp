@@ -29,10 +29,26 @@
 #include <sgtl5000midi.h>
 #include <Wire.h>
 #include <myDebug.h>
+#include "biquadTables.h"
+#include "deferLog.h"
 
 #define dbg_api  		0
 #define dbg_auto 		0
 #define dbg_dispatch	0
+#define dbg_scene		0
+
+#define SGTL_SCENE_MAX_CCS	(sgtlCCTable::num_ccs + SGTL_PEQ_FILTERS * PEQ_NUM_PARAMS)
+	// every CC that applyScene() could change
+#define SCENE_BLOCK_US		((uint32_t) (AUDIO_BLOCK_SAMPLES * 1000000.0 / AUDIO_SAMPLE_RATE_EXACT))
+	// a scene should be on the chip within one audio block
+#define SGTL_READY_TIMEOUT_MS	100
+	// how long enable() waits for the chip to answer
+#define SGTL_SYS_FS		( \
+	AUDIO_SAMPLE_RATE_EXACT > 90000 ? 0x000C : \
+	AUDIO_SAMPLE_RATE_EXACT > 46000 ? 0x0008 : \
+	AUDIO_SAMPLE_RATE_EXACT > 38000 ? 0x0004 : 0x0000 )
+	// CHIP_CLK_CTRL SYS_FS for the audio library rate (see usbAudio.h),
+	// with RATE_MODE 0.  MCLK from the teensy is 256*Fs at all of them.
 
 
 #define DUMP_CCS		1
@@ -594,6 +610,14 @@ bool SGTL5000::enable(void) {
 
 // I have not dealt with AVC, or the Pararmetric EQ, and the DAP_MIXER
 // is not used in this implmentation
+//
+// All registers are shadowed in m_shadow[], which is filled by
+// readShadow() in enable() and kept current by write().  All the
+// getters, and modify(), work from the shadow, so the only I2C reads
+// after enable() are explicit calls to read().
+//
+// Writes are queued (see i2cQueue.h) and go out from the LPI2C
+// interrupt, so none of the setters wait for the bus.
 
 
 bool SGTL5000::enable(const unsigned extMCLK, const uint32_t pllFreq)
@@ -632,12 +656,23 @@ bool SGTL5000::enable(const unsigned extMCLK, const uint32_t pllFreq)
 
 	m_hp_muted = true;
 	m_lineout_muted = true;
-	memset(m_band_value,0x2f,5);
-	memset(m_band_target,0x2f,5);
-	m_in_automation	= 0;
+	m_ramp_rate = SGTL_RAMP_DEFAULT_RATE;
+	m_ramp_active = 0;
+	m_ramp_next = 0;
+	initPeq();
 
 	Wire.begin();
-	delay(5);
+	uint32_t wait = millis();
+	while (millis() - wait < SGTL_READY_TIMEOUT_MS)
+	{
+		Wire.beginTransmission(m_i2c_addr);
+		if (Wire.endTransmission() == 0)
+			break;
+	}
+		// until the chip ACKs its address, instead of a fixed delay
+	display(dbg_api,"SGTL5000 answered after %d ms",millis() - wait);
+	m_queue.begin(m_i2c_addr);
+	m_queue.setDoneCallback(onWriteDone,this);
 
 	#if TRIGGER_PIN
 		pinMode(TRIGGER_PIN,OUTPUT);
@@ -654,11 +689,15 @@ bool SGTL5000::enable(const unsigned extMCLK, const uint32_t pllFreq)
 	}
 	display(dbg_api,"SGTL5000 CHIP_ID=0x%04X",id);
 
+	readShadow();
+		// the only time we read registers other than CHIP_ID,
+		// from here on write() keeps the shadow up to date.
+
 	#if DUMP_CCS
 		dumpCCValues("starting enable()");
 	#endif
 
-	uint16_t i2s_ctrl = read(CHIP_I2S_CTRL);
+	uint16_t i2s_ctrl = shadow(CHIP_I2S_CTRL);
 
 	display(0,"i2s_ctrl=0x%04x",i2s_ctrl);
 		// reset default = 0x10
@@ -673,19 +712,12 @@ bool SGTL5000::enable(const unsigned extMCLK, const uint32_t pllFreq)
 		display(0,"SGTL5000 SOFT RESET DETECTED",0);
 
 		// if so, do not initialize, instead
-		// read the all important m_ana_ctrl, and
-		// a few other registers that are cached,
-		// then return.
-
-		m_ana_ctrl = read(CHIP_ANA_CTRL);
-		m_hp_muted = m_ana_ctrl & (1<<4) ? 1 : 0;
-		m_lineout_muted = m_ana_ctrl & (1<<8) ? 1 : 0;
+		// pick up the cached variables from the
+		// register shadow, then return.
 
-		for (uint16_t i=0; i<5; i++)
-		{
-			m_band_value[i] = read(DAP_AUDIO_EQ_BASS_BAND0+i);
-			m_band_target[i] = m_band_value[i];
-		}
+		uint16_t ana_ctrl = shadow(CHIP_ANA_CTRL);
+		m_hp_muted = ana_ctrl & (1<<4) ? 1 : 0;
+		m_lineout_muted = ana_ctrl & (1<<8) ? 1 : 0;
 
 		#if DUMP_CCS
 			dumpCCValues("from enable() soft reset");
@@ -732,19 +764,22 @@ bool SGTL5000::enable(const unsigned extMCLK, const uint32_t pllFreq)
 	}
 
 	write(CHIP_DIG_POWER,	0x0073);		// power up all digital stuff
+	m_queue.flush();						// the delay starts when the power is up
 	delay(400);
+		// VAG ramping up with the "normal ramp" in CHIP_REF_CTRL.
+		// There is no status bit to poll for it.
 	write(CHIP_LINE_OUT_VOL, 0x1D1D);		// default approx 1.3 volts peak-to-peak
 	
 	if (extMCLK > 0)
 	{
 		//SGTL is I2S Master
-		write(CHIP_CLK_CTRL, 0x0004 | 0x03);	// 44.1 kHz, 256*Fs, use PLL
+		write(CHIP_CLK_CTRL, SGTL_SYS_FS | 0x03);	// Fs, use PLL
 		write(CHIP_I2S_CTRL, 0x0030 | (1<<7));	// SCLK=64*Fs, 16bit, I2S format
 	}
 	else
 	{
 		//SGTL is I2S Slave
-		write(CHIP_CLK_CTRL, 0x0004);			// 44.1 kHz, 256*Fs
+		write(CHIP_CLK_CTRL, SGTL_SYS_FS);		// Fs, 256*Fs
 		write(CHIP_I2S_CTRL, 0x0030);			// SCLK=64*Fs, 16bit, I2S format
 	}
 
@@ -780,47 +815,169 @@ bool SGTL5000::enable(const unsigned extMCLK, const uint32_t pllFreq)
 
 
 
+void SGTL5000::countI2C(uint32_t cycles, bool ok)
+{
+	if (cycles > m_i2c_max_cycles)
+		m_i2c_max_cycles = cycles;
+	m_i2c_count++;
+	if (!ok)
+		m_i2c_fails++;
+}
+
+
+void SGTL5000::getI2CStats(uint32_t *count, uint32_t *fails, uint32_t *max_us, bool clear /* = true */)
+{
+	__disable_irq();
+	*count = m_i2c_count;
+	*fails = m_i2c_fails;
+	*max_us = m_i2c_max_cycles / (F_CPU_ACTUAL / 1000000);
+	if (clear)
+	{
+		m_i2c_count = 0;
+		m_i2c_fails = 0;
+		m_i2c_max_cycles = 0;
+	}
+	__enable_irq();
+}
+
+
+void SGTL5000::onWriteDone(void *obj, uint16_t reg, uint16_t val, bool ok, uint32_t cycles)
+	// static, called from the i2cQueue interrupt
+{
+	SGTL5000 *self = (SGTL5000 *) obj;
+	self->countI2C(cycles,ok);
+	if (!ok)
+	{
+		self->m_error_reg = reg;
+		self->m_error_val = val;
+		self->m_write_errors++;
+	}
+	if (self->m_write_fxn)
+		self->m_write_fxn(self->m_write_obj,reg,val,ok,cycles);
+}
+
+
+
+// Registers that are read into the shadow by enable().
+// The gaps, debug registers, and write-only DAP_COEF_WR
+// registers are skipped, and start out as zero.
+
+static const uint16_t shadow_regs[] = {
+	CHIP_ID,
+	CHIP_DIG_POWER,
+	CHIP_CLK_CTRL,
+	CHIP_I2S_CTRL,
+	CHIP_SSS_CTRL,
+	CHIP_ADCDAC_CTRL,
+	CHIP_DAC_VOL,
+	CHIP_PAD_STRENGTH,
+	CHIP_ANA_ADC_CTRL,
+	CHIP_ANA_HP_CTRL,
+	CHIP_ANA_CTRL,
+	CHIP_LINREG_CTRL,
+	CHIP_REF_CTRL,
+	CHIP_MIC_CTRL,
+	CHIP_LINE_OUT_CTRL,
+	CHIP_LINE_OUT_VOL,
+	CHIP_ANA_POWER,
+	CHIP_PLL_CTRL,
+	CHIP_CLK_TOP_CTRL,
+	CHIP_ANA_STATUS,
+	CHIP_SHORT_CTRL,
+	DAP_CONTROL,
+	DAP_PEQ,
+	DAP_BASS_ENHANCE,
+	DAP_BASS_ENHANCE_CTRL,
+	DAP_AUDIO_EQ,
+	DAP_SGTL_SURROUND,
+	DAP_FILTER_COEF_ACCESS,
+	DAP_AUDIO_EQ_BASS_BAND0,
+	DAP_AUDIO_EQ_BAND1,
+	DAP_AUDIO_EQ_BAND2,
+	DAP_AUDIO_EQ_BAND3,
+	DAP_AUDIO_EQ_TREBLE_BAND4,
+	DAP_MAIN_CHAN,
+	DAP_MIX_CHAN,
+	DAP_AVC_CTRL,
+	DAP_AVC_THRESHOLD,
+	DAP_AVC_ATTACK,
+	DAP_AVC_DECAY,
+};
+
+
+void SGTL5000::readShadow()
+{
+	memset(m_shadow,0,sizeof(m_shadow));
+	for (uint16_t i=0; i<sizeof(shadow_regs)/sizeof(uint16_t); i++)
+	{
+		uint16_t reg_num = shadow_regs[i];
+		m_shadow[reg_num >> 1] = read(reg_num);
+	}
+	m_shadow[DAP_FILTER_COEF_ACCESS >> 1] &= ~0x100;
+}
+
+
+
 uint16_t SGTL5000::read(uint16_t reg_num)
 {
 	uint16_t val;
+	m_queue.flush();
+		// Wire and the queue share the port, and
+		// the read has to see any pending writes
+	uint32_t start = ARM_DWT_CYCCNT;
 	Wire.beginTransmission(m_i2c_addr);
 	Wire.write(reg_num >> 8);
 	Wire.write(reg_num);
 	if (Wire.endTransmission(false) != 0)
 	{
+		countI2C(ARM_DWT_CYCCNT - start,false);
 		my_error("SGTL5000::read(0x%04x,) failure1",reg_num);
 		return 0;
 	}
 	if (Wire.requestFrom((int)m_i2c_addr, 2) < 2)
 	{
+		countI2C(ARM_DWT_CYCCNT - start,false);
 		my_error("SGTL5000::read(0x%04x,) failure2",reg_num);
 		return 0;
 	}
 	val = Wire.read() << 8;
 	val |= Wire.read();
+	countI2C(ARM_DWT_CYCCNT - start,true);
 	return val;
 }
 
 bool SGTL5000::write(uint16_t reg_num, uint16_t val)
 {
-	Wire.beginTransmission(m_i2c_addr);
-	Wire.write(reg_num >> 8);
-	Wire.write(reg_num);
-	Wire.write(val >> 8);
-	Wire.write(val);
-	if (Wire.endTransmission() != 0)
+	if (!m_queue.write(reg_num,val))
+	{
+		defer_error("SGTL5000::write(0x%04x,0x%04x) queue failure",reg_num,val);
+		return false;
+	}
+	if (reg_num == DAP_FILTER_COEF_ACCESS)
+		val &= ~0x100;
+			// WR is self clearing, don't let modify() re-trigger it
+	m_shadow[reg_num >> 1] = val;
+	return true;
+}
+
+bool SGTL5000::writeBurst(uint16_t reg_num, const uint16_t *vals, uint8_t count)
+	// The SGTL5000 auto-increments the register address by 2
+	// after every data word, so consecutive registers can go
+	// out in a single I2C transaction.
+{
+	if (!m_queue.writeBurst(reg_num,vals,count))
 	{
-		my_error("SGTL5000::write(0x%04x,%0x%04x) failure",reg_num,val);
+		defer_error("SGTL5000::writeBurst(0x%04x,%d) queue failure",reg_num,count);
 		return false;
 	}
-	if (reg_num == CHIP_ANA_CTRL)
-		m_ana_ctrl = val;
+	for (uint8_t i=0; i<count; i++)
+		m_shadow[(reg_num >> 1) + i] = vals[i];
 	return true;
 }
 
 bool SGTL5000::modify(uint16_t reg_num, uint16_t val, uint16_t mask)
 {
-	uint16_t cur = read(reg_num);
+	uint16_t cur = shadow(reg_num);
 	cur &= ~mask;
 	cur |= val;
 	if (!write(reg_num,cur)) return false;
@@ -843,12 +1000,19 @@ bool SGTL5000::setDefaults()
 
 	#define TEST_GUITAR_VALUES   1
 
+	// mute the sound
+
 	bool retval =
+		setMuteHeadphone(1) &&
+		setMuteLineOut(1);
+	m_queue.fence();
+	initPeq();
 
-		// mute the sound
+	uint16_t save_rate = m_ramp_rate;
+	setRampRate(0);
+		// everything immediate while muted
 
-		setMuteHeadphone(1) &&
-		setMuteLineOut(1) &&
+	retval = retval &&
 
 		// set a bunch of stuff
 
@@ -877,15 +1041,20 @@ bool SGTL5000::setDefaults()
 		setEqBand(3,15,true) &&                 // same as reset
 		setEqBand(4,15,true) &&                 // same as reset
 		setAutoVolumeEnable(0) &&				// same as reset; not supported by midi
+		setPeqCount(0) &&						// same as reset
 
 		#if TEST_GUITAR_LEVELS
 			setLineInLevel(7) &&					// my default
-			setLineOutLevel(18) &&					// my default
+			setLineOutLevel(18);					// my default
 		#else
 			setMuteHeadphone(0);
 		#endif
 
-		// unmute the sound
+	// unmute the sound
+
+	setRampRate(save_rate);
+	m_queue.fence();
+	retval = retval &&
 		setMuteLineOut(0);					// same as reset/enable()
 
 
@@ -903,13 +1072,13 @@ bool SGTL5000::setInput(uint8_t val)
 {
 	display(dbg_api,"SGTL5000::setInput(%d)",val);
 	if (val == SGTL_INPUT_MIC)			// 1 = AUDIO_INPUT_MIC
-		return write(CHIP_ANA_CTRL, m_ana_ctrl & ~(1<<2)); // enable mic
+		return write(CHIP_ANA_CTRL, shadow(CHIP_ANA_CTRL) & ~(1<<2)); // enable mic
 	else // if (n == SGTL_INPUT_LINEIN)	// 0 = AUDIO_INPUT_LINEIN
-		return write(CHIP_ANA_CTRL, m_ana_ctrl | (1<<2)); // enable linein
+		return write(CHIP_ANA_CTRL, shadow(CHIP_ANA_CTRL) | (1<<2)); // enable linein
 }
 uint8_t SGTL5000::getInput()
 {
-	return (m_ana_ctrl & (1<<2)) ?
+	return (shadow(CHIP_ANA_CTRL) & (1<<2)) ?
 		SGTL_INPUT_LINEIN :
 		SGTL_INPUT_MIC;
 }
@@ -924,7 +1093,7 @@ bool SGTL5000::setMicGain(uint8_t val)
 }
 uint8_t SGTL5000::getMicGain()
 {
-	return read(CHIP_MIC_CTRL) & 0x3;
+	return shadow(CHIP_MIC_CTRL) & 0x3;
 }
 
 
@@ -959,11 +1128,11 @@ bool SGTL5000::setLineInLevelRight(uint8_t val)
 }
 uint8_t SGTL5000::getLineInLevelLeft()
 {
-	return read(CHIP_ANA_ADC_CTRL) & 0xf;
+	return shadow(CHIP_ANA_ADC_CTRL) & 0xf;
 }
 uint8_t SGTL5000::getLineInLevelRight()
 {
-	return (read(CHIP_ANA_ADC_CTRL) & 0xf0) >> 4;
+	return (shadow(CHIP_ANA_ADC_CTRL) & 0xf0) >> 4;
 }
 
 
@@ -974,7 +1143,7 @@ bool SGTL5000::setDacVolumeLeft(uint8_t val)
 	// and explicitly set 127 to 0xFC
 {
 	display(dbg_api,"SGTL5000::setDacVolumeLeft(%d)",val);
-	//	uint16_t adcdac = read(CHIP_ADCDAC_CTRL);
+	//	uint16_t adcdac = shadow(CHIP_ADCDAC_CTRL);
 	//	uint16_t dac_mute = adcdac & (1 << 2);
 	//		// pull the left DAC_MUTE bit out of CHIP_ADCDAC_CTRL
 	//	uint16_t should_mute = val == 127 ? 0 : 1 << 2;
@@ -985,15 +1154,12 @@ bool SGTL5000::setDacVolumeLeft(uint8_t val)
 	//	else
 
 	val += 0x3C;
-	return modify(CHIP_DAC_VOL,val,0xff);
-
-
-
+	return setRamp(RAMP_DAC_LEFT,val);
 }
 bool SGTL5000::setDacVolumeRight(uint8_t val)
 {
 	// display(dbg_api,"SGTL5000::setDacVolumeRight(%d)",val);
-	// uint16_t adcdac = read(CHIP_ADCDAC_CTRL);
+	// uint16_t adcdac = shadow(CHIP_ADCDAC_CTRL);
 	// uint16_t dac_mute = adcdac & (2 << 2);
 	// 	// pull the right DAC_MUTE bit out of CHIP_ADCDAC_CTRL
 	// uint16_t should_mute = val == 127 ? 0 : 2 << 2;
@@ -1003,18 +1169,18 @@ bool SGTL5000::setDacVolumeRight(uint8_t val)
 	// 	val = 0xFC;
 	// else
 	val += 0x3C;
-	return modify(CHIP_DAC_VOL,val<<8,0xff00);
+	return setRamp(RAMP_DAC_RIGHT,val);
 }
 uint8_t SGTL5000::getDacVolumeLeft()
 {
-	uint16_t val = read(CHIP_DAC_VOL) & 0xff;
+	uint16_t val = getRamp(RAMP_DAC_LEFT);
 	// if (val == 0xFC)
 	//	return 127;
 	return val - 0x3C;
 }
 uint8_t SGTL5000::getDacVolumeRight()
 {
-	uint16_t val = (read(CHIP_DAC_VOL) >> 8) & 0xff;
+	uint16_t val = getRamp(RAMP_DAC_RIGHT);
 	// if (val == 0xFC)
 	//	return 127;
 	return val - 0x3C;
@@ -1033,7 +1199,7 @@ bool SGTL5000::setDacVolumeRamp(uint8_t val)
 }
 uint8_t SGTL5000::getDacVolumeRamp()
 {
-	uint16_t val = read(CHIP_ADCDAC_CTRL) & 0x300;
+	uint16_t val = shadow(CHIP_ADCDAC_CTRL) & 0x300;
 	return
 		val == 0x300 ? DAC_VOLUME_RAMP_EXPONENTIAL :
 		val == 0x200 ? DAC_VOLUME_RAMP_LINEAR :
@@ -1086,7 +1252,7 @@ bool SGTL5000::setLineOutLevelLeft(uint8_t val)
 		if (val > 18) val = 18;
 	#endif
 	val = 31-val;
-	return modify(CHIP_LINE_OUT_VOL,val,31);
+	return setRamp(RAMP_LINEOUT_LEFT,val);
 }
 bool SGTL5000::setLineOutLevelRight(uint8_t val)
 {
@@ -1100,15 +1266,15 @@ bool SGTL5000::setLineOutLevelRight(uint8_t val)
 	#endif
 	
 	val = 31-val;
-	return modify(CHIP_LINE_OUT_VOL,val<<8,31<<8);
+	return setRamp(RAMP_LINEOUT_RIGHT,val);
 }
 uint8_t SGTL5000::getLineOutLevelLeft()
 {
-	return 31-(read(CHIP_LINE_OUT_VOL) & 31);
+	return 31 - getRamp(RAMP_LINEOUT_LEFT);
 }
 uint8_t SGTL5000::getLineOutLevelRight()
 {
-	return 31 - ((read(CHIP_LINE_OUT_VOL) >> 8) & 31);
+	return 31 - getRamp(RAMP_LINEOUT_RIGHT);
 }
 
 
@@ -1116,13 +1282,13 @@ bool SGTL5000::setHeadphoneSelect(uint8_t val)
 {
 	display(dbg_api,"SGTL5000::setHeadphoneSelect(%d)",val);
 	if (val == HEADPHONE_LINEIN)		// bypass route LINE_IN to headphone
-		return write(CHIP_ANA_CTRL, m_ana_ctrl | (1<<6));
+		return write(CHIP_ANA_CTRL, shadow(CHIP_ANA_CTRL) | (1<<6));
 	else // (val == HEADPHONE_NORMAL)	// route DAC to headphone
-		return write(CHIP_ANA_CTRL, m_ana_ctrl & ~(1<<6));
+		return write(CHIP_ANA_CTRL, shadow(CHIP_ANA_CTRL) & ~(1<<6));
 }
 uint8_t SGTL5000::getHeadphoneSelect()
 {
-	return m_ana_ctrl & (1<<6) ?
+	return shadow(CHIP_ANA_CTRL) & (1<<6) ?
 		HEADPHONE_LINEIN :
 		HEADPHONE_NORMAL;
 }
@@ -1135,7 +1301,7 @@ bool SGTL5000::setHeadphoneVolumeLeft(uint8_t val)	// 0..127
 	//	setMuteHeadphone(0);
 	if (val > 0x7f) val = 0x7f;
 	val = 0x7f - val;
-	return modify(CHIP_ANA_HP_CTRL, val, 0x7f);
+	return setRamp(RAMP_HP_LEFT,val);
 }
 bool SGTL5000::setHeadphoneVolumeRight(uint8_t val)	// 0..127
 {
@@ -1144,15 +1310,15 @@ bool SGTL5000::setHeadphoneVolumeRight(uint8_t val)	// 0..127
 	//	setMuteHeadphone(0);
 	if (val > 0x7f) val = 0x7f;
 	val = 0x7f - val;
-	return modify(CHIP_ANA_HP_CTRL, val << 8, 0x7f << 8);
+	return setRamp(RAMP_HP_RIGHT,val);
 }
 uint8_t SGTL5000::getHeadphoneVolumeLeft()
 {
-	return 0x7f-(read(CHIP_ANA_HP_CTRL) & 0x7f);
+	return 0x7f - getRamp(RAMP_HP_LEFT);
 }
 uint8_t SGTL5000::getHeadphoneVolumeRight()
 {
-	return 0x7f-((read(CHIP_ANA_HP_CTRL) >> 8) & 0x7f);
+	return 0x7f - getRamp(RAMP_HP_RIGHT);
 }
 
 
@@ -1162,15 +1328,15 @@ bool SGTL5000::setMuteHeadphone(uint8_t mute)
 	display(dbg_api,"SGTL5000::setMuteHeadphone(%d)",mute);
 	bool rslt;
 	if (mute)
-		rslt = write(CHIP_ANA_CTRL, m_ana_ctrl | (1<<4));
+		rslt = write(CHIP_ANA_CTRL, shadow(CHIP_ANA_CTRL) | (1<<4));
 	else
-		rslt = write(CHIP_ANA_CTRL, m_ana_ctrl & ~(1<<4));
+		rslt = write(CHIP_ANA_CTRL, shadow(CHIP_ANA_CTRL) & ~(1<<4));
 	m_hp_muted = mute;
 	return rslt;
 }
 uint8_t SGTL5000::getMuteHeadphone()
 {
-	return m_ana_ctrl & (1<<4) ? 1 : 0;
+	return shadow(CHIP_ANA_CTRL) & (1<<4) ? 1 : 0;
 }
 
 
@@ -1179,15 +1345,15 @@ bool SGTL5000::setMuteLineOut(uint8_t mute)
 	display(dbg_api,"SGTL5000::setMuteLineOut(%d)",mute);
 	bool rslt;
 	if (mute)
-		rslt = write(CHIP_ANA_CTRL, m_ana_ctrl | (1<<8));
+		rslt = write(CHIP_ANA_CTRL, shadow(CHIP_ANA_CTRL) | (1<<8));
 	else
-		rslt = write(CHIP_ANA_CTRL, m_ana_ctrl & ~(1<<8));
+		rslt = write(CHIP_ANA_CTRL, shadow(CHIP_ANA_CTRL) & ~(1<<8));
 	m_lineout_muted = mute;
 	return rslt;
 }
 uint8_t SGTL5000::getMuteLineOut()
 {
-	return m_ana_ctrl & (1<<8) ? 1 : 0;
+	return shadow(CHIP_ANA_CTRL) & (1<<8) ? 1 : 0;
 }
 
 
@@ -1205,7 +1371,7 @@ bool SGTL5000::setAdcHighPassFilter(uint8_t val)
 }
 uint8_t SGTL5000::getAdcHighPassFilter()
 {
-	uint16_t val = read(CHIP_ADCDAC_CTRL)  & 0x3;
+	uint16_t val = shadow(CHIP_ADCDAC_CTRL)  & 0x3;
 	if (val == 3)
 		return ADC_HIGH_PASS_DISABLE;
 	if (val == 2)
@@ -1239,6 +1405,9 @@ bool SGTL5000::setDapEnable(uint8_t val)
 		setMuteHeadphone(1);
 	if (!m_lineout_muted)
 		setMuteLineOut(1);
+	m_queue.fence();
+		// so the unmute below does not get merged
+		// into the mute, which would defeat the purpose
 	bool result = false;
 
 	if (val == DAP_ENABLE_POST)
@@ -1258,6 +1427,7 @@ bool SGTL5000::setDapEnable(uint8_t val)
 			// 0xnnn0 = ADC    --> I2S_OUT
 			// 0xnn1n = ISS_IN --> DAC
 
+	m_queue.fence();
 	if (save_hp_mute != m_hp_muted)
 		setMuteHeadphone(save_hp_mute);
 	if (save_lineout_mute != m_lineout_muted)
@@ -1268,8 +1438,8 @@ bool SGTL5000::setDapEnable(uint8_t val)
 }
 uint8_t SGTL5000::getDapEnable()
 {
-	uint16_t dap_control = read(DAP_CONTROL);
-	uint16_t sss_control = read(CHIP_SSS_CTRL);
+	uint16_t dap_control = shadow(DAP_CONTROL);
+	uint16_t sss_control = shadow(CHIP_SSS_CTRL);
 	if (!dap_control)
 		return DAP_DISABLE;
 	if ((sss_control & 0x0013) == 0x0013)
@@ -1324,7 +1494,7 @@ bool SGTL5000::setAutoVolumeControl(uint8_t maxGain, uint8_t lbiResponse, uint8_
 	// floating point figure is dB/s rate at which gain is reduced
 
 {
-	// if(m_semi_automated&&(!read(DAP_CONTROL)&1)) audioProcessorEnable();
+	// if(m_semi_automated&&(!shadow(DAP_CONTROL)&1)) audioProcessorEnable();
 
 	display(dbg_api,"SGTL5000::setAutoVolumeControl(%d,%d,%d,%0.3f,%0.3f,0.3f)",
 			maxGain,lbiResponse,hardLimit,threshold,attack,decay);
@@ -1361,8 +1531,8 @@ bool SGTL5000::setAutoVolumeControl(uint8_t maxGain, uint8_t lbiResponse, uint8_
 		// How this all plays out is not clear to me.
 		// Most guitar compressors use a "ratio"
 
-	uint8_t att=(1-pow(10,-(attack/(20*44100))))*pow(2,19);
-	uint8_t dec=(1-pow(10,-(decay/(20*44100))))*pow(2,23);
+	uint8_t att=(1-pow(10,-(attack/(20*AUDIO_SAMPLE_RATE_EXACT))))*pow(2,19);
+	uint8_t dec=(1-pow(10,-(decay/(20*AUDIO_SAMPLE_RATE_EXACT))))*pow(2,23);
 		// I am afraid to change these to uint16_ts.
 		// The register values are 11 bits.
 		// Gonna leave it for now.
@@ -1402,7 +1572,7 @@ bool SGTL5000::setSurroundWidth(uint8_t width)
 
 uint8_t SGTL5000::getSurroundEnable()
 {
-	uint16_t val = read(DAP_SGTL_SURROUND) & 0x3;
+	uint16_t val = shadow(DAP_SGTL_SURROUND) & 0x3;
 	if (val == 3)
 		return SURROUND_STEREO;
 	if (val == 2)
@@ -1411,7 +1581,7 @@ uint8_t SGTL5000::getSurroundEnable()
 }
 uint8_t SGTL5000::getSurroundWidth()
 {
-	return (read(DAP_SGTL_SURROUND)>>4) & 0x7;
+	return (shadow(DAP_SGTL_SURROUND)>>4) & 0x7;
 }
 
 
@@ -1446,28 +1616,28 @@ bool SGTL5000::setBassEnhanceVolume(uint8_t val)
 {
 	display(dbg_api,"SGTL5000::setBassEnhanceVolume(%d)",val);
 	if (val > 0x3f) val = 0x3f;
-	return modify(DAP_BASS_ENHANCE_CTRL, (0x3f-val)<<8, 0x3f<<8);
+	return setRamp(RAMP_BASS_VOLUME,0x3f-val);
 }
 
 uint8_t SGTL5000::getEnableBassEnhance()
 {
-	return read(DAP_BASS_ENHANCE) & 1;
+	return shadow(DAP_BASS_ENHANCE) & 1;
 }
 uint8_t SGTL5000::getEnableBassEnhanceCutoff()
 {
-	return (read(DAP_BASS_ENHANCE) >> 8) & 1;
+	return (shadow(DAP_BASS_ENHANCE) >> 8) & 1;
 }
 uint8_t SGTL5000::getBassEnhanceCutoff()
 {
-	return (read(DAP_BASS_ENHANCE) >> 4) & 0x7;
+	return (shadow(DAP_BASS_ENHANCE) >> 4) & 0x7;
 }
 uint8_t SGTL5000::getBassEnhanceBoost()
 {
-	return 0x7f - (read(DAP_BASS_ENHANCE_CTRL) & 0x7f);
+	return 0x7f - (shadow(DAP_BASS_ENHANCE_CTRL) & 0x7f);
 }
 uint8_t SGTL5000::getBassEnhanceVolume()
 {
-	return 0x3f-((read(DAP_BASS_ENHANCE_CTRL) >> 8) & 0x3f);
+	return 0x3f - getRamp(RAMP_BASS_VOLUME);
 }
 
 
@@ -1490,7 +1660,7 @@ bool SGTL5000::setEqSelect(uint8_t val)
 }
 uint8_t SGTL5000::getEqSelect()
 {
-	return read(DAP_AUDIO_EQ) & 0x3;
+	return shadow(DAP_AUDIO_EQ) & 0x3;
 }
 
 
@@ -1498,10 +1668,6 @@ uint8_t SGTL5000::getEqSelect()
 // 		works with loop() automation
 // Note that client must call setEnableDap() and
 //		setEqSelect(2 or 3) before calling this method.
-// assumes that m_band_value[5] is correct.
-
-#define AUTOMATION_BUSY  (1 << 6)	// 6th bit
-#define AUTIMATION_MASK	 (0x1f)		// 1st 5 bits
 
 bool SGTL5000::setEqBand(uint8_t band_num, uint8_t val, bool force /* = 0 */)	// 0..95 (0x5F)
 	// for ToneControl use 0 and 4
@@ -1509,84 +1675,386 @@ bool SGTL5000::setEqBand(uint8_t band_num, uint8_t val, bool force /* = 0 */)	//
 	// Sets EQ band gain from -11.75db to +12db in 0.25db steps.
 	// reset default is 47 (0x2f) = 0 db
 {
-	display(dbg_api,"SGTL5000::setEqBand(%d,%d)",band_num,val);
-	proc_entry();
-
+	defer_display(dbg_api,"SGTL5000::setEqBand(%d,%d)",band_num,val);
 	if (val > 0x5f) val = 0x5f;
-	m_band_target[band_num] = val;
 	if (force)
 	{
-		m_band_value[band_num] = val;
-		write(DAP_AUDIO_EQ_BASS_BAND0+(band_num*2),val);
+		m_ramp_active &= ~(1 << (RAMP_EQ_BAND0 + band_num));
+		return write(DAP_AUDIO_EQ_BASS_BAND0+(band_num*2),val);
 	}
-	else
+	return setRamp(RAMP_EQ_BAND0 + band_num, val);
+}
+uint8_t SGTL5000::getEqBand(uint8_t band_num)
+{
+	return getRamp(RAMP_EQ_BAND0 + band_num) & 0x5f;
+}
+
+
+
+//-------------------------------------------
+// ramp scheduler
+//-------------------------------------------
+// Every ramped thing earns "credit" in milli-dB at m_ramp_rate for
+// the microseconds since it was last looked at, and spends it in
+// steps of no more than 0.5db per write.  So the ramp speed does not
+// depend on how often loop() is called, and a ramp that does not get
+// a turn (because of the write cap) just moves a bigger step, up to
+// 0.5db, the next time.
+
+static const sgtlRampDef_t *rampDef(uint8_t ramp);
+	// the register field, from the CC descriptor table below
+
+#define RAMP_MAX_STEP_MDB		500
+	// the biggest step per write, and the most credit we keep
+#define RAMP_MAX_ELAPSED_US		100000
+	// so the credit math cannot overflow
+#define RAMP_PEQ_WRITES			3
+	// I2C transactions in one PEQ step
+
+static_assert(RAMP_PEQ_WRITES <= SGTL_RAMP_MAX_WRITES,
+	"a PEQ step would never fit in one pass of runRamps()");
+
+
+void SGTL5000::setRampRate(uint16_t mdb_per_ms)
+{
+	display(dbg_api,"SGTL5000::setRampRate(%d)",mdb_per_ms);
+	m_ramp_rate = mdb_per_ms;
+	if (!m_ramp_rate)
 	{
-		m_in_automation |= (1 << band_num);
-		if (!(m_in_automation & AUTOMATION_BUSY))
+		// finish everything right now
+
+		for (uint8_t i=0; i<NUM_RAMPS; i++)
+		{
+			if (m_ramp_active & (1<<i))
+				setRamp(i,m_ramp_target[i]);
+		}
+		for (uint8_t i=0; i<SGTL_PEQ_FILTERS; i++)
 		{
-			m_in_automation |= AUTOMATION_BUSY;
-			handleEqAutomation(band_num);
-			m_in_automation &= ~AUTOMATION_BUSY;
+			if (m_ramp_active & (1<<(NUM_RAMPS+i)))
+			{
+				memcpy(m_peq_value[i],m_peq_target[i],PEQ_NUM_PARAMS);
+				loadPeqFilter(i);
+			}
 		}
+		m_ramp_active = 0;
 	}
-	
-	proc_leave();
-	return 1;
 }
-uint8_t SGTL5000::getEqBand(uint8_t band_num)
+
+
+void SGTL5000::startRamp(uint8_t item)
+{
+	if (!(m_ramp_active & (1<<item)))
+	{
+		m_ramp_credit[item] = 0;
+		m_ramp_time[item] = micros();
+		m_ramp_active |= (1<<item);
+	}
+}
+
+
+bool SGTL5000::setRamp(uint8_t ramp, uint8_t field)
+{
+	const sgtlRampDef_t *def = rampDef(ramp);
+	m_ramp_target[ramp] = field;
+	if (!m_ramp_rate)
+	{
+		m_ramp_active &= ~(1<<ramp);
+		return modify(def->reg, field << def->shift, def->mask << def->shift);
+	}
+	if (field != ((shadow(def->reg) >> def->shift) & def->mask))
+		startRamp(ramp);
+	return true;
+}
+
+
+uint8_t SGTL5000::getRamp(uint8_t ramp)
 {
-	return read(DAP_AUDIO_EQ_BASS_BAND0+(band_num*2)) & 0x5f;
+	const sgtlRampDef_t *def = rampDef(ramp);
+	if (m_ramp_active & (1<<ramp))
+		return m_ramp_target[ramp];
+	return (shadow(def->reg) >> def->shift) & def->mask;
 }
 
 
+bool SGTL5000::handleRamp(uint8_t ramp, uint32_t credit)
+{
+	const sgtlRampDef_t *def = rampDef(ramp);
+	int cur = (shadow(def->reg) >> def->shift) & def->mask;
+	int desired = m_ramp_target[ramp];
+	int step = credit / def->mdb;
+	m_ramp_credit[ramp] = credit - step * def->mdb;
+
+	if (desired - cur > step)
+		cur += step;
+	else if (desired - cur < -step)
+		cur -= step;
+	else
+		cur = desired;
+
+	defer_display(dbg_auto,"SGTL5000::handleRamp(%d) desired(%d) set(%d)",ramp,desired,cur);
+	modify(def->reg, cur << def->shift, def->mask << def->shift);
+	return cur == desired;
+}
+
 
-void SGTL5000::handleEqAutomation(uint8_t band_num)
-	// returns true if automation should continue
-	// no good way to return a write failure
+void SGTL5000::runRamps()
+	// Round robin through everything that is ramping, spending
+	// at most SGTL_AUTOMATION_US and SGTL_RAMP_MAX_WRITES per pass.
+	// We wait for the queue to empty between passes, otherwise
+	// the steps would just pile up (or coalesce) in the queue.
+	// An item whose writes do not fit in what is left of the cap
+	// keeps its credit, and goes first in the next pass.
 {
-	int desired = m_band_target[band_num];
-	int cur = m_band_value[band_num];
+	if (!m_ramp_active || !m_queue.idle())
+		return;
+
+	defer_display(dbg_auto,"SGTL5000::runRamps() active(%05x)",m_ramp_active);
+	proc_entry();
 
-	if (desired - cur > 2)
+	uint32_t start = micros();
+	uint8_t writes = 0;
+	int skipped = -1;
+		// the first item that did not fit
+	for (uint8_t n=0; n<NUM_RAMP_ITEMS && writes<SGTL_RAMP_MAX_WRITES; n++)
 	{
-		display(dbg_auto,"SGTL5000::handleEqAutomation band(%d) desired(%d) cur(%d) set(%d)",band_num,desired,cur,cur+2);
-		cur = cur + 2;
+		uint32_t now = micros();
+		if (now - start >= SGTL_AUTOMATION_US)
+			break;
+
+		uint8_t item = m_ramp_next;
+		m_ramp_next = (m_ramp_next + 1) % NUM_RAMP_ITEMS;
+		if (!(m_ramp_active & (1<<item)))
+			continue;
+
+		uint8_t cost = item < NUM_RAMPS ? 1 : RAMP_PEQ_WRITES;
+		if (writes + cost > SGTL_RAMP_MAX_WRITES)
+		{
+			if (skipped < 0)
+				skipped = item;
+			continue;
+		}
+
+		uint32_t elapsed = now - m_ramp_time[item];
+		if (elapsed > RAMP_MAX_ELAPSED_US)
+			elapsed = RAMP_MAX_ELAPSED_US;
+		uint32_t credit = m_ramp_credit[item] + elapsed * m_ramp_rate / 1000;
+		if (credit > RAMP_MAX_STEP_MDB)
+			credit = RAMP_MAX_STEP_MDB;
+		m_ramp_time[item] = now;
+
+		bool done;
+		if (item < NUM_RAMPS)
+		{
+			if (credit < rampDef(item)->mdb)
+			{
+				m_ramp_credit[item] = credit;
+				continue;
+			}
+			done = handleRamp(item,credit);
+		}
+		else
+		{
+			// a PEQ step is up to 0.5db, so it costs the
+			// full step, and RAMP_PEQ_WRITES transactions
+
+			if (credit < RAMP_MAX_STEP_MDB)
+			{
+				m_ramp_credit[item] = credit;
+				continue;
+			}
+			m_ramp_credit[item] = 0;
+			done = handlePeqAutomation(item - NUM_RAMPS);
+		}
+		writes += cost;
+
+		if (done)
+			m_ramp_active &= ~(1<<item);
 	}
-	else if (desired - cur < -2)
+
+	if (skipped >= 0)
+		m_ramp_next = skipped;
+	proc_leave();
+}
+
+
+
+void SGTL5000::loop()
+{
+	uint32_t errors = m_write_errors;
+	if (errors != m_errors_reported)
 	{
-		display(dbg_auto,"SGTL5000::handleEqAutomation band(%d) desired(%d) cur(%d) set(%d)",band_num,desired,cur,cur-2);
-		cur = cur - 2;
+		my_error("SGTL5000 %d write failure(s), last reg(0x%04x) val(0x%04x)",
+			errors - m_errors_reported,
+			m_error_reg,
+			m_error_val);
+		m_errors_reported = errors;
 	}
-	else	// done with this band
+
+	runRamps();
+
+	if (m_scene_start && m_queue.idle())
 	{
-		display(dbg_auto,"SGTL5000::handleEqAutomation band(%d) desired(%d) cur(%d) done",band_num,desired,cur);
-		cur = desired;
-		m_in_automation &= ~(1<<band_num);
+		uint32_t us = micros() - m_scene_start;
+		m_scene_start = 0;
+		if (us > SCENE_BLOCK_US)
+			defer_warning(0,"SGTL5000 scene took %d us, more than an audio block",us);
+		else
+			defer_display(dbg_scene,"SGTL5000 scene took %d us",us);
 	}
+}
+
+
+
+//-------------------------------------------
+// PEQ MIDI support
+//-------------------------------------------
+
+#define PEQ_FREQ_STEP	1		// 1/127th of three decades, about 5.6%
+#define PEQ_GAIN_STEP	2		// 0.5db
+#define PEQ_Q_STEP		2
+
+static const uint8_t peq_default_freq[SGTL_PEQ_FILTERS] = { 10, 28, 46, 64, 82, 100, 118 };
+	// about 34Hz, 103Hz, 314Hz, 650Hz, 1.9kHz, 5.9kHz, 18kHz
+
+
+static float peqFreq(uint8_t val)
+	// lands exactly on a biquad table frequency, 20Hz..20kHz
+{
+	return biquad::freq_table.freq[(val * (BIQUAD_NUM_FREQS-1) + 63) / 127];
+}
+static float peqGain(uint8_t val)	{ return ((int) val - 64) * 0.25f; }
+static float peqQ(uint8_t val)		{ return (val + 1) * 0.1f; }
+
 
-	m_band_value[band_num] = cur;
-	write(DAP_AUDIO_EQ_BASS_BAND0+(band_num*2),cur);
+void SGTL5000::initPeq()
+	// flat PARAEQ filters at the default frequencies
+	// does not write to the chip
+{
+	for (uint8_t i=0; i<SGTL_PEQ_FILTERS; i++)
+	{
+		m_peq_target[i][PEQ_PARAM_TYPE] = FILTER_PARAEQ;
+		m_peq_target[i][PEQ_PARAM_FREQ] = peq_default_freq[i];
+		m_peq_target[i][PEQ_PARAM_GAIN] = 64;
+		m_peq_target[i][PEQ_PARAM_Q] = 6;
+	}
+	memcpy(m_peq_value,m_peq_target,sizeof(m_peq_value));
+	m_ramp_active &= ~(((1<<SGTL_PEQ_FILTERS)-1) << NUM_RAMPS);
 }
 
 
+void SGTL5000::loadPeqFilter(uint8_t filter_num)
+{
+	const uint8_t *p = m_peq_value[filter_num];
+	int coef[5];
+	calcBiquad(
+		p[PEQ_PARAM_TYPE],
+		peqFreq(p[PEQ_PARAM_FREQ]),
+		peqGain(p[PEQ_PARAM_GAIN]),
+		peqQ(p[PEQ_PARAM_Q]),
+		524288,
+		AUDIO_SAMPLE_RATE_EXACT,
+		coef);
+	eqFilter(filter_num,coef);
+}
 
-void SGTL5000::loop()
+
+bool SGTL5000::setPeqCount(uint8_t n)
 {
-	if ( (m_in_automation & AUTIMATION_MASK) &&
-		!(m_in_automation & AUTOMATION_BUSY))
+	display(dbg_api,"SGTL5000::setPeqCount(%d)",n);
+	if (n > SGTL_PEQ_FILTERS) n = SGTL_PEQ_FILTERS;
+
+	// filters that are not enabled are not automated,
+	// so bring them up to date before turning them on.
+
+	for (uint8_t i=getPeqCount(); i<n; i++)
 	{
-		display(dbg_auto,"SGTL5000::loop() m_in_automation(%04x)",m_in_automation);
-		proc_entry();
+		memcpy(m_peq_value[i],m_peq_target[i],PEQ_NUM_PARAMS);
+		m_ramp_active &= ~(1<<(NUM_RAMPS+i));
+		loadPeqFilter(i);
+	}
+	return eqFilterCount(n);
+}
 
-		m_in_automation |= AUTOMATION_BUSY;
-		for (uint8_t band_num=0; band_num<5; band_num++)
-		{
-			if (m_in_automation & (1<<band_num))
-				handleEqAutomation(band_num);
-		}
-		m_in_automation &= ~AUTOMATION_BUSY;
-		proc_leave();
+
+uint8_t SGTL5000::getPeqCount()
+{
+	return shadow(DAP_PEQ) & 7;
+}
+
+
+bool SGTL5000::setPeqParam(uint8_t filter_num, uint8_t param, uint8_t val)
+{
+	defer_display(dbg_api,"SGTL5000::setPeqParam(%d,%d,%d)",filter_num,param,val);
+	if (filter_num >= SGTL_PEQ_FILTERS || param >= PEQ_NUM_PARAMS)
+		return false;
+	if (val > 127) val = 127;
+	if (param == PEQ_PARAM_TYPE && val > FILTER_HISHELF)
+		val = FILTER_HISHELF;
+
+	m_peq_target[filter_num][param] = val;
+
+	if (filter_num >= getPeqCount() || !m_ramp_rate)
+	{
+		// not enabled, just remember it,
+		// or no ramping, load it now
+
+		memcpy(m_peq_value[filter_num],m_peq_target[filter_num],PEQ_NUM_PARAMS);
+		m_ramp_active &= ~(1<<(NUM_RAMPS+filter_num));
+		if (filter_num < getPeqCount())
+			loadPeqFilter(filter_num);
+		return true;
+	}
+	if (param == PEQ_PARAM_TYPE)
+	{
+		// a ramp between filter types makes no sense
+
+		m_peq_value[filter_num][param] = val;
+		loadPeqFilter(filter_num);
+		return true;
 	}
+
+	startRamp(NUM_RAMPS + filter_num);
+	return true;
+}
+
+
+uint8_t SGTL5000::getPeqParam(uint8_t filter_num, uint8_t param)
+{
+	if (filter_num >= SGTL_PEQ_FILTERS || param >= PEQ_NUM_PARAMS)
+		return 0;
+	return m_peq_target[filter_num][param];
+}
+
+
+static uint8_t stepToward(uint8_t cur, uint8_t target, uint8_t step)
+{
+	if (target > cur + step)
+		return cur + step;
+	if (target + step < cur)
+		return cur - step;
+	return target;
+}
+
+
+bool SGTL5000::handlePeqAutomation(uint8_t filter_num)
+	// one step of FREQ, GAIN, and Q per call,
+	// all in one coefficient load
+{
+	uint8_t *cur = m_peq_value[filter_num];
+	const uint8_t *target = m_peq_target[filter_num];
+
+	cur[PEQ_PARAM_FREQ] = stepToward(cur[PEQ_PARAM_FREQ],target[PEQ_PARAM_FREQ],PEQ_FREQ_STEP);
+	cur[PEQ_PARAM_GAIN] = stepToward(cur[PEQ_PARAM_GAIN],target[PEQ_PARAM_GAIN],PEQ_GAIN_STEP);
+	cur[PEQ_PARAM_Q] = stepToward(cur[PEQ_PARAM_Q],target[PEQ_PARAM_Q],PEQ_Q_STEP);
+
+	defer_display(dbg_auto,"SGTL5000::handlePeqAutomation(%d) freq(%d) gain(%d) q(%d)",
+		filter_num,
+		cur[PEQ_PARAM_FREQ],
+		cur[PEQ_PARAM_GAIN],
+		cur[PEQ_PARAM_Q]);
+
+	loadPeqFilter(filter_num);
+	return !memcmp(cur,target,PEQ_NUM_PARAMS);
 }
 
 
@@ -1601,22 +2069,100 @@ uint16_t SGTL5000::eqFilterCount(uint8_t n) // valid to n&7, 0 thru 7 filters en
 
 void SGTL5000::eqFilter(uint8_t filterNum, int *filterParameters)
 	// SGTL5000 PEQ Coefficient loader
+	//
+	// Each 20 bit coefficient is split into a 16 bit MSB and a 4 bit LSB
+	// register.  The registers are in two runs, B0 right after the
+	// COEF_ACCESS register, and B1..A2 after the AVC registers, so it
+	// takes three transactions: the index and B0, the other four
+	// coefficients, and the WR strobe.  It used to be eleven, plus a read.
 {
 	// TODO: add the part that selects 7 PEQ filters.
 	// if (m_semi_automated) automate(1,1,filterNum+1);
 
-	modify(DAP_FILTER_COEF_ACCESS,(uint16_t)filterNum,15);
-	write(DAP_COEF_WR_B0_MSB,(*filterParameters>>4)&65535);
-	write(DAP_COEF_WR_B0_LSB,(*filterParameters++)&15);
-	write(DAP_COEF_WR_B1_MSB,(*filterParameters>>4)&65535);
-	write(DAP_COEF_WR_B1_LSB,(*filterParameters++)&15);
-	write(DAP_COEF_WR_B2_MSB,(*filterParameters>>4)&65535);
-	write(DAP_COEF_WR_B2_LSB,(*filterParameters++)&15);
-	write(DAP_COEF_WR_A1_MSB,(*filterParameters>>4)&65535);
-	write(DAP_COEF_WR_A1_LSB,(*filterParameters++)&15);
-	write(DAP_COEF_WR_A2_MSB,(*filterParameters>>4)&65535);
-	write(DAP_COEF_WR_A2_LSB,(*filterParameters++)&15);
+	uint16_t vals[10];
+	for (uint8_t i=0; i<5; i++)
+	{
+		vals[i*2]   = (filterParameters[i] >> 4) & 65535;
+		vals[i*2+1] = filterParameters[i] & 15;
+	}
+
+	m_queue.fence();
+		// don't let these merge into a previous filter's writes
+
+	uint16_t first[3];
+	first[0] = (shadow(DAP_FILTER_COEF_ACCESS) & ~15) | filterNum;
+	first[1] = vals[0];
+	first[2] = vals[1];
+
+	writeBurst(DAP_FILTER_COEF_ACCESS,first,3);		// 0x010C..0x0110
+	writeBurst(DAP_COEF_WR_B1_MSB,&vals[2],8);		// 0x012C..0x013A
 	write(DAP_FILTER_COEF_ACCESS,(uint16_t)0x100|filterNum);
+	m_queue.fence();
+}
+
+
+bool SGTL5000::loadPeqBank(const int coef[7][5])
+	// Switching a whole preset is 21 queued transactions that go
+	// out in the background, about 20ms at Wire's default 100kHz
+	// versus 80ms (all blocking) before.  The filters
+	// are swapped one by one while the audio keeps running.
+{
+	display(dbg_api,"SGTL5000::loadPeqBank()",0);
+	for (uint8_t i=0; i<7; i++)
+	{
+		int params[5];
+		memcpy(params,coef[i],sizeof(params));
+		eqFilter(i,params);
+	}
+	return eqFilterCount(7);
+}
+
+
+
+static bool lookupTrig(float fC, float *cosw, float *sinw)
+	// binary search the log spaced frequency table and interpolate
+	// returns false if fC is outside of 20Hz..20kHz
+{
+	const float *freq = biquad::freq_table.freq;
+	if (fC < freq[0] || fC > freq[BIQUAD_NUM_FREQS-1])
+		return false;
+
+	int lo = 0;
+	int hi = BIQUAD_NUM_FREQS - 1;
+	while (hi - lo > 1)
+	{
+		int mid = (lo + hi) >> 1;
+		if (freq[mid] <= fC)
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	float frac = (fC - freq[lo]) / (freq[hi] - freq[lo]);
+	const float *c = biquad::freq_table.cos_w0;
+	const float *s = biquad::freq_table.sin_w0;
+	*cosw = c[lo] + frac * (c[hi] - c[lo]);
+	*sinw = s[lo] + frac * (s[hi] - s[lo]);
+	return true;
+}
+
+
+static bool lookupGain(float dB, float *A, float *sqrtA)
+	// 10^(dB/40) and 10^(dB/80) from the 0.5dB table
+	// returns false if dB is outside of -48..+48
+{
+	float pos = (dB - BIQUAD_MIN_DB) * BIQUAD_DB_STEPS;
+	if (pos < 0 || pos > BIQUAD_NUM_GAINS - 1)
+		return false;
+	int idx = (int) pos;
+	if (idx >= BIQUAD_NUM_GAINS - 1)
+		idx = BIQUAD_NUM_GAINS - 2;
+	float frac = pos - idx;
+	const float *a = biquad::gain_table.A;
+	const float *r = biquad::gain_table.sqrt_A;
+	*A = a[idx] + frac * (a[idx+1] - a[idx]);
+	*sqrtA = r[idx] + frac * (r[idx+1] - r[idx]);
+	return true;
 }
 
 
@@ -1630,20 +2176,38 @@ void SGTL5000::calcBiquad(uint8_t filtertype, float fC, float dB_Gain, float Q,
 	// before calling this routine with varying values the end user should check that those values are limited
 	// to valid results.
 
-	float A;
+	// prh - the sines, cosines, and powers come from the compile time
+	// tables in biquadTables.h, so at our sample rate this is all a
+	// few dozen float operations, including the divides by Q, A and a0.
+	// The slow original math is only used for other sample rates, or
+	// frequencies/gains outside of the tables.
+	// Note that only PARAEQ and the shelves use A, so it is always the
+	// dB/40 flavor from the table.
+
+	float A, sqrtA;
+	float cosw, sinw;
 	float b0,b1,b2,a0,a1,a2;
 
-	if (filtertype < FILTER_PARAEQ)
-		A = pow(10,dB_Gain/20);
-	else
-		A=pow(10,dB_Gain/40);
-	float W0 = 2*3.14159265358979323846*fC/fS;
-	float cosw = cosf(W0);
-	float sinw = sinf(W0);
+	bool table_rate = (uint32_t) fS == (uint32_t) AUDIO_SAMPLE_RATE_EXACT;
+	if (!table_rate || !lookupTrig(fC,&cosw,&sinw))
+	{
+		float W0 = 2*3.14159265358979323846*fC/fS;
+		cosw = cosf(W0);
+		sinw = sinf(W0);
+	}
+	if (!lookupGain(dB_Gain,&A,&sqrtA))
+	{
+		if (filtertype < FILTER_PARAEQ)
+			A = pow(10,dB_Gain/20);
+		else
+			A=pow(10,dB_Gain/40);
+		sqrtA = sqrtf(A);
+	}
+
 	//float alpha = sinw*sinh((log(2)/2)*BW*W0/sinw);
 	//float beta = sqrt(2*A);
 	float alpha = sinw / (2 * Q);
-	float beta = sqrtf(A)/Q;
+	float beta = sqrtA/Q;
 
 	switch(filtertype)
 	{
@@ -1726,24 +2290,182 @@ void SGTL5000::calcBiquad(uint8_t filtertype, float fC, float dB_Gain, float Q,
 }
 
 
+//-----------------------------
+// CC descriptor table
+//-----------------------------
+// One entry per CC, in any order.  The PEQ parameters are computed,
+// as (filter, param) from the CC number, so they are not in here.
+//
+// The CC_AUTO_RAMP CCs that own a register field also give the field,
+// and how many milli-dB each step of it is, which is all the ramp
+// scheduler knows about them.  The "both" setters are CC_AUTO_RAMP, so
+// they get coalesced, but have no field of their own.
+
+#define RW		0
+#define WO		CC_WRITE_ONLY
+#define CMD		(CC_WRITE_ONLY | CC_COMMAND)
+#define NONE	CC_AUTO_NONE
+#define RAMP	CC_AUTO_RAMP
+
+#define CC(cc, max, flags, aut, set, get) \
+	{ SGTL_CC_##cc, max, flags, aut, #cc, &SGTL5000::set, get, RAMP_NONE, { 0, 0, 0, 0 } }
+#define RAMPED(cc, max, flags, set, get, ramp, reg, shift, mask, mdb) \
+	{ SGTL_CC_##cc, max, flags, CC_AUTO_RAMP, #cc, &SGTL5000::set, get, RAMP_##ramp, { reg, shift, mask, mdb } }
+
+
+struct sgtlRampDefs
+	// the register field of each RAMP_XXX, built by the compiler
+	// from the table, and checking that each one is there once
+{
+	sgtlRampDef_t def[NUM_RAMPS];
+	bool valid;
+
+	template <int NUM_CCS>
+	constexpr sgtlRampDefs(const SGTL5000::ccDesc_t (&table)[NUM_CCS]) : def(), valid(true)
+	{
+		bool seen[NUM_RAMPS] = {};
+		for (int i=0; i<NUM_RAMPS; i++)
+			def[i] = { 0, 0, 0, 0 };
+		for (int i=0; i<NUM_CCS; i++)
+		{
+			uint8_t ramp = table[i].ramp;
+			if (ramp == RAMP_NONE)
+				continue;
+			if (ramp >= NUM_RAMPS || seen[ramp] ||
+				table[i].automation != CC_AUTO_RAMP)
+				valid = false;
+			else
+			{
+				seen[ramp] = true;
+				def[ramp] = table[i].field;
+			}
+		}
+		for (int i=0; i<NUM_RAMPS; i++)
+			if (!seen[i])
+				valid = false;
+	}
+};
+
+struct sgtlCCTable
+{
+	static constexpr SGTL5000::ccDesc_t table[] = {
+		CC(DUMP,					1,   CMD, NONE,	ccDump,					NULL),
+		CC(SET_DEFAULTS,			1,   CMD, NONE,	ccSetDefaults,			NULL),
+		CC(INPUT_SELECT,			1,   RW,  NONE,	setInput,				&SGTL5000::getInput),
+		CC(MIC_GAIN_,				3,   RW,  NONE,	setMicGain,				&SGTL5000::getMicGain),
+		CC(LINEIN_LEVEL,			15,  WO,  NONE,	setLineInLevel,			NULL),
+		CC(LINEIN_LEVEL_LEFT,		15,  RW,  NONE,	setLineInLevelLeft,		&SGTL5000::getLineInLevelLeft),
+		CC(LINEIN_LEVEL_RIGHT,		15,  RW,  NONE,	setLineInLevelRight,	&SGTL5000::getLineInLevelRight),
+		CC(DAC_VOLUME,				127, WO,  RAMP,	setDacVolume,			NULL),
+		RAMPED(DAC_VOLUME_LEFT,		127, RW,		setDacVolumeLeft,		&SGTL5000::getDacVolumeLeft,
+			DAC_LEFT,		CHIP_DAC_VOL,				0, 0xff, 500),
+		RAMPED(DAC_VOLUME_RIGHT,	127, RW,		setDacVolumeRight,		&SGTL5000::getDacVolumeRight,
+			DAC_RIGHT,		CHIP_DAC_VOL,				8, 0xff, 500),
+		CC(DAC_VOLUME_RAMP,			2,   RW,  NONE,	setDacVolumeRamp,		&SGTL5000::getDacVolumeRamp),
+		CC(LINEOUT_LEVEL,			31,  WO,  RAMP,	setLineOutLevel,		NULL),
+		RAMPED(LINEOUT_LEVEL_LEFT,	31,  RW,		setLineOutLevelLeft,	&SGTL5000::getLineOutLevelLeft,
+			LINEOUT_LEFT,	CHIP_LINE_OUT_VOL,			0, 0x1f, 500),
+		RAMPED(LINEOUT_LEVEL_RIGHT,	31,  RW,		setLineOutLevelRight,	&SGTL5000::getLineOutLevelRight,
+			LINEOUT_RIGHT,	CHIP_LINE_OUT_VOL,			8, 0x1f, 500),
+		CC(HP_SELECT,				1,   RW,  NONE,	setHeadphoneSelect,		&SGTL5000::getHeadphoneSelect),
+		CC(HP_VOLUME,				127, WO,  RAMP,	setHeadphoneVolume,		NULL),
+		RAMPED(HP_VOLUME_LEFT,		127, RW,		setHeadphoneVolumeLeft,	&SGTL5000::getHeadphoneVolumeLeft,
+			HP_LEFT,		CHIP_ANA_HP_CTRL,			0, 0x7f, 500),
+		RAMPED(HP_VOLUME_RIGHT,		127, RW,		setHeadphoneVolumeRight,&SGTL5000::getHeadphoneVolumeRight,
+			HP_RIGHT,		CHIP_ANA_HP_CTRL,			8, 0x7f, 500),
+		CC(MUTE_HP,					1,   RW,  NONE,	setMuteHeadphone,		&SGTL5000::getMuteHeadphone),
+		CC(MUTE_LINEOUT,			1,   RW,  NONE,	setMuteLineOut,			&SGTL5000::getMuteLineOut),
+		CC(ADC_HIGH_PASS,			2,   RW,  NONE,	setAdcHighPassFilter,	&SGTL5000::getAdcHighPassFilter),
+		CC(DAP_ENABLE,				2,   RW,  NONE,	setDapEnable,			&SGTL5000::getDapEnable),
+		CC(SURROUND_ENABLE,			2,   RW,  NONE,	setSurroundEnable,		&SGTL5000::getSurroundEnable),
+		CC(SURROUND_WIDTH,			7,   RW,  NONE,	setSurroundWidth,		&SGTL5000::getSurroundWidth),
+		CC(BASS_ENHANCE_ENABLE,		1,   RW,  NONE,	setEnableBassEnhance,	&SGTL5000::getEnableBassEnhance),
+		CC(BASS_CUTOFF_ENABLE,		1,   RW,  NONE,	setEnableBassEnhanceCutoff,	&SGTL5000::getEnableBassEnhanceCutoff),
+		CC(BASS_CUTOFF_FREQ,		6,   RW,  NONE,	setBassEnhanceCutoff,	&SGTL5000::getBassEnhanceCutoff),
+		CC(BASS_BOOST,				127, RW,  NONE,	setBassEnhanceBoost,	&SGTL5000::getBassEnhanceBoost),
+		RAMPED(BASS_VOLUME,			63,  RW,		setBassEnhanceVolume,	&SGTL5000::getBassEnhanceVolume,
+			BASS_VOLUME,	DAP_BASS_ENHANCE_CTRL,		8, 0x3f, 500),
+		CC(EQ_SELECT,				3,   RW,  NONE,	setEqSelect,			&SGTL5000::getEqSelect),
+		RAMPED(EQ_BAND0,			95,  RW,		ccSetEqBand0,			&SGTL5000::ccGetEqBand0,
+			EQ_BAND0,		DAP_AUDIO_EQ_BASS_BAND0,	0, 0x7f, 250),
+		RAMPED(EQ_BAND1,			95,  RW,		ccSetEqBand1,			&SGTL5000::ccGetEqBand1,
+			EQ_BAND0 + 1,	DAP_AUDIO_EQ_BAND1,			0, 0x7f, 250),
+		RAMPED(EQ_BAND2,			95,  RW,		ccSetEqBand2,			&SGTL5000::ccGetEqBand2,
+			EQ_BAND0 + 2,	DAP_AUDIO_EQ_BAND2,			0, 0x7f, 250),
+		RAMPED(EQ_BAND3,			95,  RW,		ccSetEqBand3,			&SGTL5000::ccGetEqBand3,
+			EQ_BAND0 + 3,	DAP_AUDIO_EQ_BAND3,			0, 0x7f, 250),
+		RAMPED(EQ_BAND4,			95,  RW,		ccSetEqBand4,			&SGTL5000::ccGetEqBand4,
+			EQ_BAND0 + 4,	DAP_AUDIO_EQ_TREBLE_BAND4,	0, 0x7f, 250),
+		CC(PEQ_COUNT,				7,   RW,  NONE,	setPeqCount,			&SGTL5000::getPeqCount),
+		CC(RAMP_RATE,				127, RW,  NONE,	ccSetRampRate,			&SGTL5000::ccGetRampRate),
+	};
+
+	static constexpr int num_ccs = sizeof(table) / sizeof(table[0]);
+	static constexpr ccIndex<num_ccs> index = ccIndex<num_ccs>(table);
+};
+
+constexpr SGTL5000::ccDesc_t sgtlCCTable::table[];
+constexpr ccIndex<sgtlCCTable::num_ccs> sgtlCCTable::index;
+
+static constexpr sgtlRampDefs ramp_fields(sgtlCCTable::table);
+
+static_assert(sgtlCCTable::index.valid,
+	"a CC is in the sgtl5000 CC table twice, or is not 0..127");
+static_assert(!sgtlCCTable::index.any(SGTL_CC_PEQ_TYPE(0), SGTL_CC_PEQ_MAX),
+	"the sgtl5000 CC table overlaps the PEQ CCs");
+static_assert(ramp_fields.valid,
+	"each RAMP_XXX must be given by exactly one CC_AUTO_RAMP CC");
+static_assert(SGTL_CC_PEQ_MAX <= 127 && SGTL_CC_LAST <= 127,
+	"the sgtl5000midiExt.h CCs go past 127");
+
+static const sgtlRampDef_t *rampDef(uint8_t ramp)
+{
+	return &ramp_fields.def[ramp];
+}
+
+#undef RW
+#undef WO
+#undef CMD
+#undef NONE
+#undef RAMP
+#undef CC
+#undef RAMPED
+
+
+static inline bool isPeqParamCC(uint8_t cc)
+{
+	return cc >= SGTL_CC_PEQ_TYPE(0) && cc <= SGTL_CC_PEQ_MAX;
+}
+
+
 //-------------------------------------------------
 // MIDI API
 //-------------------------------------------------
 
-
 void SGTL5000::dumpCCValues(const char *where)
 {
 	display(0,"sgtl CC values %s",where);
 	proc_entry();
-	for (uint8_t cc=SGTL_CC_BASE; cc<=SGTL_CC_MAX; cc++)
+	for (int i=0; i<sgtlCCTable::num_ccs; i++)
 	{
-		if (!sgtl5000_writeOnlyCC(cc))
+		const ccDesc_t *desc = &sgtlCCTable::table[i];
+		if (!(desc->flags & CC_WRITE_ONLY))
 		{
-			int val = getCC(cc);
-			display(0,"SGTL_CC(%-2d) = %-4d  %-20s max=%d",cc,val,sgtl5000_getCCName(cc),sgtl5000_getCCMax(cc));
+			int val = (this->*desc->get)();
+			display(0,"SGTL_CC(%-2d) = %-4d  %-20s max=%d",desc->cc,val,desc->name,desc->max);
 		}
-		else if (0)
-			display(0,"",0);
+	}
+
+	for (uint8_t i=0; i<SGTL_PEQ_FILTERS; i++)
+	{
+		display(0,"PEQ(%d) CC(%d..%d) type=%d freq=%d gain=%d q=%d",
+			i,
+			SGTL_CC_PEQ_TYPE(i),
+			SGTL_CC_PEQ_Q(i),
+			getPeqParam(i,PEQ_PARAM_TYPE),
+			getPeqParam(i,PEQ_PARAM_FREQ),
+			getPeqParam(i,PEQ_PARAM_GAIN),
+			getPeqParam(i,PEQ_PARAM_Q));
 	}
 	proc_leave();
 }
@@ -1751,96 +2473,176 @@ void SGTL5000::dumpCCValues(const char *where)
 
 bool SGTL5000::dispatchCC(uint8_t cc, uint8_t val)
 {
-	display(dbg_dispatch,"sgtl500 CC(%d) %s <= %d",cc,sgtl5000_getCCName(cc),val);
+	if (isPeqParamCC(cc))
+	{
+		defer_display(dbg_dispatch,"sgtl500 PEQ CC(%d) <= %d",cc,val);
+		uint8_t num = cc - SGTL_CC_PEQ_TYPE(0);
+		return setPeqParam(num / PEQ_NUM_PARAMS, num % PEQ_NUM_PARAMS, val);
+	}
 
-	switch (cc)
+	uint8_t idx = sgtlCCTable::index[cc];
+	if (idx == CC_NONE)
 	{
-		case SGTL_CC_DUMP					: dumpCCValues("from dump_sgtl command"); return 1;
-		case SGTL_CC_SET_DEFAULTS			: return setDefaults();
-		case SGTL_CC_INPUT_SELECT			: return setInput(val);
-		case SGTL_CC_MIC_GAIN_				: return setMicGain(val);
-		case SGTL_CC_LINEIN_LEVEL			: return setLineInLevel(val);
-		case SGTL_CC_LINEIN_LEVEL_LEFT		: return setLineInLevelLeft(val);
-		case SGTL_CC_LINEIN_LEVEL_RIGHT		: return setLineInLevelRight(val);
-		case SGTL_CC_DAC_VOLUME				: return setDacVolume(val);
-		case SGTL_CC_DAC_VOLUME_LEFT		: return setDacVolumeLeft(val);
-		case SGTL_CC_DAC_VOLUME_RIGHT		: return setDacVolumeRight(val);
-		case SGTL_CC_DAC_VOLUME_RAMP		: return setDacVolumeRamp(val);
-		case SGTL_CC_LINEOUT_LEVEL			: return setLineOutLevel(val);
-		case SGTL_CC_LINEOUT_LEVEL_LEFT		: return setLineOutLevelLeft(val);
-		case SGTL_CC_LINEOUT_LEVEL_RIGHT	: return setLineOutLevelRight(val);
-		case SGTL_CC_HP_SELECT				: return setHeadphoneSelect(val);
-		case SGTL_CC_HP_VOLUME				: return setHeadphoneVolume(val);
-		case SGTL_CC_HP_VOLUME_LEFT			: return setHeadphoneVolumeLeft(val);
-		case SGTL_CC_HP_VOLUME_RIGHT		: return setHeadphoneVolumeRight(val);
-		case SGTL_CC_MUTE_HP				: return setMuteHeadphone(val);
-		case SGTL_CC_MUTE_LINEOUT			: return setMuteLineOut(val);
-		case SGTL_CC_ADC_HIGH_PASS			: return setAdcHighPassFilter(val);
-		case SGTL_CC_DAP_ENABLE				: return setDapEnable(val);
-		case SGTL_CC_SURROUND_ENABLE		: return setSurroundEnable(val);
-		case SGTL_CC_SURROUND_WIDTH			: return setSurroundWidth(val);
-		case SGTL_CC_BASS_ENHANCE_ENABLE	: return setEnableBassEnhance(val);
-		case SGTL_CC_BASS_CUTOFF_ENABLE		: return setEnableBassEnhanceCutoff(val);
-		case SGTL_CC_BASS_CUTOFF_FREQ		: return setBassEnhanceCutoff(val);
-		case SGTL_CC_BASS_BOOST				: return setBassEnhanceBoost(val);
-		case SGTL_CC_BASS_VOLUME			: return setBassEnhanceVolume(val);
-		case SGTL_CC_EQ_SELECT				: return setEqSelect(val);
-		case SGTL_CC_EQ_BAND0				: return setEqBand(0,val);
-		case SGTL_CC_EQ_BAND1				: return setEqBand(1,val);
-		case SGTL_CC_EQ_BAND2				: return setEqBand(2,val);
-		case SGTL_CC_EQ_BAND3				: return setEqBand(3,val);
-		case SGTL_CC_EQ_BAND4				: return setEqBand(4,val);
+		defer_error("unknown dispatchCC(%d,%d)",cc,val);
+		return false;
 	}
 
-	my_error("unknown dispatchCC(%d,%d)",cc,val);
-	return false;
+	const ccDesc_t *desc = &sgtlCCTable::table[idx];
+	if (val > desc->max)
+	{
+		defer_warning(0,"sgtl5000 CC(%d) %s val(%d) > max(%d)",cc,desc->name,val,desc->max);
+		return false;
+	}
+	defer_display(dbg_dispatch,"sgtl500 CC(%d) %s <= %d",cc,desc->name,val);
+	return (this->*desc->set)(val);
 }
 
 
 int SGTL5000::getCC(uint8_t cc)
 {
-	int val = -1;
+	if (isPeqParamCC(cc))
+	{
+		uint8_t num = cc - SGTL_CC_PEQ_TYPE(0);
+		return getPeqParam(num / PEQ_NUM_PARAMS, num % PEQ_NUM_PARAMS);
+	}
+
+	uint8_t idx = sgtlCCTable::index[cc];
+	if (idx == CC_NONE)
+		return -1;
+	const ccDesc_t *desc = &sgtlCCTable::table[idx];
+	if (desc->flags & CC_WRITE_ONLY)
+		return 255;
+	return (this->*desc->get)();
+}
+
+
+bool SGTL5000::isContinuousCC(uint8_t cc)
+{
+	if (isPeqParamCC(cc))
+		return (cc - SGTL_CC_PEQ_TYPE(0)) % PEQ_NUM_PARAMS != PEQ_PARAM_TYPE;
+	uint8_t idx = sgtlCCTable::index[cc];
+	return idx != CC_NONE && sgtlCCTable::table[idx].automation != CC_AUTO_NONE;
+}
 
-	switch (cc)
+
+int SGTL5000::getCCMax(uint8_t cc)
+{
+	if (isPeqParamCC(cc))
 	{
-		case SGTL_CC_DUMP					: val = 255; 							break;
-		case SGTL_CC_SET_DEFAULTS			: val = 255; 							break;
-		case SGTL_CC_INPUT_SELECT			: val = getInput();						break;
-		case SGTL_CC_MIC_GAIN_				: val = getMicGain();	                break;
-		case SGTL_CC_LINEIN_LEVEL			: val = 255; 							break;
-		case SGTL_CC_LINEIN_LEVEL_LEFT		: val = getLineInLevelLeft();	        break;
-		case SGTL_CC_LINEIN_LEVEL_RIGHT		: val = getLineInLevelRight();	        break;
-		case SGTL_CC_DAC_VOLUME				: val = 255; 							break;
-		case SGTL_CC_DAC_VOLUME_LEFT		: val = getDacVolumeLeft();	            break;
-		case SGTL_CC_DAC_VOLUME_RIGHT		: val = getDacVolumeRight();	        break;
-		case SGTL_CC_DAC_VOLUME_RAMP		: val = getDacVolumeRamp();	            break;
-		case SGTL_CC_LINEOUT_LEVEL			: val = 255; 							break;
-		case SGTL_CC_LINEOUT_LEVEL_LEFT		: val = getLineOutLevelLeft();	        break;
-		case SGTL_CC_LINEOUT_LEVEL_RIGHT	: val = getLineOutLevelRight();	        break;
-		case SGTL_CC_HP_SELECT				: val = getHeadphoneSelect();	        break;
-		case SGTL_CC_HP_VOLUME				: val = 255; 							break;
-		case SGTL_CC_HP_VOLUME_LEFT			: val = getHeadphoneVolumeLeft();	    break;
-		case SGTL_CC_HP_VOLUME_RIGHT		: val = getHeadphoneVolumeRight();	    break;
-		case SGTL_CC_MUTE_HP				: val = getMuteHeadphone();	            break;
-		case SGTL_CC_MUTE_LINEOUT			: val = getMuteLineOut();	            break;
-		case SGTL_CC_ADC_HIGH_PASS			: val = getAdcHighPassFilter();	        break;
-		case SGTL_CC_DAP_ENABLE				: val = getDapEnable();	                break;
-		case SGTL_CC_SURROUND_ENABLE		: val = getSurroundEnable();	        break;
-		case SGTL_CC_SURROUND_WIDTH			: val = getSurroundWidth();	            break;
-		case SGTL_CC_BASS_ENHANCE_ENABLE	: val = getEnableBassEnhance();	        break;
-		case SGTL_CC_BASS_CUTOFF_ENABLE		: val = getEnableBassEnhanceCutoff();	break;
-		case SGTL_CC_BASS_CUTOFF_FREQ		: val = getBassEnhanceCutoff();	        break;
-		case SGTL_CC_BASS_BOOST				: val = getBassEnhanceBoost();	        break;
-		case SGTL_CC_BASS_VOLUME			: val = getBassEnhanceVolume();	        break;
-		case SGTL_CC_EQ_SELECT				: val = getEqSelect();	                break;
-		case SGTL_CC_EQ_BAND0				: val = getEqBand(0);	                break;
-		case SGTL_CC_EQ_BAND1				: val = getEqBand(1);	                break;
-		case SGTL_CC_EQ_BAND2				: val = getEqBand(2);	                break;
-		case SGTL_CC_EQ_BAND3				: val = getEqBand(3);	                break;
-		case SGTL_CC_EQ_BAND4				: val = getEqBand(4);	                break;
+		uint8_t num = cc - SGTL_CC_PEQ_TYPE(0);
+		return num % PEQ_NUM_PARAMS == PEQ_PARAM_TYPE ? FILTER_HISHELF : 127;
 	}
+	uint8_t idx = sgtlCCTable::index[cc];
+	return idx == CC_NONE ? -1 : sgtlCCTable::table[idx].max;
+}
 
-	return val;
+
+bool SGTL5000::isCommandCC(uint8_t cc)
+{
+	uint8_t idx = sgtlCCTable::index[cc];
+	return idx != CC_NONE && (sgtlCCTable::table[idx].flags & CC_COMMAND);
+}
+
+
+int SGTL5000::snapshotCCs(uint8_t *ccs, uint8_t *vals, int max_ccs)
+	// all from the shadow and our own state, no I2C
+{
+	int n = 0;
+	for (int i=0; i<sgtlCCTable::num_ccs && n<max_ccs; i++)
+	{
+		const ccDesc_t *desc = &sgtlCCTable::table[i];
+		if (desc->flags & CC_WRITE_ONLY)
+			continue;
+		ccs[n] = desc->cc;
+		vals[n++] = (this->*desc->get)();
+	}
+	for (uint8_t cc=SGTL_CC_PEQ_TYPE(0); cc<=SGTL_CC_PEQ_MAX && n<max_ccs; cc++)
+	{
+		ccs[n] = cc;
+		vals[n++] = getCC(cc);
+	}
+	return n;
+}
+
+
+
+
+//-------------------------------------------------
+// scene recall
+//-------------------------------------------------
+
+int SGTL5000::applyScene(const uint8_t *ccs, const uint8_t *vals, int count)
+{
+	// find what actually changed, mutes last, and the ramp
+	// rate after that, so it is not lost when the rate in
+	// force before the scene is put back
+
+	uint8_t changed[SGTL_SCENE_MAX_CCS];
+	int num_changed = 0;
+	bool hp_mute = m_hp_muted;
+	bool lineout_mute = m_lineout_muted;
+	int ramp_rate_val = -1;
+
+	for (int i=0; i<count; i++)
+	{
+		uint8_t cc = ccs[i];
+		int cur = getCC(cc);
+		if (cur < 0 || cur == 255 || cur == vals[i])
+			continue;
+		if (cc == SGTL_CC_MUTE_HP)
+			hp_mute = vals[i];
+		else if (cc == SGTL_CC_MUTE_LINEOUT)
+			lineout_mute = vals[i];
+		else if (cc == SGTL_CC_RAMP_RATE)
+			ramp_rate_val = vals[i];
+		else if (num_changed < SGTL_SCENE_MAX_CCS)
+			changed[num_changed++] = i;
+	}
+
+	bool mutes_changed = hp_mute != m_hp_muted || lineout_mute != m_lineout_muted;
+	bool rate_changed = ramp_rate_val >= 0;
+	int total = num_changed + mutes_changed + rate_changed;
+	if (!total)
+		return 0;
+
+	defer_display(dbg_scene,"SGTL5000 scene %d of %d CCs changed",total,count);
+	m_scene_start = micros();
+
+	if (num_changed)
+	{
+		// the mutes go out before anything jumps, including
+		// the ramps in progress, which setRampRate(0) finishes
+
+		if (!m_hp_muted)
+			setMuteHeadphone(1);
+		if (!m_lineout_muted)
+			setMuteLineOut(1);
+		m_queue.fence();
+
+		uint16_t ramp_rate = m_ramp_rate;
+		if (ramp_rate)
+			setRampRate(0);
+				// also makes the setters write immediately
+
+		for (int i=0; i<num_changed; i++)
+		{
+			uint8_t n = changed[i];
+			dispatchCC(ccs[n],vals[n]);
+		}
+
+		m_queue.fence();
+		setRampRate(ramp_rate);
+	}
+
+	if (rate_changed)
+		dispatchCC(SGTL_CC_RAMP_RATE,ramp_rate_val);
+
+	if (hp_mute != m_hp_muted)
+		setMuteHeadphone(hp_mute);
+	if (lineout_mute != m_lineout_muted)
+		setMuteLineOut(lineout_mute);
+
+	return total;
 }
 
 
@@ -12,12 +12,66 @@
 //
 // See sgtl5000midi.h for enumerated parameters and midi CC numbers
 		
+#pragma once
+
 #include <AudioStream.h>
 #include "AudioControl.h"
+#include "i2cQueue.h"
+#include "ccTable.h"
+#include "sgtl5000midiExt.h"
+	// the PEQ and RAMP_RATE CCs
 
 #define SGTL5000_I2C_ADDR_CS_NORMAL		0x0A  // CTRL_ADR0_CS pin low (normal configuration)
 #define SGTL5000_I2C_ADDR_CS_ALT		0x2A  // CTRL_ADR0_CS  pin high
 
+#define SGTL5000_NUM_REGS				(0x013C / 2)	// 16 bit registers 0x0000..0x013A
+
+#define SGTL_PLL_FREQ					((AUDIO_SAMPLE_RATE_EXACT > 90000 ? 2048.0l : 4096.0l) * AUDIO_SAMPLE_RATE_EXACT)
+	// default enable() pllFreq.  The PLL has to come out at 180.6336 MHz
+	// for 44.1 kHz, and at 196.608 MHz for both 48 and 96 kHz.
+
+
+// PEQ CCs in a filter, in order
+
+#define PEQ_PARAM_TYPE					0
+#define PEQ_PARAM_FREQ					1
+#define PEQ_PARAM_GAIN					2
+#define PEQ_PARAM_Q						3
+#define PEQ_NUM_PARAMS					4
+
+#define SGTL_AUTOMATION_US				250
+	// time budget for one pass of loop() automation
+#define SGTL_RAMP_MAX_WRITES			4
+	// most I2C transactions queued by one pass of loop() automation
+#define SGTL_RAMP_DEFAULT_RATE			100
+	// milli-dB per millisecond, 12dB takes 120ms
+
+// ramped register fields
+
+#define RAMP_EQ_BAND0					0		// ..4
+#define RAMP_DAC_LEFT					5
+#define RAMP_DAC_RIGHT					6
+#define RAMP_LINEOUT_LEFT				7
+#define RAMP_LINEOUT_RIGHT				8
+#define RAMP_HP_LEFT					9
+#define RAMP_HP_RIGHT					10
+#define RAMP_BASS_VOLUME				11
+#define NUM_RAMPS						12
+#define NUM_RAMP_ITEMS					(NUM_RAMPS + SGTL_PEQ_FILTERS)
+	// the PEQ filters are scheduled after the register ramps
+#define RAMP_NONE						0xff
+	// for CCs that do not own a ramped register field
+
+typedef struct
+{
+	uint16_t reg;
+	uint8_t shift;
+	uint8_t mask;
+	uint16_t mdb;
+		// milli-dB per field unit
+} sgtlRampDef_t;
+	// a ramped register field, from the CC descriptor table
+
 class SGTL5000 : public AudioControl
 	// Client may call setDefaults() for a reliable setup of reasonable values.
 	// Otherwise, client may call the the methods associated with the [bracketed] blocks.
@@ -33,12 +87,23 @@ class SGTL5000 : public AudioControl
 {
 public:
 
-	SGTL5000(void) : m_i2c_addr(SGTL5000_I2C_ADDR_CS_NORMAL)  {}
+	SGTL5000(void) :
+		m_i2c_addr(SGTL5000_I2C_ADDR_CS_NORMAL),
+		m_i2c_count(0),
+		m_i2c_fails(0),
+		m_i2c_max_cycles(0),
+		m_write_fxn(0),
+		m_write_obj(0),
+		m_write_errors(0),
+		m_error_reg(0),
+		m_error_val(0),
+		m_errors_reported(0),
+		m_scene_start(0) {}
 	void setAltAddress()  { m_i2c_addr = SGTL5000_I2C_ADDR_CS_ALT; }
 
 	bool enable(void) override;
 		// enable with the SGTL5000 as the master
-	bool enable(const unsigned extMCLK, const uint32_t pllFreq = (4096.0l * AUDIO_SAMPLE_RATE_EXACT) );
+	bool enable(const unsigned extMCLK, const uint32_t pllFreq = SGTL_PLL_FREQ);
 		// enable setting the teensy as the Master with given glock settings
 
 
@@ -48,6 +113,16 @@ public:
 		// says that to avoid clicks these registers must not
 		// be arbitrarily changed, but rather, only ramped up
 		// in 0.5db (increments of 2 in the uint8_t values).
+		// It also reports any failed (queued) register writes.
+		//
+		// The same scheduler ramps the DAC, line out, headphone
+		// and bass enhance volumes, and the PEQ filters, at the
+		// setRampRate() rate, in no more than 0.5db per write,
+		// whatever speed loop() happens to be called at.
+
+	void setRampRate(uint16_t mdb_per_ms);
+		// 0 turns ramping off, so the setters write immediately.
+	uint16_t getRampRate()	{ return m_ramp_rate; }
 
 	// unimplmented orthogonal base class control API
 
@@ -258,7 +333,8 @@ public:
 
 
 	// TONE_CONTROL
-	// PEQ(1) not supported by MIDI
+	// PEQ(1) is supported by MIDI with the SGTL_CC_PEQ_XXX CCs above
+	// and its changes are ramped by loop() in small steps.
 	// For the other two, TONE(2) and GEQ(3), in order to avoid pops,
 	// the changes are automated to occur in no more than 0.5db steps.
 	// Hence, this SGTL5000 has a loop() method that must be called to
@@ -275,10 +351,28 @@ public:
 				// The parametric equalizer is implemented using 7 cascaded, second order
 				// bi-quad filters whose frequencies, gain, and Q may be freely configured,
 				// but each filter can only be specified as a set of filter coefficients.
+			bool loadPeqBank(const int coef[7][5]);
+				// Loads all 7 filters (b0,b1,b2,a1,a2 as from calcBiquad)
+				// and enables them, in 21 queued I2C transactions.
 			uint16_t eqFilterCount(uint8_t n);
 				// Enables zero or more of the already configured parametric filters.
+
+			bool setPeqCount(uint8_t n);	// 0..7
+				// loads filters 0..n-1 from the current PEQ parameters
+				// and then enables them.
+			bool setPeqParam(uint8_t filter_num, uint8_t param, uint8_t val);
+				// param is PEQ_PARAM_TYPE..PEQ_PARAM_Q, val is 0..127 per
+				// the CC scales above.  Type changes take effect immediately,
+				// the others are ramped by loop().
+			uint8_t getPeqCount();
+			uint8_t getPeqParam(uint8_t filter_num, uint8_t param);
 			void calcBiquad(uint8_t filtertype, float fC, float dB_Gain, float Q, uint32_t quantization_unit, uint32_t fS, int *coef);
-				// Helper method to build filter parameters
+				// Helper method to build filter parameters.
+				// Uses the compile time tables in biquadTables.h at AUDIO_SAMPLE_RATE_EXACT,
+				// 20Hz..20kHz, and -48..+48dB, so it is quick enough to call at MIDI rates.
+				// There is no pow() or sinf()/cosf(), but it still divides by Q, by A for
+				// PARAEQ, and by a0 to normalize.  The tables are good to 7e-4 in cos(w0),
+				// see biquadTables.h.
 		// TONE_CONTROLS (2) Enables bass and treble tone controls
 		// GRAPHIC_EQUALIZER (3) Enables the five-band graphic equalizer
 			bool setEqBand(uint8_t band_num, uint8_t val, bool force = false);	// 0..95 (0x5F)
@@ -301,42 +395,174 @@ public:
 		// all setters are defined
 		// getCC returns -1 for unknown CC numbers,
 		//		255 for write only or mondadic commands
+		// Both go through the descriptor table in sgtl5000.cpp,
+		// except for the PEQ parameters, which are computed.
+	bool isCommandCC(uint8_t cc);
+	bool isContinuousCC(uint8_t cc);
+		// the ramped ones (CC_AUTO_RAMP, and the PEQ freq, gain and Q),
+		// which are the only ones coalesced by TE3_hub
+	int getCCMax(uint8_t cc);
+		// the largest valid value, -1 for unknown CC numbers
+	int snapshotCCs(uint8_t *ccs, uint8_t *vals, int max_ccs);
+		// every readable CC and its value, returns the number filled in
+	int applyScene(const uint8_t *ccs, const uint8_t *vals, int count);
+		// Scene recall.  Compares each value to the current one (from
+		// the shadow), and applies only the ones that differ, with the
+		// ramps off, in one burst between a mute and an unmute of the
+		// outputs.  Single register writes to the same register are
+		// merged in the I2C queue, but PEQ coefficient bursts are not.
+		// The mutes are queued before the ramps in progress are
+		// finished.  MUTE_HP and MUTE_LINEOUT in the scene become the
+		// final mute state, and RAMP_RATE in the scene the ramp rate
+		// after the recall.  Returns the number of CCs that changed.
 
 	// debugging support
 
 	void dumpCCValues(const char *where);		// debugging dump of everything
 
+	void getI2CStats(uint32_t *count, uint32_t *fails, uint32_t *max_us, bool clear = true);
+		// number of read()/write() transactions, how many failed, and the
+		// longest one in microseconds, since the last clear.  Counting is
+		// a couple of register reads per transaction, and never displays.
+		// Writes are counted when the queue actually finishes them.
+
+	void setWriteCallback(i2cQueueDoneFxn fxn, void *obj)
+		{ m_write_fxn = fxn; m_write_obj = obj; }
+		// optional client callback, called from the I2C interrupt
+		// as each queued register write completes or fails.
+	bool flushWrites()	{ return m_queue.flush(); }
+		// wait until all queued writes are on the chip
+
 
 protected:
 
+	// CC descriptor table, see ccTable.h
+
+	friend struct sgtlCCTable;
+	friend struct sgtlRampDefs;
+
+	typedef bool (SGTL5000::*ccSetter_t)(uint8_t val);
+	typedef uint8_t (SGTL5000::*ccGetter_t)();
+
+	typedef struct
+	{
+		uint8_t cc;
+		uint8_t max;
+		uint8_t flags;
+		uint8_t automation;
+		const char *name;
+		ccSetter_t set;
+		ccGetter_t get;
+		uint8_t ramp;
+			// RAMP_XXX for the CC_AUTO_RAMP CCs that own a register
+			// field, RAMP_NONE for the rest, including the "both"
+			// setters, which just call the left and right ones
+		sgtlRampDef_t field;
+	} ccDesc_t;
+
+	// adapters for the CCs that do not map to a one
+	// parameter setter, or a no parameter getter
+
+	bool ccDump(uint8_t val)			{ dumpCCValues("from dump_sgtl command"); return 1; }
+	bool ccSetDefaults(uint8_t val)		{ return setDefaults(); }
+	bool ccSetEqBand0(uint8_t val)		{ return setEqBand(0,val); }
+	bool ccSetEqBand1(uint8_t val)		{ return setEqBand(1,val); }
+	bool ccSetEqBand2(uint8_t val)		{ return setEqBand(2,val); }
+	bool ccSetEqBand3(uint8_t val)		{ return setEqBand(3,val); }
+	bool ccSetEqBand4(uint8_t val)		{ return setEqBand(4,val); }
+	uint8_t ccGetEqBand0()				{ return getEqBand(0); }
+	uint8_t ccGetEqBand1()				{ return getEqBand(1); }
+	uint8_t ccGetEqBand2()				{ return getEqBand(2); }
+	uint8_t ccGetEqBand3()				{ return getEqBand(3); }
+	uint8_t ccGetEqBand4()				{ return getEqBand(4); }
+	bool ccSetRampRate(uint8_t val)		{ setRampRate(val * 10); return 1; }
+	uint8_t ccGetRampRate()				{ return m_ramp_rate / 10; }
+
 	uint8_t m_i2c_addr;
 
+	// telemetry
+
+	volatile uint32_t m_i2c_count;
+	volatile uint32_t m_i2c_fails;
+	volatile uint32_t m_i2c_max_cycles;
+	void countI2C(uint32_t cycles, bool ok);
+
+	// queued writes
+
+	i2cQueue m_queue;
+	i2cQueueDoneFxn m_write_fxn;
+	void *m_write_obj;
+	volatile uint32_t m_write_errors;
+	volatile uint16_t m_error_reg;
+	volatile uint16_t m_error_val;
+	uint32_t m_errors_reported;
+	static void onWriteDone(void *obj, uint16_t reg, uint16_t val, bool ok, uint32_t cycles);
+
 	bool m_hp_muted;
 	bool m_lineout_muted;
-	uint16_t m_ana_ctrl;
 
-	// automation variables
+	uint32_t m_scene_start;
+		// micros() of the last applyScene(), until loop()
+		// sees the queue go idle and reports how long it took
+
+	// register shadow
+
+	uint16_t m_shadow[SGTL5000_NUM_REGS];
+		// a copy of every register from CHIP_ID (0x0000)
+		// through DAP_COEF_WR_A2_LSB (0x013A)
+	uint16_t shadow(uint16_t reg_num)	{ return m_shadow[reg_num >> 1]; }
+	void readShadow();
+		// fills the shadow from the chip, called once by enable()
+
+	// PEQ parameters, ramped from m_peq_value
+	// to m_peq_target by loop()
+
+	uint8_t m_peq_value[SGTL_PEQ_FILTERS][PEQ_NUM_PARAMS];
+	uint8_t m_peq_target[SGTL_PEQ_FILTERS][PEQ_NUM_PARAMS];
+
+	void initPeq();
+	void loadPeqFilter(uint8_t filter_num);
+	bool handlePeqAutomation(uint8_t filter_num);
+		// returns true when the filter reaches its target
+
+	// ramp scheduler
 	// note that the user must call loop()
 
-	uint8_t m_band_value[5];
-	uint8_t m_band_target[5];
-	volatile uint8_t m_in_automation;
-		// bitwise bands that need automation
-		// with 1<<6 as a busy flag
+	uint16_t m_ramp_rate;
+		// milli-dB per millisecond
+	uint32_t m_ramp_active;
+		// bitwise NUM_RAMP_ITEMS that need automation
+	uint8_t m_ramp_next;
+		// round robin starting point for loop()
+	uint8_t m_ramp_target[NUM_RAMPS];
+		// register field values
+	uint16_t m_ramp_credit[NUM_RAMP_ITEMS];
+		// milli-dB earned but not yet spent
+	uint32_t m_ramp_time[NUM_RAMP_ITEMS];
+		// micros() of the last credit
+
+	bool setRamp(uint8_t ramp, uint8_t field);
+	uint8_t getRamp(uint8_t ramp);
+		// target if ramping, else the current field value
+	void startRamp(uint8_t item);
+	bool handleRamp(uint8_t ramp, uint32_t credit);
+		// returns true when the ramp reaches its target
+	void runRamps();
 
 	bool write(uint16_t reg_num, uint16_t val);
-		// returns 0 on failure, 1 on success
+		// Updates the shadow and queues the write, which goes out
+		// to the chip from the I2C interrupt.  Returns 0 only if the
+		// queue is stuck.  Actual bus failures are reported by loop().
 	uint16_t read(uint16_t reg_num);
 		// note that API cannot differentiate between
-		// a read failure, and read of a register containing zero
+		// a read failure, and read of a register containing zero.
+		// Always goes to the chip; the getters use shadow() instead.
+		// Blocks until all queued writes are finished.
+	bool writeBurst(uint16_t reg_num, const uint16_t *vals, uint8_t count);
+		// consecutive registers in one I2C transaction, updates the shadow
 	bool modify(uint16_t reg_num, uint16_t val, uint16_t mask);
 		// returns 1 if the write() succeeds, or zero if it fails.
-		// can fail to function properly and still return 1 due to
-		// API limitation of read()
-
-	// utilities
-
-	void handleEqAutomation(uint8_t band_num);
+		// uses the shadow, so it is a single I2C transaction
 
 };
 
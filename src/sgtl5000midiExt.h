@@ -0,0 +1,39 @@
+//-------------------------------------------------------
+// sgtl5000midiExt.h
+//-------------------------------------------------------
+// The SGTL5000 CCs that src/sgtl5000.cpp adds after SGTL_CC_MAX in
+// sgtl5000midi.h, for TE3 to include after sgtl5000midi.h, so that
+// both sides name them from the same place.  Only defines.
+// sgtl5000.cpp checks that they all stay within 0..127.
+//
+// Each of the SGTL_PEQ_FILTERS parametric EQ filters has four CCs,
+// all 0..127:
+//
+//		TYPE	FILTER_LOPASS(0) .. FILTER_HISHELF(6), default FILTER_PARAEQ
+//		FREQ	log scale, 20Hz * 1000^(val/127), so 64 = about 650Hz
+//		GAIN	(val-64)/4 dB, -16dB to +15.75dB, 64 = 0dB
+//		Q		(val+1)/10, 0.1 to 12.8, default 6 = 0.7
+//
+// PEQ_COUNT is the number of enabled filters 0..7, written to DAP_PEQ.
+// FREQ, GAIN, and Q changes are ramped by loop().
+
+#pragma once
+
+
+#define SGTL_PEQ_FILTERS				7
+
+#define SGTL_CC_PEQ_BASE				(SGTL_CC_MAX + 1)
+#define SGTL_CC_PEQ_COUNT				(SGTL_CC_PEQ_BASE)
+#define SGTL_CC_PEQ_TYPE(f)				(SGTL_CC_PEQ_BASE + 1 + (f)*4)
+#define SGTL_CC_PEQ_FREQ(f)				(SGTL_CC_PEQ_BASE + 2 + (f)*4)
+#define SGTL_CC_PEQ_GAIN(f)				(SGTL_CC_PEQ_BASE + 3 + (f)*4)
+#define SGTL_CC_PEQ_Q(f)				(SGTL_CC_PEQ_BASE + 4 + (f)*4)
+#define SGTL_CC_PEQ_MAX					(SGTL_CC_PEQ_Q(SGTL_PEQ_FILTERS-1))
+
+#define SGTL_CC_RAMP_RATE				(SGTL_CC_PEQ_MAX + 1)
+	// 0..127 in 0.01 dB/ms, 0 = no ramping, default 10 = 0.1dB/ms
+
+#define SGTL_CC_LAST					(SGTL_CC_RAMP_RATE)
+
+
+// end of sgtl5000midiExt.h
@@ -0,0 +1,259 @@
+//-------------------------------------------------------
+// stereoMixer.cpp
+//-------------------------------------------------------
+// See stereoMixer.h.  The samples stay packed two per word.
+// SMLAWB/SMLAWT multiply a 32 bit value by the bottom/top half of a
+// packed gain pair and add the top 32 bits of the 48 bit product.
+// The sample goes in one bit below the top of the 32 bit operand, so
+// each accumulator ends up as sample * gain * 2^13, which leaves room
+// for all four channels at full scale and full gain.
+
+#include "stereoMixer.h"
+#include <dspinst.h>
+
+
+int32_t AudioStereoMixCore::toQ22(float gain)
+{
+	if (gain > STEREO_MIXER_MAX_GAIN)
+		gain = STEREO_MIXER_MAX_GAIN;
+	else if (gain < -STEREO_MIXER_MAX_GAIN)
+		gain = -STEREO_MIXER_MAX_GAIN;
+	return (int32_t) (gain * (16384 << 8));
+}
+
+
+void AudioStereoMixerBase::gain(unsigned int channel, float gain)
+{
+	if (channel >= m_num_channels)
+		return;
+	m_target[channel] = toQ22(gain);
+}
+
+
+void AudioStereoMixerBase::gainNow(unsigned int channel, float gain)
+{
+	if (channel >= m_num_channels)
+		return;
+	__disable_irq();
+	m_gain[channel] = m_target[channel] = toQ22(gain);
+	__enable_irq();
+}
+
+
+static void mixRamp(int32_t *acc_L, int32_t *acc_R,
+	const audio_block_t *in_L, const audio_block_t *in_R,
+	int32_t gain, int32_t step)
+	// one channel of both sides into the accumulators,
+	// two samples per pass.  Either block may be NULL.
+{
+	const uint32_t *src_L = in_L ? (const uint32_t *) in_L->data : NULL;
+	const uint32_t *src_R = in_R ? (const uint32_t *) in_R->data : NULL;
+
+	for (int i=0; i<AUDIO_BLOCK_SAMPLES/2; i++)
+	{
+		int32_t g0 = gain >> 8;
+		gain += step;
+		int32_t g1 = gain >> 8;
+		gain += step;
+		uint32_t gains = pack_16b_16b(g1,g0);
+
+		if (src_L)
+		{
+			uint32_t pair = *src_L++;
+			acc_L[0] = signed_multiply_accumulate_32x16b(acc_L[0],((int32_t) (pair << 16)) >> 1,gains);
+			acc_L[1] = signed_multiply_accumulate_32x16t(acc_L[1],((int32_t) (pair & 0xffff0000)) >> 1,gains);
+		}
+		if (src_R)
+		{
+			uint32_t pair = *src_R++;
+			acc_R[0] = signed_multiply_accumulate_32x16b(acc_R[0],((int32_t) (pair << 16)) >> 1,gains);
+			acc_R[1] = signed_multiply_accumulate_32x16t(acc_R[1],((int32_t) (pair & 0xffff0000)) >> 1,gains);
+		}
+		acc_L += 2;
+		acc_R += 2;
+	}
+}
+
+
+static void pack(audio_block_t *out, const int32_t *acc)
+{
+	uint32_t *dst = (uint32_t *) out->data;
+	for (int i=0; i<AUDIO_BLOCK_SAMPLES/2; i++)
+	{
+		int32_t s0 = signed_saturate_rshift(acc[0],16,13);
+		int32_t s1 = signed_saturate_rshift(acc[1],16,13);
+		*dst++ = pack_16b_16b(s1,s0);
+		acc += 2;
+	}
+}
+
+
+void AudioStereoMixCore::mixOutput(audio_block_t **in_L, audio_block_t **in_R, int num,
+	int32_t *gain, const int32_t *target, uint8_t output)
+{
+	int32_t acc_L[AUDIO_BLOCK_SAMPLES];
+	int32_t acc_R[AUDIO_BLOCK_SAMPLES];
+	audio_block_t *pass_L = NULL;
+	audio_block_t *pass_R = NULL;
+	int num_active = 0;
+
+	for (int ch=0; ch<num; ch++)
+	{
+		int32_t cur = gain[ch];
+		int32_t step = (target[ch] - cur) / AUDIO_BLOCK_SAMPLES;
+		gain[ch] = target[ch];
+			// the remainder of the division is well under one Q14 lsb
+
+		if ((in_L[ch] || in_R[ch]) && (cur || target[ch]))
+		{
+			// hold on to the first active channel in case it
+			// turns out to be the only one and can be passed
+			// straight through.  Mix it in when a second one
+			// shows up.
+
+			if (num_active == 0 && in_L[ch] && in_R[ch] &&
+				cur == ONE_Q22 && target[ch] == ONE_Q22)
+			{
+				pass_L = in_L[ch];
+				pass_R = in_R[ch];
+				num_active++;
+				continue;
+			}
+
+			if (num_active == 0 || pass_L)
+			{
+				memset(acc_L,0,sizeof(acc_L));
+				memset(acc_R,0,sizeof(acc_R));
+			}
+			if (pass_L)
+			{
+				mixRamp(acc_L,acc_R,pass_L,pass_R,ONE_Q22,0);
+				pass_L = pass_R = NULL;
+			}
+			mixRamp(acc_L,acc_R,in_L[ch],in_R[ch],cur,step);
+			num_active++;
+		}
+	}
+
+	if (pass_L)
+	{
+		transmit(pass_L,output);
+		transmit(pass_R,output + 1);
+		return;
+	}
+	if (!num_active)
+		return;
+
+	audio_block_t *out_L = allocate();
+	audio_block_t *out_R = allocate();
+	if (out_L)
+	{
+		pack(out_L,acc_L);
+		transmit(out_L,output);
+		release(out_L);
+	}
+	if (out_R)
+	{
+		pack(out_R,acc_R);
+		transmit(out_R,output + 1);
+		release(out_R);
+	}
+}
+
+
+void AudioStereoMixCore::releaseInputs(audio_block_t **in_L, audio_block_t **in_R, int num)
+{
+	for (int i=0; i<num; i++)
+	{
+		if (in_L[i]) release(in_L[i]);
+		if (in_R[i]) release(in_R[i]);
+	}
+}
+
+
+//-----------------------------------
+// AudioStereoMixerBase
+//-----------------------------------
+
+void AudioStereoMixerBase::update(void)
+{
+	audio_block_t *in_L[STEREO_MATRIX_MAX_SRCS];
+	audio_block_t *in_R[STEREO_MATRIX_MAX_SRCS];
+	int32_t target[STEREO_MATRIX_MAX_SRCS];
+
+	for (int ch=0; ch<m_num_channels; ch++)
+	{
+		in_L[ch] = receiveReadOnly(ch * 2);
+		in_R[ch] = receiveReadOnly(ch * 2 + 1);
+		target[ch] = m_target[ch];
+	}
+
+	mixOutput(in_L,in_R,m_num_channels,m_gain,target,0);
+
+	releaseInputs(in_L,in_R,m_num_channels);
+}
+
+
+//-----------------------------------
+// AudioStereoMatrixBase
+//-----------------------------------
+
+void AudioStereoMatrixBase::gain(unsigned int src, unsigned int dst, float gain)
+{
+	if (src >= m_num_srcs || dst >= m_num_dsts)
+		return;
+	m_level[dst * m_num_srcs + src] = toQ22(gain);
+}
+
+
+void AudioStereoMatrixBase::route(unsigned int src, unsigned int dst, bool on)
+{
+	if (src >= m_num_srcs || dst >= m_num_dsts)
+		return;
+	m_route[dst * m_num_srcs + src] = on;
+}
+
+
+bool AudioStereoMatrixBase::routed(unsigned int src, unsigned int dst)
+{
+	if (src >= m_num_srcs || dst >= m_num_dsts)
+		return false;
+	return m_route[dst * m_num_srcs + src];
+}
+
+
+void AudioStereoMatrixBase::update(void)
+{
+	audio_block_t *in_L[STEREO_MATRIX_MAX_SRCS];
+	audio_block_t *in_R[STEREO_MATRIX_MAX_SRCS];
+	int32_t target[STEREO_MATRIX_MAX_SRCS];
+
+	for (int src=0; src<m_num_srcs; src++)
+	{
+		in_L[src] = receiveReadOnly(src * 2);
+		in_R[src] = receiveReadOnly(src * 2 + 1);
+	}
+
+	for (int dst=0; dst<m_num_dsts; dst++)
+	{
+		// skip the whole destination if nothing
+		// is routed to it, or still ramping down
+
+		int32_t *gain = &m_gain[dst * m_num_srcs];
+		bool any = false;
+		for (int src=0; src<m_num_srcs; src++)
+		{
+			int i = dst * m_num_srcs + src;
+			target[src] = m_route[i] ? m_level[i] : 0;
+			if (target[src] || gain[src])
+				any = true;
+		}
+		if (any)
+			mixOutput(in_L,in_R,m_num_srcs,gain,target,dst * 2);
+	}
+
+	releaseInputs(in_L,in_R,m_num_srcs);
+}
+
+
+// end of stereoMixer.cpp
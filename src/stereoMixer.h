@@ -0,0 +1,207 @@
+//-------------------------------------------------------
+// stereoMixer.h
+//-------------------------------------------------------
+// A stereo N channel mixer, to replace pairs of AudioMixer4's,
+// with the gain ramped per sample across each block.
+//
+// AudioMixer4::gain() takes effect at the next block boundary, so a
+// pedal sweep on a TEHUB_CC_MIX_* turns into a staircase of gain steps
+// every 2.9ms, which is the zipper noise.  Here gain() only sets a
+// target, and update() moves linearly from the current gain to the
+// target over the 128 samples of the next block, so every change is
+// a smooth ramp, no matter how coarse the CCs are.
+//
+// Inputs are in left/right pairs: channel n is inputs 2n (left) and
+// 2n+1 (right), with the same gain on both.  Output 0 is left and 1 is
+// right.  Both sides of a channel are mixed in the same pass, sharing
+// the gain ramp, using the M7's DSP SMLAWB/SMLAWT instructions on two
+// packed samples at a time.  One update() and one pair of output blocks
+// does what two mixers, and two pairs of blocks, did before.
+//
+// If only one channel has any input, at a steady unity gain, its
+// blocks are passed straight through, with no math and no allocation.
+//
+// AudioStereoMixer<N> only holds the input queue and gain arrays,
+// so each size costs nothing but its storage.  All of the code is in
+// the non-template AudioStereoMixerBase.
+//
+// Gains are Q14 internally, so the range is about -2.0 to +2.0.
+//
+// AudioStereoMatrix<NUM_SRCS,NUM_DSTS> is the same thing as a routing
+// matrix.  Inputs are stereo sources, as above, and outputs 2d and 2d+1
+// are stereo destination d.  Each crosspoint has a gain, and a route
+// that turns it on or off at runtime.  Turning a route off ramps it to
+// zero over the next block, and on again ramps it up from zero, so the
+// change is click free and happens at a block boundary.  Crosspoints
+// that are off (and done ramping) are skipped, and a destination with
+// none on transmits nothing at all, so it allocates no blocks and uses
+// no CPU, and whatever it feeds sees silence.  Each destination is mixed
+// exactly like an AudioStereoMixer, including the unity pass-through.
+
+#pragma once
+
+#include <Arduino.h>
+#include <AudioStream.h>
+
+
+#define STEREO_MIXER_MAX_GAIN	1.99f
+#define STEREO_MATRIX_MAX_SRCS	8
+
+#define STEREO_L(channel)		((channel) * 2)
+#define STEREO_R(channel)		((channel) * 2 + 1)
+	// AudioConnection input numbers
+
+
+class AudioStereoMixCore : public AudioStream
+	// what the mixer and the matrix have in common
+{
+protected:
+
+	static const int32_t ONE_Q22 = 16384 << 8;
+		// Q14 gain, with 8 more bits for the per-sample step
+
+	AudioStereoMixCore(uint8_t num_inputs, audio_block_t **queue) :
+		AudioStream(num_inputs, queue) {}
+
+	static int32_t toQ22(float gain);
+
+	void mixOutput(audio_block_t **in_L, audio_block_t **in_R, int num,
+			int32_t *gain, const int32_t *target, uint8_t output);
+		// mix num stereo inputs, ramping each gain[] to its target[],
+		// and transmit the result on output and output+1.
+		// The caller releases the inputs.
+	static void releaseInputs(audio_block_t **in_L, audio_block_t **in_R, int num);
+
+};
+
+
+class AudioStereoMixerBase : public AudioStereoMixCore
+{
+public:
+
+	virtual void update(void);
+
+	void gain(unsigned int channel, float gain);
+		// sets the target, reached over the next block
+	void gainNow(unsigned int channel, float gain);
+		// no ramp, for setup()
+
+protected:
+
+	AudioStereoMixerBase(uint8_t num_channels, audio_block_t **queue,
+			int32_t *gains, volatile int32_t *targets) :
+		AudioStereoMixCore(num_channels * 2, queue),
+		m_num_channels(num_channels),
+		m_gain(gains),
+		m_target(targets)
+	{
+		for (int i=0; i<num_channels; i++)
+		{
+			m_gain[i] = m_target[i] = ONE_Q22;
+		}
+	}
+
+private:
+
+	uint8_t m_num_channels;
+	int32_t *m_gain;
+		// only touched by update()
+	volatile int32_t *m_target;
+		// written by gain() in loop()
+
+};
+
+
+template <uint8_t NUM_CHANNELS>
+class AudioStereoMixer : public AudioStereoMixerBase
+{
+public:
+
+	AudioStereoMixer() :
+		AudioStereoMixerBase(NUM_CHANNELS, m_queue, m_gains, m_targets)
+	{
+		static_assert(NUM_CHANNELS <= STEREO_MATRIX_MAX_SRCS, "too many AudioStereoMixer channels");
+	}
+
+private:
+
+	audio_block_t *m_queue[NUM_CHANNELS * 2];
+	int32_t m_gains[NUM_CHANNELS];
+	volatile int32_t m_targets[NUM_CHANNELS];
+
+};
+
+
+typedef AudioStereoMixer<4> AudioStereoMixer4;
+
+
+class AudioStereoMatrixBase : public AudioStereoMixCore
+{
+public:
+
+	virtual void update(void);
+
+	void gain(unsigned int src, unsigned int dst, float gain);
+		// the level of a crosspoint while it is routed
+	void route(unsigned int src, unsigned int dst, bool on);
+	bool routed(unsigned int src, unsigned int dst);
+
+protected:
+
+	AudioStereoMatrixBase(uint8_t num_srcs, uint8_t num_dsts, audio_block_t **queue,
+			int32_t *gains, volatile int32_t *levels, volatile bool *routes) :
+		AudioStereoMixCore(num_srcs * 2, queue),
+		m_num_srcs(num_srcs),
+		m_num_dsts(num_dsts),
+		m_gain(gains),
+		m_level(levels),
+		m_route(routes)
+	{
+		for (int i=0; i<num_srcs * num_dsts; i++)
+		{
+			m_gain[i] = 0;
+			m_level[i] = ONE_Q22;
+			m_route[i] = false;
+		}
+	}
+
+private:
+
+	uint8_t m_num_srcs;
+	uint8_t m_num_dsts;
+
+	// all indexed by dst * m_num_srcs + src,
+	// so each destination is one contiguous column
+
+	int32_t *m_gain;
+		// only touched by update()
+	volatile int32_t *m_level;
+		// written by gain() in loop()
+	volatile bool *m_route;
+		// written by route() in loop()
+
+};
+
+
+template <uint8_t NUM_SRCS, uint8_t NUM_DSTS>
+class AudioStereoMatrix : public AudioStereoMatrixBase
+{
+public:
+
+	AudioStereoMatrix() :
+		AudioStereoMatrixBase(NUM_SRCS, NUM_DSTS, m_queue, m_gains, m_levels, m_routes)
+	{
+		static_assert(NUM_SRCS <= STEREO_MATRIX_MAX_SRCS, "too many AudioStereoMatrix sources");
+	}
+
+private:
+
+	audio_block_t *m_queue[NUM_SRCS * 2];
+	int32_t m_gains[NUM_SRCS * NUM_DSTS];
+	volatile int32_t m_levels[NUM_SRCS * NUM_DSTS];
+	volatile bool m_routes[NUM_SRCS * NUM_DSTS];
+
+};
+
+
+// end of stereoMixer.h
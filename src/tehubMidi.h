@@ -0,0 +1,47 @@
+//-------------------------------------------------------
+// tehubMidi.h
+//-------------------------------------------------------
+// The TEHUB CCs that the hub adds after TEHUB_CC_MAX in teCommon.h,
+// for TE3 to include after teCommon.h, so that both sides name them
+// from the same place instead of hard-coding offsets.  Only defines,
+// nothing here depends on how the hub was built.  TE3_hub.ino checks
+// that they all stay within 0..127, up to TEHUB_CC_LAST.
+//
+// Whether a CC does anything depends on the build (WITH_CONFIG_STORE,
+// WITH_ROUTER, USB_AUDIO_CHANNELS), but its number never does.
+
+#pragma once
+
+
+#define TEHUB_CC_TELEMETRY			(TEHUB_CC_MAX + 1)
+	// telemetry period in 100ms units, 0 = off (default)
+#define TEHUB_CC_USB_TRACE			(TEHUB_CC_MAX + 2)
+	// command, send the USB trace as SysEx
+#define TEHUB_CC_SAVE_CONFIG		(TEHUB_CC_MAX + 3)
+	// command, save the configuration to EEPROM
+
+// router sources and destinations, each a stereo
+// pair of router inputs or outputs
+
+#define ROUTE_SRC_IN				0		// SGTL5000 LINE_IN
+#define ROUTE_SRC_USB				1		// the iPad, usb_in 0,1
+#define ROUTE_SRC_LOOP				2		// the rPi Looper return, i2s_in 2,3
+#define ROUTE_SRC_SINE				3		// the sine, or the latency probe if MEASURE_LATENCY
+#define ROUTE_SRC_USB2				4		// usb_in 2,3, 4 channel builds only
+#define ROUTE_DST_CODEC				0		// SGTL5000 LINE_OUT / headphones
+#define ROUTE_DST_USB				1		// to the iPad, usb_out 0,1
+#define ROUTE_DST_LOOP				2		// the rPi Looper send, i2s_out 2,3
+#define ROUTE_DST_USB2				3		// usb_out 2,3, 4 channel builds only
+
+#define ROUTE_MAX_SRCS				5
+#define ROUTE_MAX_DSTS				4
+	// of any build, so the TEHUB_CC_ROUTE numbers
+	// do not depend on USB_AUDIO_CHANNELS
+
+#define TEHUB_CC_ROUTE(src, dst)	(TEHUB_CC_MAX + 4 + (src) * ROUTE_MAX_DSTS + (dst))
+	// one on/off CC per router crosspoint
+
+#define TEHUB_CC_LAST				(TEHUB_CC_ROUTE(ROUTE_MAX_SRCS - 1, ROUTE_MAX_DSTS - 1))
+
+
+// end of tehubMidi.h
@@ -0,0 +1,547 @@
+//-------------------------------------------------------
+// usbAudio.cpp
+//-------------------------------------------------------
+// See usbAudio.h.  This follows the structure of the core
+// usb_audio.cpp, rx_event(), sync_event() and tx_event() on the
+// isochronous endpoints, and the blocks handed to and from the
+// audio update() under __disable_irq(), but the samples are
+// (un)packed straight between the USB buffers and the audio blocks
+// for any USB_AUDIO_SUBFRAME, and the packet sizes come from
+// USB_AUDIO_RATE instead of the hardwired 44 and 45 frames.
+//
+// usb_out is an adaptive endpoint, so the host takes whatever we
+// send.  Sending the nominal rate, like the core does, slowly walks
+// off against the I2S clock, so update() keeps track of how many frames
+// are left whenever a new block comes in, and transmit_callback() adds
+// or drops one frame per packet to keep that around half a block.
+
+#include "usbAudio.h"
+#include <Arduino.h>
+#include <AudioStream.h>
+
+
+static_assert((int) AUDIO_SAMPLE_RATE_EXACT == USB_AUDIO_RATE,
+	"USB_AUDIO_RATE must match AUDIO_SAMPLE_RATE_EXACT, see usbAudio.h");
+
+
+#if !USB_AUDIO_CORE
+
+#include <usb_dev.h>
+
+
+#define NOMINAL_FEEDBACK	((uint32_t) (USB_AUDIO_RATE / 1000.0 * 16777216.0))
+	// samples per ms * 2^24, see usbDrift.cpp
+#define UNDERRUN_BUMP		3500
+	// same as the core
+
+#ifndef FEATURE_MAX_VOLUME
+	#define FEATURE_MAX_VOLUME	0xFF
+#endif
+
+
+struct usb_audio_setup_t
+	// the setup packet as the feature requests see it
+{
+	uint8_t bmRequestType;
+	uint8_t bRequest;
+	uint8_t bChannel;
+	uint8_t bCS;
+	uint8_t bIfEp;
+	uint8_t bEntityId;
+	uint16_t wLength;
+};
+
+
+// the core usb_audio.cpp globals that _usb.c and usbDrift.cpp use
+
+uint32_t feedback_accumulator;
+volatile uint32_t usb_audio_underrun_count;
+volatile uint32_t usb_audio_overrun_count;
+
+extern "C" {
+	uint8_t usb_audio_receive_setting = 0;
+	uint8_t usb_audio_transmit_setting = 0;
+	extern volatile uint8_t usb_high_speed;			// _usb.c
+}
+
+static struct
+{
+	int change;
+	int mute;
+	int volume;
+} features = {0,0,FEATURE_MAX_VOLUME/2};
+
+
+DMAMEM static transfer_t rx_transfer __attribute__ ((used, aligned(32)));
+DMAMEM static transfer_t sync_transfer __attribute__ ((used, aligned(32)));
+DMAMEM static transfer_t tx_transfer __attribute__ ((used, aligned(32)));
+DMAMEM static uint8_t rx_buffer[(USB_AUDIO_RX_SIZE + 31) & ~31] __attribute__ ((aligned(32)));
+DMAMEM static uint8_t tx_buffer[(USB_AUDIO_TX_SIZE + 31) & ~31] __attribute__ ((aligned(32)));
+DMAMEM static uint32_t sync_feedback __attribute__ ((aligned(32)));
+
+static uint8_t sync_nbytes;
+static uint8_t sync_rshift;
+static uint32_t tx_phase;
+	// USB_AUDIO_RATE * ms, modulo 1000
+
+
+//-----------------------------------
+// sample packing
+//-----------------------------------
+// USB audio is little endian, with the channels interleaved in each
+// frame.  At 16 bits every frame starts on a word boundary in the
+// (aligned) USB buffers, so a pair of channels is one 32 bit load or
+// store.  For 24 bits our 16 bit sample is the top two bytes.
+
+static inline void unpack(const uint8_t *data, audio_block_t **blocks, unsigned int at, unsigned int frames)
+{
+	#if USB_AUDIO_SUBFRAME == 2
+		const uint32_t *p = (const uint32_t *) data;
+		for (unsigned int i=at; i<at+frames; i++)
+		{
+			for (int ch=0; ch<USB_AUDIO_CHANNELS; ch+=2)
+			{
+				uint32_t pair = *p++;
+				blocks[ch]->data[i] = pair;
+				blocks[ch+1]->data[i] = pair >> 16;
+			}
+		}
+	#else
+		for (unsigned int i=at; i<at+frames; i++)
+		{
+			for (int ch=0; ch<USB_AUDIO_CHANNELS; ch++)
+			{
+				blocks[ch]->data[i] = (int16_t) (data[1] | (data[2] << 8));
+				data += USB_AUDIO_SUBFRAME;
+			}
+		}
+	#endif
+}
+
+
+static inline void pack(uint8_t *data, audio_block_t **blocks, unsigned int at, unsigned int frames)
+{
+	#if USB_AUDIO_SUBFRAME == 2
+		uint32_t *p = (uint32_t *) data;
+		for (unsigned int i=at; i<at+frames; i++)
+		{
+			for (int ch=0; ch<USB_AUDIO_CHANNELS; ch+=2)
+			{
+				*p++ = (uint16_t) blocks[ch]->data[i] |
+					((uint32_t) (uint16_t) blocks[ch+1]->data[i] << 16);
+			}
+		}
+	#else
+		for (unsigned int i=at; i<at+frames; i++)
+		{
+			for (int ch=0; ch<USB_AUDIO_CHANNELS; ch++)
+			{
+				uint16_t s = blocks[ch]->data[i];
+				*data++ = 0;
+				*data++ = s & 0xff;
+				*data++ = s >> 8;
+			}
+		}
+	#endif
+}
+
+
+bool AudioUSBStream::allocateBlocks(audio_block_t **blocks)
+{
+	for (int ch=0; ch<USB_AUDIO_CHANNELS; ch++)
+	{
+		blocks[ch] = allocate();
+		if (!blocks[ch])
+		{
+			while (ch--)
+			{
+				release(blocks[ch]);
+				blocks[ch] = NULL;
+			}
+			return false;
+		}
+	}
+	return true;
+}
+
+
+void AudioUSBStream::releaseBlocks(audio_block_t **blocks)
+{
+	for (int ch=0; ch<USB_AUDIO_CHANNELS; ch++)
+	{
+		if (blocks[ch])
+			release(blocks[ch]);
+		blocks[ch] = NULL;
+	}
+}
+
+
+//-----------------------------------
+// endpoints
+//-----------------------------------
+
+static void rx_event(transfer_t *t)
+{
+	if (t)
+	{
+		int len = USB_AUDIO_RX_SIZE - ((rx_transfer.status >> 16) & 0x7FFF);
+		AudioInputUSBStream::receive_callback(len);
+	}
+	usb_prepare_transfer(&rx_transfer, rx_buffer, USB_AUDIO_RX_SIZE, 0);
+	arm_dcache_delete(rx_buffer, sizeof(rx_buffer));
+	usb_receive(AUDIO_RX_ENDPOINT, &rx_transfer);
+}
+
+
+static void sync_event(transfer_t *t)
+	// USB 2.0 Specification, 5.12.4.2 Feedback, pages 73-75
+{
+	sync_feedback = feedback_accumulator >> sync_rshift;
+	usb_prepare_transfer(&sync_transfer, &sync_feedback, sync_nbytes, 0);
+	arm_dcache_flush(&sync_feedback, sync_nbytes);
+	usb_transmit(AUDIO_SYNC_ENDPOINT, &sync_transfer);
+}
+
+
+static void tx_event(transfer_t *t)
+{
+	int len = AudioOutputUSBStream::transmit_callback();
+	usb_prepare_transfer(&tx_transfer, tx_buffer, len, 0);
+	arm_dcache_flush_delete(tx_buffer, sizeof(tx_buffer));
+	usb_transmit(AUDIO_TX_ENDPOINT, &tx_transfer);
+}
+
+
+extern "C" void usb_audio_configure(void)
+	// from _usb.c on SET_CONFIGURATION
+{
+	usb_audio_underrun_count = 0;
+	usb_audio_overrun_count = 0;
+	feedback_accumulator = NOMINAL_FEEDBACK;
+	tx_phase = 0;
+
+	if (usb_high_speed)
+	{
+		sync_nbytes = 4;
+		sync_rshift = 8;
+	}
+	else
+	{
+		sync_nbytes = 3;
+		sync_rshift = 10;
+	}
+
+	memset(&rx_transfer, 0, sizeof(rx_transfer));
+	usb_config_rx_iso(AUDIO_RX_ENDPOINT, USB_AUDIO_RX_SIZE, 1, rx_event);
+	rx_event(NULL);
+	memset(&sync_transfer, 0, sizeof(sync_transfer));
+	usb_config_tx_iso(AUDIO_SYNC_ENDPOINT, sync_nbytes, 1, sync_event);
+	sync_event(NULL);
+	memset(&tx_transfer, 0, sizeof(tx_transfer));
+	usb_config_tx_iso(AUDIO_TX_ENDPOINT, USB_AUDIO_TX_SIZE, 1, tx_event);
+	tx_event(NULL);
+}
+
+
+//-----------------------------------
+// feature unit (host volume and mute)
+//-----------------------------------
+// Same as the core.  The UnitID, channel and so on are not checked.
+
+extern "C" int usb_audio_get_feature(void *stp, uint8_t *data, uint32_t *datalen)
+{
+	const usb_audio_setup_t *setup = (const usb_audio_setup_t *) stp;
+	if (setup->bmRequestType == 0xA1)
+	{
+		if (setup->bCS == 0x01)			// mute
+		{
+			data[0] = features.mute;
+			*datalen = 1;
+			return 1;
+		}
+		if (setup->bCS == 0x02)			// volume
+		{
+			int value =
+				setup->bRequest == 0x81 ? features.volume :		// GET_CUR
+				setup->bRequest == 0x83 ? FEATURE_MAX_VOLUME :	// GET_MAX
+				setup->bRequest == 0x84 ? 1 : 0;				// GET_RES, GET_MIN
+			data[0] = value & 0xff;
+			data[1] = (value >> 8) & 0xff;
+			*datalen = 2;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+extern "C" int usb_audio_set_feature(void *stp, uint8_t *buf)
+{
+	const usb_audio_setup_t *setup = (const usb_audio_setup_t *) stp;
+	if (setup->bmRequestType == 0x21 &&
+		setup->bRequest == 0x01)		// SET_CUR
+	{
+		if (setup->bCS == 0x01)
+		{
+			features.mute = buf[0];
+			features.change = 1;
+			return 1;
+		}
+		if (setup->bCS == 0x02)
+		{
+			features.volume = buf[0];
+			features.change = 1;
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+//-----------------------------------
+// AudioInputUSBStream
+//-----------------------------------
+
+audio_block_t *AudioInputUSBStream::s_incoming[USB_AUDIO_CHANNELS];
+audio_block_t *AudioInputUSBStream::s_ready[USB_AUDIO_CHANNELS];
+uint16_t AudioInputUSBStream::s_incoming_count;
+uint8_t AudioInputUSBStream::s_receive_flag;
+
+
+float AudioInputUSBStream::volume()
+{
+	if (features.mute)
+		return 0.0;
+	return (float) features.volume / (float) FEATURE_MAX_VOLUME;
+}
+
+
+void AudioInputUSBStream::receive_callback(unsigned int len)
+{
+	s_receive_flag = 1;
+
+	const uint8_t *data = rx_buffer;
+	unsigned int frames = len / USB_AUDIO_FRAME_BYTES;
+	unsigned int count = s_incoming_count;
+
+	if (!s_incoming[0] && !allocateBlocks(s_incoming))
+		return;
+
+	while (frames)
+	{
+		unsigned int avail = AUDIO_BLOCK_SAMPLES - count;
+		if (frames < avail)
+		{
+			unpack(data,s_incoming,count,frames);
+			s_incoming_count = count + frames;
+			return;
+		}
+
+		unpack(data,s_incoming,count,avail);
+		data += avail * USB_AUDIO_FRAME_BYTES;
+		frames -= avail;
+		count = AUDIO_BLOCK_SAMPLES;
+
+		if (s_ready[0])
+		{
+			// overrun, the host is sending too fast
+			s_incoming_count = count;
+			if (frames)
+				usb_audio_overrun_count++;
+			return;
+		}
+
+		for (int ch=0; ch<USB_AUDIO_CHANNELS; ch++)
+			s_ready[ch] = s_incoming[ch];
+		count = 0;
+		if (!allocateBlocks(s_incoming))
+			break;
+	}
+	s_incoming_count = count;
+}
+
+
+void AudioInputUSBStream::update(void)
+{
+	audio_block_t *blocks[USB_AUDIO_CHANNELS];
+
+	__disable_irq();
+	for (int ch=0; ch<USB_AUDIO_CHANNELS; ch++)
+	{
+		blocks[ch] = s_ready[ch];
+		s_ready[ch] = NULL;
+	}
+	uint16_t count = s_incoming_count;
+	uint8_t flag = s_receive_flag;
+	s_receive_flag = 0;
+	__enable_irq();
+
+	// the core's buffer centering, that usbDrift
+	// folds into its offset
+
+	if (flag)
+		feedback_accumulator += AUDIO_BLOCK_SAMPLES/2 - (int) count;
+
+	if (!blocks[0])
+	{
+		usb_audio_underrun_count++;
+		if (flag)
+			feedback_accumulator += UNDERRUN_BUMP;
+		return;
+	}
+
+	for (int ch=0; ch<USB_AUDIO_CHANNELS; ch++)
+	{
+		transmit(blocks[ch],ch);
+		release(blocks[ch]);
+	}
+}
+
+
+//-----------------------------------
+// AudioOutputUSBStream
+//-----------------------------------
+
+audio_block_t *AudioOutputUSBStream::s_first[USB_AUDIO_CHANNELS];
+audio_block_t *AudioOutputUSBStream::s_second[USB_AUDIO_CHANNELS];
+uint16_t AudioOutputUSBStream::s_offset;
+int16_t AudioOutputUSBStream::s_level = AUDIO_BLOCK_SAMPLES / 2;
+
+
+void AudioOutputUSBStream::update(void)
+{
+	audio_block_t *blocks[USB_AUDIO_CHANNELS];
+	audio_block_t *dropped[USB_AUDIO_CHANNELS];
+
+	bool ok = true;
+	for (int ch=0; ch<USB_AUDIO_CHANNELS; ch++)
+	{
+		blocks[ch] = receiveReadOnly(ch);
+		dropped[ch] = NULL;
+	}
+
+	if (!usb_audio_transmit_setting)
+	{
+		releaseBlocks(blocks);
+		__disable_irq();
+		for (int ch=0; ch<USB_AUDIO_CHANNELS; ch++)
+		{
+			dropped[ch] = s_first[ch];
+			s_first[ch] = NULL;
+			blocks[ch] = s_second[ch];
+			s_second[ch] = NULL;
+		}
+		s_offset = 0;
+		__enable_irq();
+		releaseBlocks(dropped);
+		releaseBlocks(blocks);
+		return;
+	}
+
+	// unconnected channels send silence
+
+	for (int ch=0; ch<USB_AUDIO_CHANNELS && ok; ch++)
+	{
+		if (!blocks[ch])
+		{
+			blocks[ch] = allocate();
+			if (blocks[ch])
+				memset(blocks[ch]->data,0,sizeof(blocks[ch]->data));
+			else
+				ok = false;
+		}
+	}
+	if (!ok)
+	{
+		releaseBlocks(blocks);
+		return;
+	}
+
+	__disable_irq();
+
+	// what is left just before a block arrives, smoothed,
+	// which is what transmit_callback() steers on.
+
+	int level = s_first[0] ? AUDIO_BLOCK_SAMPLES - s_offset : 0;
+	if (s_second[0])
+		level += AUDIO_BLOCK_SAMPLES;
+	s_level += (level - s_level) / 4;
+
+	if (!s_first[0])
+	{
+		for (int ch=0; ch<USB_AUDIO_CHANNELS; ch++)
+			s_first[ch] = blocks[ch];
+		s_offset = 0;
+	}
+	else if (!s_second[0])
+	{
+		for (int ch=0; ch<USB_AUDIO_CHANNELS; ch++)
+			s_second[ch] = blocks[ch];
+	}
+	else
+	{
+		// the host is not keeping up, drop the oldest
+		for (int ch=0; ch<USB_AUDIO_CHANNELS; ch++)
+		{
+			dropped[ch] = s_first[ch];
+			s_first[ch] = s_second[ch];
+			s_second[ch] = blocks[ch];
+		}
+		s_offset = 0;
+	}
+	__enable_irq();
+	releaseBlocks(dropped);
+}
+
+
+unsigned int AudioOutputUSBStream::transmit_callback(void)
+{
+	// the nominal number of frames for this millisecond,
+	// nudged by one to keep the queue centred
+
+	tx_phase += USB_AUDIO_RATE;
+	unsigned int target = tx_phase / 1000;
+	tx_phase -= target * 1000;
+
+	if (s_level > AUDIO_BLOCK_SAMPLES * 3 / 4)
+		target++;
+	else if (s_level < AUDIO_BLOCK_SAMPLES / 4)
+		target--;
+
+	unsigned int len = 0;
+	while (len < target)
+	{
+		if (!s_first[0])
+		{
+			// underrun, the host is taking more than we have
+			memset(tx_buffer + len * USB_AUDIO_FRAME_BYTES,0,(target - len) * USB_AUDIO_FRAME_BYTES);
+			break;
+		}
+
+		unsigned int num = target - len;
+		unsigned int avail = AUDIO_BLOCK_SAMPLES - s_offset;
+		if (num > avail)
+			num = avail;
+		pack(tx_buffer + len * USB_AUDIO_FRAME_BYTES,s_first,s_offset,num);
+		len += num;
+		s_offset += num;
+
+		if (s_offset >= AUDIO_BLOCK_SAMPLES)
+		{
+			for (int ch=0; ch<USB_AUDIO_CHANNELS; ch++)
+			{
+				AudioStream::release(s_first[ch]);
+				s_first[ch] = s_second[ch];
+				s_second[ch] = NULL;
+			}
+			s_offset = 0;
+		}
+	}
+	return target * USB_AUDIO_FRAME_BYTES;
+}
+
+
+#endif	// !USB_AUDIO_CORE
+
+
+// end of usbAudio.cpp
@@ -0,0 +1,170 @@
+//-------------------------------------------------------
+// usbAudio.h
+//-------------------------------------------------------
+// The USB audio stream format, and the stream objects that
+// replace Paul's AudioInputUSB and AudioOutputUSB when it is not
+// his fixed 16 bit / 44.1 kHz stereo.
+//
+// This is included by _usb_desc.c and _usb.c (C) for the descriptors
+// and the GET_CUR sample rate, and by TE3_hub.ino (C++) for the objects,
+// so the options have to live here, like USB_TRACE in usbTrace.h.
+//
+// USB_AUDIO_RATE has to match the rate that the audio library (and so
+// the I2S clocks and the SGTL5000) runs at, AUDIO_SAMPLE_RATE_EXACT.
+// Like AUDIO_BLOCK_SAMPLES that has to be the same in the core and every
+// library, so it goes in the build flags (-DAUDIO_SAMPLE_RATE_EXACT=48000.0f
+// in platform.local.txt for the IDE), and usbAudio.cpp just checks that
+// it was.  Everything else, the biquad tables, the SGTL5000 SYS_FS and
+// PLL, and the usbDrift nominal rate, follow AUDIO_SAMPLE_RATE_EXACT.
+//
+// At the default 16 bit / 44.1 kHz the core usb_audio.cpp is used as is.
+// Otherwise usbAudio.cpp defines everything that _usb.c and usbDrift.cpp
+// use from it (usb_audio_configure(), the alternate settings, the feature
+// requests, the feedback_accumulator and the overrun counts), so the core
+// one never gets linked in, the same way _usb.c replaces usb.c.
+//
+// With USB_AUDIO_CHANNELS 4 the stream objects have four inputs or
+// outputs, and the samples are interleaved in each USB frame in channel
+// order, as UAC1 wants, so the host sees one 4 channel device and can
+// record the guitar and the Looper on separate tracks in sync.
+//
+// The audio library itself is 16 bits, so with USB_AUDIO_BITS 24 the
+// 16 bit samples go in the top two bytes of each 3 byte sample and the
+// low byte from the host is dropped.  The point is that the host gets
+// its native format and does not have to convert or resample.
+
+#pragma once
+
+
+#define USB_AUDIO_RATE			44100
+	// 44100, 48000 or 96000
+#define USB_AUDIO_BITS			16
+	// 16, or 24 for packed 3 byte samples
+#define USB_AUDIO_CHANNELS		2
+	// 2, or 4 for all of the i2s quad channels, with the Looper
+	// on channels 2 and 3 both ways (see TE3_hub.ino)
+
+
+#define USB_AUDIO_CORE  (USB_AUDIO_RATE == 44100 && USB_AUDIO_BITS == 16 && USB_AUDIO_CHANNELS == 2)
+	// use Paul's AudioInputUSB and AudioOutputUSB
+
+#define USB_AUDIO_SUBFRAME		(USB_AUDIO_BITS / 8)
+	// bytes per sample
+#define USB_AUDIO_FRAME_BYTES	(USB_AUDIO_CHANNELS * USB_AUDIO_SUBFRAME)
+	// bytes per sample frame (one sample for each channel)
+#if USB_AUDIO_CHANNELS == 2
+	#define USB_AUDIO_CHANNEL_CONFIG	0x0003
+		// left and right front
+#else
+	#define USB_AUDIO_CHANNEL_CONFIG	0x0000
+		// no spatial positions, just four discrete channels
+#endif
+#define USB_AUDIO_FEATURE_SIZE	(7 + 1 + USB_AUDIO_CHANNELS)
+	// the feature unit descriptor, with a master mute
+	// and a volume control for each channel
+#define USB_AUDIO_PACKET_SIZE	((((USB_AUDIO_RATE + 999) / 1000) + 1) * USB_AUDIO_FRAME_BYTES)
+	// one packet per millisecond, with room for one extra frame
+	// for the feedback (usb_in) and the rate matching (usb_out)
+
+#if USB_AUDIO_CORE
+	#define USB_AUDIO_TX_SIZE	AUDIO_TX_SIZE
+	#define USB_AUDIO_RX_SIZE	AUDIO_RX_SIZE
+#else
+	#define USB_AUDIO_TX_SIZE	USB_AUDIO_PACKET_SIZE
+	#define USB_AUDIO_RX_SIZE	USB_AUDIO_PACKET_SIZE
+#endif
+
+
+#if USB_AUDIO_RATE != 44100 && USB_AUDIO_RATE != 48000 && USB_AUDIO_RATE != 96000
+	#error USB_AUDIO_RATE must be 44100, 48000 or 96000
+#endif
+#if USB_AUDIO_BITS != 16 && USB_AUDIO_BITS != 24
+	#error USB_AUDIO_BITS must be 16 or 24
+#endif
+#if USB_AUDIO_CHANNELS != 2 && USB_AUDIO_CHANNELS != 4
+	#error USB_AUDIO_CHANNELS must be 2 or 4
+#endif
+#if USB_AUDIO_PACKET_SIZE > 1023
+	#error USB_AUDIO_PACKET_SIZE is over the 1023 byte isochronous limit
+#endif
+
+
+#ifdef __cplusplus
+#if !USB_AUDIO_CORE
+
+#include <Arduino.h>
+#include <AudioStream.h>
+
+
+class AudioUSBStream : public AudioStream
+	// what the input and output have in common
+{
+protected:
+
+	AudioUSBStream(unsigned char ninput, audio_block_t **iqueue) :
+		AudioStream(ninput,iqueue) {}
+
+	static bool allocateBlocks(audio_block_t **blocks);
+		// one for each channel, all or nothing
+	static void releaseBlocks(audio_block_t **blocks);
+		// and set them to NULL
+
+};
+
+
+class AudioInputUSBStream : public AudioUSBStream
+	// usb_in, host -> hub
+{
+public:
+
+	AudioInputUSBStream() : AudioUSBStream(0,NULL) {}
+
+	virtual void update(void);
+
+	float volume();
+		// the host's volume control on us, 0..1
+
+	static void receive_callback(unsigned int len);
+		// from the USB ISR only
+
+private:
+
+	static audio_block_t *s_incoming[USB_AUDIO_CHANNELS];
+	static audio_block_t *s_ready[USB_AUDIO_CHANNELS];
+	static uint16_t s_incoming_count;
+	static uint8_t s_receive_flag;
+
+};
+
+
+class AudioOutputUSBStream : public AudioUSBStream
+	// usb_out, hub -> host
+{
+public:
+
+	AudioOutputUSBStream() : AudioUSBStream(USB_AUDIO_CHANNELS,m_input_queue) {}
+
+	virtual void update(void);
+
+	static unsigned int transmit_callback(void);
+		// from the USB ISR only, returns the packet length
+
+private:
+
+	audio_block_t *m_input_queue[USB_AUDIO_CHANNELS];
+
+	static audio_block_t *s_first[USB_AUDIO_CHANNELS];
+	static audio_block_t *s_second[USB_AUDIO_CHANNELS];
+	static uint16_t s_offset;
+		// frames of s_first already sent
+	static int16_t s_level;
+		// smoothed frames still queued when a block is added
+
+};
+
+
+#endif	// !USB_AUDIO_CORE
+#endif	// __cplusplus
+
+
+// end of usbAudio.h
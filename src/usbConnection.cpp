@@ -0,0 +1,55 @@
+//-------------------------------------------------------
+// usbConnection.cpp
+//-------------------------------------------------------
+// See usbConnection.h
+
+#include "usbConnection.h"
+#include <myDebug.h>
+
+extern "C" {
+	extern volatile uint8_t usb_configuration;		// _usb.c
+}
+
+usbAudioConnection *usbAudioConnection::s_connections[USB_AUDIO_MAX_CONNECTIONS];
+int usbAudioConnection::s_num_connections = 0;
+bool usbAudioConnection::s_connected = false;
+
+
+usbAudioConnection::usbAudioConnection(
+		AudioStream &source, uint8_t source_output,
+		AudioStream &destination, uint8_t destination_input) :
+	AudioConnection(),
+	m_source(&source),
+	m_destination(&destination),
+	m_source_output(source_output),
+	m_destination_input(destination_input)
+{
+	if (s_num_connections < USB_AUDIO_MAX_CONNECTIONS)
+		s_connections[s_num_connections++] = this;
+}
+
+
+bool usbAudioConnection::task()
+{
+	bool configured = usb_configuration;
+	if (configured == s_connected)
+		return false;
+
+	s_connected = configured;
+	for (int i=0; i<s_num_connections; i++)
+	{
+		usbAudioConnection *c = s_connections[i];
+		if (configured)
+			c->connect(*c->m_source,c->m_source_output,*c->m_destination,c->m_destination_input);
+		else
+			c->disconnect();
+	}
+	display(0,"usb audio %s (%d connections) at %d ms",
+		configured ? "connected" : "disconnected",
+		s_num_connections,
+		millis());
+	return true;
+}
+
+
+// end of usbConnection.cpp
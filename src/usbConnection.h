@@ -0,0 +1,54 @@
+//-------------------------------------------------------
+// usbConnection.h
+//-------------------------------------------------------
+// An AudioConnection that is only made while the USB host
+// has the device configured.
+//
+// Normally setup() waits for my_usb_init() before bringing up the
+// audio, and the graph is fixed at compile time.  With these, the
+// codec and the local monitor path can come up first, and work with
+// no host at all, while USB enumerates in the background.  The
+// constructor just remembers the endpoints.  task(), from loop(),
+// watches usb_configuration (in _usb.c), and connects all of them
+// when the host configures us, and disconnects them all again if it
+// goes away (cable pulled, bus reset), so usb_in and usb_out never
+// feed the graph while there is nothing behind them.
+//
+// Needs the dynamic AudioConnection API (Teensyduino 1.57 or later).
+
+#pragma once
+
+#include <Arduino.h>
+#include <AudioStream.h>
+
+
+#define USB_AUDIO_MAX_CONNECTIONS	16
+
+
+class usbAudioConnection : public AudioConnection
+{
+public:
+
+	usbAudioConnection(
+		AudioStream &source, uint8_t source_output,
+		AudioStream &destination, uint8_t destination_input);
+
+	static bool task();
+		// from loop(), returns true when connected() changes
+	static bool connected()		{ return s_connected; }
+
+private:
+
+	AudioStream *m_source;
+	AudioStream *m_destination;
+	uint8_t m_source_output;
+	uint8_t m_destination_input;
+
+	static usbAudioConnection *s_connections[USB_AUDIO_MAX_CONNECTIONS];
+	static int s_num_connections;
+	static bool s_connected;
+
+};
+
+
+// end of usbConnection.h
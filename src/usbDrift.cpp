@@ -0,0 +1,127 @@
+//-------------------------------------------------------
+// usbDrift.cpp
+//-------------------------------------------------------
+// See usbDrift.h.  The feedback_accumulator is in units of
+// samples per millisecond * 2^24 (739875226 = 44.1 * 2^24),
+// and is shifted down by the core's sync_event() into the
+// 10.14 (full speed) or 16.16 (high speed) feedback format.
+
+#include "usbDrift.h"
+
+extern uint32_t feedback_accumulator;				// core usb_audio.cpp
+extern volatile uint32_t usb_audio_overrun_count;	// core usb_audio.cpp
+
+extern "C" {
+	extern uint8_t usb_audio_receive_setting;		// core usb_audio.cpp
+	extern volatile uint8_t usb_high_speed;			// _usb.c
+}
+
+
+#define DRIFT_SETTLE_FRAMES		(8 * 1000)
+	// measure for one second (in 125us microframes) before
+	// taking over the feedback_accumulator
+#define DRIFT_WINDOW_FRAMES		(1 << 23)
+	// about 17 minutes.  When the totals get this big we
+	// halve them, so the estimate keeps tracking slow
+	// (temperature) drift without losing precision.
+#define DRIFT_OVERRUN_STEP		3500
+	// same size as Paul's underrun bump, in the other direction
+#define DRIFT_OFFSET_LIMIT		(1 << 18)
+	// about +/- 350 ppm of buffer centering on top of the
+	// measured rate, which is way more than it should ever need
+
+#define NOMINAL_FEEDBACK		((uint32_t)(AUDIO_SAMPLE_RATE_EXACT / 1000.0 * 16777216.0))
+
+
+static uint32_t readFrame()
+	// USB1_FRINDEX counts 125us microframes in bits 13:0.
+	// At full speed only bits 13:3 (the frame number) count.
+{
+	uint32_t frame = USB1_FRINDEX & 0x3fff;
+	if (!usb_high_speed)
+		frame &= ~7;
+	return frame;
+}
+
+
+void AudioUsbDrift::reset()
+{
+	m_locked = false;
+	m_last_setting = 0;
+	m_last_frame = 0;
+	m_total_frames = 0;
+	m_total_samples = 0;
+	m_last_overruns = 0;
+	m_last_written = 0;
+	m_estimate = NOMINAL_FEEDBACK;
+	m_offset = 0;
+}
+
+
+int32_t AudioUsbDrift::ratePPM()
+{
+	int64_t diff = (int64_t) m_estimate - (int64_t) NOMINAL_FEEDBACK;
+	return (int32_t) (diff * 1000000 / (int64_t) NOMINAL_FEEDBACK);
+}
+
+
+void AudioUsbDrift::update(void)
+{
+	// start over whenever the host (re)starts streaming to us,
+	// as usb_audio_configure() resets the feedback_accumulator.
+
+	uint8_t setting = usb_audio_receive_setting;
+	if (setting != m_last_setting)
+	{
+		reset();
+		m_last_setting = setting;
+		m_last_frame = readFrame();
+		m_last_overruns = usb_audio_overrun_count;
+		return;
+	}
+	if (!setting)
+		return;
+
+	// count this block against the host's clock
+
+	uint32_t frame = readFrame();
+	m_total_frames += (frame - m_last_frame) & 0x3fff;
+	m_total_samples += AUDIO_BLOCK_SAMPLES;
+	m_last_frame = frame;
+
+	if (m_total_frames >= DRIFT_WINDOW_FRAMES)
+	{
+		m_total_frames >>= 1;
+		m_total_samples >>= 1;
+	}
+	if (m_total_frames < DRIFT_SETTLE_FRAMES)
+		return;
+
+	// samples per ms * 2^24 == (samples * 8 * 2^24) / microframes
+
+	m_estimate = (uint32_t) ((m_total_samples << 27) / m_total_frames);
+
+	// Fold whatever AudioInputUSB::update() just added for buffer
+	// centering (or an underrun) into our offset, and pull it back
+	// down for any overruns since the last block.
+
+	uint32_t fb = feedback_accumulator;
+	if (m_locked)
+		m_offset += (int32_t) (fb - m_last_written);
+
+	uint32_t overruns = usb_audio_overrun_count;
+	m_offset -= (int32_t) (overruns - m_last_overruns) * DRIFT_OVERRUN_STEP;
+	m_last_overruns = overruns;
+
+	if (m_offset > DRIFT_OFFSET_LIMIT)
+		m_offset = DRIFT_OFFSET_LIMIT;
+	if (m_offset < -DRIFT_OFFSET_LIMIT)
+		m_offset = -DRIFT_OFFSET_LIMIT;
+
+	m_last_written = m_estimate + m_offset;
+	feedback_accumulator = m_last_written;
+	m_locked = true;
+}
+
+
+// end of usbDrift.cpp
@@ -0,0 +1,75 @@
+//-------------------------------------------------------
+// usbDrift.h
+//-------------------------------------------------------
+// Clock drift compensation between the USB host and the
+// teensy I2S (quad) audio clock.
+//
+// The host sends usb_in samples at its own (SOF) rate, and the I2S
+// hardware eats them at the teensy audio PLL rate.  Paul's AudioInputUSB
+// steers the feedback endpoint with a tiny (1 per block) term on the buffer
+// fill, and a big bump upwards on every underrun, but does nothing on
+// overruns.  So the feedback value slowly walks off, and we get the steady
+// 1-2 per second overruns (pops) noted in TE3_hub.ino::loop().
+//
+// This object has no inputs or outputs, and no audio passes through it,
+// so it adds no latency.  It MUST be declared after usb_in so that its
+// update() runs right after usb_in's update() in the audio interrupt.
+//
+// Every block it counts the samples the I2S clock consumed against the
+// USB frame counter (USB1_FRINDEX) that is locked to the host's SOFs.
+// That gives the actual I2S sample rate as seen by the host, which is
+// exactly what the feedback endpoint is supposed to report.  It writes
+// that measured rate into the core's feedback_accumulator.  Paul's
+// buffer-centering adjustments (whatever update() added since our last
+// write) are kept as a small clamped offset on top of the measured rate,
+// and overruns pull that offset down the same way he pushes it up on
+// underruns.
+
+#pragma once
+
+#include <Arduino.h>
+#include <AudioStream.h>
+
+
+class AudioUsbDrift : public AudioStream
+{
+public:
+
+	AudioUsbDrift() : AudioStream(0,NULL)
+	{
+		active = true;
+			// not connected to anything, but
+			// we still need update() to be called
+		reset();
+	}
+
+	virtual void update(void);
+
+	// diagnostics, safe to call from loop()
+
+	bool locked()			{ return m_locked; }
+	int32_t ratePPM();
+		// measured I2S rate versus nominal AUDIO_SAMPLE_RATE_EXACT
+	int32_t offset()		{ return m_offset; }
+		// current buffer centering offset in feedback units
+
+private:
+
+	void reset();
+
+	bool m_locked;
+		// true once we have measured long enough to
+		// start writing the feedback_accumulator
+	uint8_t m_last_setting;
+	uint32_t m_last_frame;
+	uint32_t m_total_frames;
+	uint64_t m_total_samples;
+	uint32_t m_last_overruns;
+	uint32_t m_last_written;
+	uint32_t m_estimate;
+	int32_t m_offset;
+
+};
+
+
+// end of usbDrift.h
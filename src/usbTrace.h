@@ -0,0 +1,63 @@
+//-------------------------------------------------------
+// usbTrace.h
+//-------------------------------------------------------
+// An event trace of the USB device stack in _usb.c, for finding
+// out what the USB was doing around an audio pop.
+//
+// With USB_TRACE 1, _usb.c records transfers being primed, ATDTW
+// retries, completions, how long each endpoint's callbacks took, SOFs,
+// setup packets, and bus resets, each stamped with ARM_DWT_CYCCNT, in a
+// ring of USB_TRACE_SIZE events in RAM.  A record is two words, written
+// with the USB interrupts masked, so it costs well under a microsecond.
+//
+// usb_trace_trigger() (TE3_hub.ino calls it on a usb_in underrun or
+// overrun, or from the TEHUB_CC_USB_TRACE command) lets USB_TRACE_POST
+// more events in and then freezes the ring, so it holds what happened
+// both before and after the glitch.  loop() then sends the frozen ring
+// to TE3 as SysEx on the TEHUB_CABLE and re-arms it.
+//
+// An event's info word is (type << 24) | (ep << 16) | arg, where ep is
+// the endpoint number, plus 0x80 for transmit (IN) endpoints.
+
+#pragma once
+
+#include <stdint.h>
+
+#define USB_TRACE				0
+	// 0 compiles all of it out of _usb.c
+#define USB_TRACE_SIZE			256
+	// events, must be a power of two
+#define USB_TRACE_POST			64
+	// events recorded after a trigger
+
+// event types, and what is in arg
+
+#define USB_TRACE_PRIME			1	// 1 if added to a list that was already primed
+#define USB_TRACE_ATDTW			2	// retries of the ATDTW semaphore
+#define USB_TRACE_COMPLETE		3	// transfers completed
+#define USB_TRACE_CALLBACK		4	// cycles for the callbacks, saturated at 0xffff
+#define USB_TRACE_SOF			5	// USB1_FRINDEX
+#define USB_TRACE_SETUP			6	// bmRequestType | (bRequest << 8)
+#define USB_TRACE_RESET			7
+#define USB_TRACE_TRIGGER		8	// the cause given to usb_trace_trigger()
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void usb_trace_trigger(uint16_t cause);
+	// freeze after USB_TRACE_POST more events, if not already triggered
+int usb_trace_frozen(void);
+int usb_trace_count(void);
+	// events in the ring, up to USB_TRACE_SIZE
+void usb_trace_get(int n, uint32_t *cycles, uint32_t *info);
+	// n = 0 is the oldest, only while frozen
+void usb_trace_rearm(void);
+	// clears the ring, and starts recording again
+
+#ifdef __cplusplus
+}
+#endif
+
+
+// end of usbTrace.h